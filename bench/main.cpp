@@ -0,0 +1,405 @@
+//
+//  main.cpp
+//  bmwrapper-bench, end to end benchmarks for the BitMessage wrapper against the mock API server.
+//
+//  Results are written as JSON, to stdout or to the file given with --output.
+//
+
+#include "BitMessage.h"
+#include "base64.h"
+#include "MockBitMessageServer.h"
+
+#include <json/json.h>
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <random>
+#include <csignal>
+
+#ifndef OT_USE_TR1
+#include <chrono>
+#include <thread>
+#else
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#endif
+
+using namespace bmwrapper;
+
+
+typedef std::chrono::steady_clock BenchClock;
+
+
+static double millisSince(BenchClock::time_point started){
+    
+    return std::chrono::duration_cast<std::chrono::microseconds>(BenchClock::now() - started).count() / 1000.0;
+    
+}
+
+
+// Summary of a set of samples, in milliseconds
+static Json::Value summarize(std::vector<double> samples){
+    
+    Json::Value summary;
+    summary["iterations"] = (int)samples.size();
+    
+    if(samples.empty())
+        return summary;
+    
+    std::sort(samples.begin(), samples.end());
+    
+    double total = 0;
+    for(unsigned int x = 0; x < samples.size(); x++)
+        total += samples.at(x);
+    
+    summary["mean_ms"] = total / samples.size();
+    summary["min_ms"] = samples.front();
+    summary["median_ms"] = samples.at(samples.size() / 2);
+    summary["p95_ms"] = samples.at(std::min<std::size_t>(samples.size() - 1, (std::size_t)(samples.size() * 0.95)));
+    summary["max_ms"] = samples.back();
+    
+    return summary;
+    
+}
+
+
+// Blocks until the client's queue has drained, returns false if it didn't within the timeout.
+static bool waitForQueue(BitMessage &client, int timeout){
+    
+    BenchClock::time_point started = BenchClock::now();
+    
+    while(!client.queueIdle()){
+        if(millisSince(started) > timeout)
+            return false;
+        std::chrono::microseconds dura( 100 );
+        OT_THREAD_SLEEP( dura );
+    }
+    
+    return true;
+    
+}
+
+
+static Json::Value rpcStatsJson(RPCStatsSnapshot const& stats){
+    
+    Json::Value methods(Json::objectValue);
+    
+    for(RPCStatsSnapshot::const_iterator it = stats.begin(); it != stats.end(); ++it){
+        Json::Value method;
+        method["calls"] = (Json::UInt64)it->second.calls;
+        method["failures"] = (Json::UInt64)it->second.failures;
+        method["response_bytes"] = (Json::UInt64)it->second.responseBytes;
+        method["mean_latency_us"] = (Json::UInt64)it->second.meanLatencyMicros();
+        method["p95_latency_us"] = (Json::UInt64)it->second.latencyPercentileMicros(95);
+        methods[it->first] = method;
+    }
+    
+    return methods;
+    
+}
+
+
+static Json::Value benchMailbox(MockBitMessageServer &server, std::string const& commstring, int inboxSize, int sendCount){
+    
+    Json::Value result;
+    result["inbox_size"] = inboxSize;
+    
+    int const sentSize = std::max(1, inboxSize / 10);
+    server.resetMailbox(inboxSize, sentSize);
+    result["sent_size"] = sentSize;
+    
+    int const iterations = std::max(3, std::min(20, 100000 / inboxSize));
+    
+    // The constructor's first sync runs under the default response size limit, so it isn't timed.
+    BitMessage client(commstring);
+    BenchClock::time_point started;
+    
+    if(!client.accessible()){
+        std::cerr << "Error: Could not reach the mock server" << std::endl;
+        result["error"] = "server inaccessible";
+        return result;
+    }
+    
+    // Large mailboxes need room to come down in one response.
+    client.setResponseSizeLimit(1024 * 1024 * 1024);
+    client.setTimeout(600000);
+    client.resetRPCStats();
+    
+    
+    // checkMail, from queueing the refresh until the local inbox and outbox have been rebuilt
+    
+    std::vector<double> refresh;
+    for(int x = 0; x < iterations; x++){
+        started = BenchClock::now();
+        client.checkMail();
+        if(!waitForQueue(client, 600000)){
+            result["error"] = "checkMail did not complete";
+            return result;
+        }
+        refresh.push_back(millisSince(started));
+    }
+    result["checkMail"] = summarize(refresh);
+    
+    
+    // Queries against the local copy
+    
+    std::vector<std::pair<std::string, std::string> > identities = client.getLocalAddresses();
+    std::string identity = identities.empty() ? "" : identities.at(0).second;
+    
+    std::vector<double> inbox, unread, allUnread;
+    std::size_t returned = 0;
+    
+    for(int x = 0; x < iterations * 5; x++){
+        
+        started = BenchClock::now();
+        returned += client.getInbox().size();
+        inbox.push_back(millisSince(started));
+        
+        started = BenchClock::now();
+        returned += client.getUnreadMail(identity).size();
+        unread.push_back(millisSince(started));
+        
+        started = BenchClock::now();
+        returned += client.getAllUnreadMail().size();
+        allUnread.push_back(millisSince(started));
+        
+    }
+    
+    result["getInbox"] = summarize(inbox);
+    result["getUnreadMail"] = summarize(unread);
+    result["getAllUnreadMail"] = summarize(allUnread);
+    result["messages_returned"] = (Json::UInt64)returned;
+    
+    
+    // sendMail, queue throughput from the first send until every one has been answered
+    
+    std::vector<std::pair<std::string, std::string> > contacts = client.getRemoteAddresses();
+    std::string contact = contacts.empty() ? identity : contacts.at(0).second;
+    
+    started = BenchClock::now();
+    for(int x = 0; x < sendCount; x++){
+        client.sendMail(NetworkMail(identity, contact, "Benchmark", "Benchmark message body"));
+    }
+    double queued = millisSince(started);
+    
+    if(!waitForQueue(client, 600000)){
+        result["error"] = "sendMail did not complete";
+        return result;
+    }
+    double sent = millisSince(started);
+    
+    Json::Value sendMail;
+    sendMail["messages"] = sendCount;
+    sendMail["queue_ms"] = queued;
+    sendMail["total_ms"] = sent;
+    sendMail["messages_per_second"] = sent > 0 ? sendCount / (sent / 1000.0) : 0;
+    result["sendMail"] = sendMail;
+    
+    result["rpc"] = rpcStatsJson(client.getRPCStats());
+    
+    return result;
+    
+}
+
+
+static Json::Value benchBase64(std::size_t size){
+    
+    std::mt19937 random(size);
+    std::uniform_int_distribution<int> byte(0, 255);
+    
+    std::string plain;
+    plain.reserve(size);
+    for(std::size_t x = 0; x < size; x++)
+        plain += (char)byte(random);
+    
+    // Enough rounds to push about 64MB through each way
+    int const rounds = std::max<std::size_t>(1, (64 * 1024 * 1024) / size);
+    
+    std::string encoded;
+    std::size_t check = 0;
+    
+    BenchClock::time_point started = BenchClock::now();
+    for(int x = 0; x < rounds; x++){
+        encoded = base64(plain).encoded();
+        check += encoded.size();
+    }
+    double encodeMillis = millisSince(started);
+    
+    started = BenchClock::now();
+    for(int x = 0; x < rounds; x++){
+        check += base64(encoded, true).decoded().size();
+    }
+    double decodeMillis = millisSince(started);
+    
+    double megabytes = (double)size * rounds / (1024 * 1024);
+    
+    Json::Value result;
+    result["bytes"] = (Json::UInt64)size;
+    result["rounds"] = rounds;
+    result["encode_mb_per_second"] = encodeMillis > 0 ? megabytes / (encodeMillis / 1000.0) : 0;
+    result["decode_mb_per_second"] = decodeMillis > 0 ? megabytes / (decodeMillis / 1000.0) : 0;
+    result["roundtrip_ok"] = base64(encoded, true).decoded() == plain;
+    result["checksum"] = (Json::UInt64)check;
+    
+    return result;
+    
+}
+
+
+static void usage(const char *name){
+    
+    std::cerr << "Usage: " << name << " [options]" << std::endl
+              << "  --sizes N,N,...     Inbox sizes to run (default 100,1000,10000,100000)" << std::endl
+              << "  --port N            Port for the mock server (default 18442)" << std::endl
+              << "  --transport T       tcp, unix or inproc (default tcp)" << std::endl
+              << "  --message-size N    Plaintext bytes per message body (default 512)" << std::endl
+              << "  --sends N           Messages queued for the sendMail run (default 1000)" << std::endl
+              << "  --latency MS        Latency added to every mock call (default 0)" << std::endl
+              << "  --output FILE       Write the results here instead of stdout" << std::endl;
+    
+}
+
+
+int main(int argc, char **argv){
+    
+    std::vector<int> sizes;
+    std::string output;
+    std::string transport("tcp");
+    int sends = 1000;
+    
+    MockServerOptions options;
+    options.port = 18442;
+    options.messageSize = 512;
+    
+    for(int x = 1; x < argc; x++){
+        
+        std::string option(argv[x]);
+        
+        if(option == "--help" || option == "-h"){
+            usage(argv[0]);
+            return 0;
+        }
+        
+        if(x + 1 >= argc){
+            usage(argv[0]);
+            return 1;
+        }
+        
+        std::string value(argv[++x]);
+        
+        if(option == "--sizes"){
+            std::stringstream list(value);
+            std::string size;
+            while(std::getline(list, size, ','))
+                sizes.push_back(std::atoi(size.c_str()));
+        }
+        else if(option == "--port")
+            options.port = std::atoi(value.c_str());
+        else if(option == "--message-size")
+            options.messageSize = std::atoi(value.c_str());
+        else if(option == "--sends")
+            sends = std::atoi(value.c_str());
+        else if(option == "--latency")
+            options.latency = std::atoi(value.c_str());
+        else if(option == "--output")
+            output = value;
+        else if(option == "--transport")
+            transport = value;
+        else{
+            usage(argv[0]);
+            return 1;
+        }
+        
+    }
+    
+    if(sizes.empty()){
+        sizes.push_back(100);
+        sizes.push_back(1000);
+        sizes.push_back(10000);
+        sizes.push_back(100000);
+    }
+    
+    std::signal(SIGPIPE, SIG_IGN);
+    
+    Json::Value root;
+    root["timestamp"] = (Json::Int64)std::time(nullptr);
+    root["message_size"] = options.messageSize;
+    root["latency_ms"] = options.latency;
+    root["transport"] = transport;
+    
+    if(transport == "unix")
+        options.socketPath = "/tmp/bmwrapper-bench.sock";
+    else if(transport != "tcp" && transport != "inproc"){
+        usage(argv[0]);
+        return 1;
+    }
+    
+    try{
+        
+        options.inboxSize = 0;
+        options.sentSize = 0;
+        
+        MockBitMessageServer server(options);
+        server.start();
+        
+        std::ostringstream commstring;
+        if(transport == "unix"){
+            commstring << "unix:" << options.socketPath << ",0,bench,bench";
+        }
+        else if(transport == "inproc"){
+            registerXmlRPCHandler("bench", &server);
+            commstring << "inproc:bench,0,bench,bench";
+        }
+        else{
+            commstring << "127.0.0.1," << options.port << ",bench,bench";
+        }
+        
+        root["mailbox"] = Json::Value(Json::arrayValue);
+        for(unsigned int x = 0; x < sizes.size(); x++){
+            if(sizes.at(x) <= 0)
+                continue;
+            std::cerr << "Running mailbox benchmarks with " << sizes.at(x) << " messages" << std::endl;
+            root["mailbox"].append(benchMailbox(server, commstring.str(), sizes.at(x), sends));
+        }
+        
+        unregisterXmlRPCHandler("bench");
+        server.stop();
+        
+    }
+    catch(std::exception const& e){
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    
+    std::cerr << "Running base64 benchmarks" << std::endl;
+    
+    root["base64"] = Json::Value(Json::arrayValue);
+    root["base64"].append(benchBase64(64));
+    root["base64"].append(benchBase64(1024));
+    root["base64"].append(benchBase64(64 * 1024));
+    root["base64"].append(benchBase64(1024 * 1024));
+    
+    Json::StyledWriter writer;
+    
+    if(output.empty()){
+        std::cout << writer.write(root);
+    }
+    else{
+        std::ofstream file(output.c_str());
+        if(!file){
+            std::cerr << "Error: Could not open " << output << std::endl;
+            return 1;
+        }
+        file << writer.write(root);
+    }
+    
+    return 0;
+    
+}
@@ -0,0 +1,1076 @@
+//
+//  MockBitMessageServer.cpp
+//
+
+#include "MockBitMessageServer.h"
+#include "base64.h"
+
+#include <json/json.h>
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef OT_USE_TR1
+#include <chrono>
+#include <thread>
+#else
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
+#endif
+
+namespace bmwrapper {
+    
+    
+    typedef xmlrpc_c::value (MockBitMessageServer::*MockHandler)(xmlrpc_c::paramList const&);
+    
+    // Routes a registry method to its handler on the server, through the latency and failure injection.
+    class MockMethod : public xmlrpc_c::method {
+        
+    public:
+        
+        MockMethod(MockBitMessageServer *server, std::string const& methodName, MockHandler handler) : m_server(server), m_methodName(methodName), m_handler(handler) {}
+        
+        void execute(xmlrpc_c::paramList const& params, xmlrpc_c::value * const retval){
+            
+            if(!m_server->beginCall(m_methodName)){
+                *retval = xmlrpc_c::value_string("API Error 0000: Injected failure in " + m_methodName);
+                return;
+            }
+            
+            *retval = (m_server->*m_handler)(params);
+            
+        }
+        
+    private:
+        
+        MockBitMessageServer *m_server;
+        std::string m_methodName;
+        MockHandler m_handler;
+        
+    };
+    
+    
+    static const char s_base58[] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+    
+    
+    // PyBitmessage encodes with Python's base64 codec, which wraps lines at 76 characters.
+    static std::string wrappedBase64(std::string const& plain){
+        
+        std::string encoded = base64(plain).encoded();
+        std::string wrapped;
+        wrapped.reserve(encoded.size() + encoded.size() / 76 + 1);
+        
+        for(std::size_t x = 0; x < encoded.size(); x += 76){
+            wrapped.append(encoded, x, 76);
+            wrapped += '\n';
+        }
+        
+        return wrapped;
+        
+    }
+    
+    
+    // Clients send base64 without line breaks, everything is stored the way PyBitmessage would hand it back.
+    static std::string rewrapped(std::string const& packed){
+        
+        return wrappedBase64(base64(packed, true).decoded());
+        
+    }
+    
+    
+    static std::string toJson(Json::Value const& root){
+        
+        Json::FastWriter writer;
+        return writer.write(root);
+        
+    }
+    
+    
+    static Json::Value inboxJson(MockInboxMessage const& message){
+        
+        Json::Value entry;
+        entry["msgid"] = message.msgid;
+        entry["toAddress"] = message.toAddress;
+        entry["fromAddress"] = message.fromAddress;
+        entry["subject"] = message.subject;
+        entry["message"] = message.message;
+        entry["encodingType"] = message.encodingType;
+        
+        std::ostringstream received;
+        received << message.receivedTime;
+        entry["receivedTime"] = received.str();
+        entry["read"] = message.read ? 1 : 0;
+        
+        return entry;
+        
+    }
+    
+    
+    static Json::Value sentJson(MockSentMessage const& message){
+        
+        Json::Value entry;
+        entry["msgid"] = message.msgid;
+        entry["toAddress"] = message.toAddress;
+        entry["fromAddress"] = message.fromAddress;
+        entry["subject"] = message.subject;
+        entry["message"] = message.message;
+        entry["encodingType"] = message.encodingType;
+        entry["lastActionTime"] = (Json::Int64)message.lastActionTime;
+        entry["status"] = message.status;
+        entry["ackData"] = message.ackData;
+        
+        return entry;
+        
+    }
+    
+    
+    MockBitMessageServer::MockBitMessageServer(MockServerOptions options) : m_options(options), m_server(nullptr), m_listenSocket(-1), m_running(false), m_nextID(1), m_random(std::random_device()()) {
+        
+        registerMethods();
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        populate();
+        mlock.unlock();
+        
+        // Long keepalives so that persistent clients aren't measured reconnecting.
+        // PyBitmessage answers on any path, the client posts to the root.
+        xmlrpc_c::serverAbyss::constrOpt serverOptions;
+        serverOptions.registryP(&m_registry)
+                     .uriPath("/")
+                     .keepaliveTimeout(60)
+                     .keepaliveMaxConn(1000000)
+                     .serverOwnsSignals(false);
+        
+        if(m_options.socketPath.empty())
+            serverOptions.portNumber(m_options.port);
+        else
+            serverOptions.socketFd(listenUnix(m_options.socketPath));
+        
+        m_server = new xmlrpc_c::serverAbyss(serverOptions);
+        
+    }
+    
+    
+    MockBitMessageServer::~MockBitMessageServer(){
+        
+        stop();
+        delete m_server;
+        
+        if(m_listenSocket >= 0){
+            close(m_listenSocket);
+            unlink(m_options.socketPath.c_str());
+        }
+        
+    }
+    
+    
+    int MockBitMessageServer::listenUnix(std::string const& socketPath){
+        
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        
+        if(socketPath.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Unix socket path is too long: " + socketPath);
+        std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+        
+        // Clear out a socket left behind by an earlier run
+        unlink(socketPath.c_str());
+        
+        m_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(m_listenSocket < 0)
+            throw std::runtime_error(std::string("Unable to create Unix socket: ") + std::strerror(errno));
+        
+        if(bind(m_listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(m_listenSocket, 64) != 0){
+            std::string reason(std::strerror(errno));
+            close(m_listenSocket);
+            m_listenSocket = -1;
+            throw std::runtime_error("Unable to listen on " + socketPath + ": " + reason);
+        }
+        
+        return m_listenSocket;
+        
+    }
+    
+    
+    void MockBitMessageServer::processCall(std::string const& callXml, std::string *responseXml){
+        
+        m_registry.processCall(callXml, responseXml);
+        
+    }
+    
+    
+    void MockBitMessageServer::run(){
+        
+        m_server->run();
+        
+    }
+    
+    
+    void MockBitMessageServer::start(){
+        
+        if(m_running){
+            std::cerr << "MockBitMessageServer is already running!" << std::endl;
+            return;
+        }
+        
+        m_running = true;
+        m_thread = OT_THREAD(&MockBitMessageServer::run, this);
+        
+    }
+    
+    
+    void MockBitMessageServer::stop(){
+        
+        if(m_running){
+            m_server->terminate();
+            m_thread.join();
+            m_running = false;
+        }
+        
+    }
+    
+    
+    MockServerOptions MockBitMessageServer::getOptions(){
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        MockServerOptions options(m_options);
+        mlock.unlock();
+        return options;
+        
+    }
+    
+    
+    void MockBitMessageServer::setLatency(int latency, int latencyJitter){
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        m_options.latency = latency;
+        m_options.latencyJitter = latencyJitter;
+        mlock.unlock();
+        
+    }
+    
+    
+    void MockBitMessageServer::setFailureRates(double faultRate, double apiErrorRate){
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        m_options.faultRate = faultRate;
+        m_options.apiErrorRate = apiErrorRate;
+        mlock.unlock();
+        
+    }
+    
+    
+    void MockBitMessageServer::resetMailbox(int inboxSize, int sentSize){
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        m_options.inboxSize = inboxSize;
+        m_options.sentSize = sentSize;
+        populate();
+        mlock.unlock();
+        
+    }
+    
+    
+    int MockBitMessageServer::inboxSize(){
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        int size = m_inbox.size();
+        mlock.unlock();
+        return size;
+        
+    }
+    
+    
+    int MockBitMessageServer::sentSize(){
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        int size = m_sent.size();
+        mlock.unlock();
+        return size;
+        
+    }
+    
+    
+    bool MockBitMessageServer::beginCall(std::string const& methodName){
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        
+        int delay = m_options.latency;
+        if(m_options.latencyJitter > 0)
+            delay += std::uniform_int_distribution<int>(0, m_options.latencyJitter)(m_random);
+        
+        std::uniform_real_distribution<double> roll(0.0, 1.0);
+        bool fault = m_options.faultRate > 0.0 && roll(m_random) < m_options.faultRate;
+        bool apiError = !fault && m_options.apiErrorRate > 0.0 && roll(m_random) < m_options.apiErrorRate;
+        
+        mlock.unlock();
+        
+        if(delay > 0){
+            std::chrono::milliseconds dura( delay );
+            OT_THREAD_SLEEP( dura );
+        }
+        
+        if(fault)
+            throw xmlrpc_c::fault("Injected fault in " + methodName, xmlrpc_c::fault::CODE_INTERNAL);
+        
+        return !apiError;
+        
+    }
+    
+    
+    void MockBitMessageServer::registerMethods(){
+        
+        struct { const char *name; MockHandler handler; } methods[] = {
+            {"helloWorld", &MockBitMessageServer::helloWorld},
+            {"add", &MockBitMessageServer::add},
+            {"getStatus", &MockBitMessageServer::getStatus},
+            {"getAllInboxMessages", &MockBitMessageServer::getAllInboxMessages},
+            {"getAllInboxMessageIds", &MockBitMessageServer::getAllInboxMessageIds},
+            {"getInboxMessageByID", &MockBitMessageServer::getInboxMessageByID},
+            {"trashMessage", &MockBitMessageServer::trashMessage},
+            {"getAllSentMessages", &MockBitMessageServer::getAllSentMessages},
+            {"getSentMessageByID", &MockBitMessageServer::getSentMessageByID},
+            {"getSentMessageByAckData", &MockBitMessageServer::getSentMessageByAckData},
+            {"getSentMessagesBySender", &MockBitMessageServer::getSentMessagesBySender},
+            {"trashSentMessageByAckData", &MockBitMessageServer::trashSentMessageByAckData},
+            {"sendMessage", &MockBitMessageServer::sendMessage},
+            {"sendBroadcast", &MockBitMessageServer::sendBroadcast},
+            {"listAddresses2", &MockBitMessageServer::listAddresses2},
+            {"createRandomAddress", &MockBitMessageServer::createRandomAddress},
+            {"createDeterministicAddresses", &MockBitMessageServer::createDeterministicAddresses},
+            {"getDeterministicAddress", &MockBitMessageServer::getDeterministicAddress},
+            {"deleteAddress", &MockBitMessageServer::deleteAddress},
+            {"decodeAddress", &MockBitMessageServer::decodeAddress},
+            {"createChan", &MockBitMessageServer::createChan},
+            {"joinChan", &MockBitMessageServer::joinChan},
+            {"leaveChan", &MockBitMessageServer::leaveChan},
+            {"listSubscriptions", &MockBitMessageServer::listSubscriptions},
+            {"addSubscription", &MockBitMessageServer::addSubscription},
+            {"deleteSubscription", &MockBitMessageServer::deleteSubscription},
+            {"listAddressBookEntries", &MockBitMessageServer::listAddressBookEntries},
+            {"addAddressBookEntry", &MockBitMessageServer::addAddressBookEntry},
+            {"deleteAddressBookEntry", &MockBitMessageServer::deleteAddressBookEntry}
+        };
+        
+        for(unsigned int x = 0; x < sizeof(methods) / sizeof(methods[0]); x++){
+            m_registry.addMethod(methods[x].name, xmlrpc_c::methodPtr(new MockMethod(this, methods[x].name, methods[x].handler)));
+        }
+        
+    }
+    
+    
+    void MockBitMessageServer::populate(){
+        
+        m_inbox.clear();
+        m_sent.clear();
+        m_addresses.clear();
+        m_subscriptions.clear();
+        m_addressBook.clear();
+        
+        for(int x = 0; x < m_options.addressCount; x++){
+            MockAddress address = {newAddress(), wrappedBase64("Identity " + std::to_string(x)), true, false};
+            m_addresses.push_back(address);
+        }
+        
+        for(int x = 0; x < m_options.subscriptionCount; x++){
+            MockAddress address = {newAddress(), wrappedBase64("Subscription " + std::to_string(x)), true, false};
+            m_subscriptions.push_back(address);
+        }
+        
+        for(int x = 0; x < m_options.addressBookSize; x++){
+            MockAddress address = {newAddress(), wrappedBase64("Contact " + std::to_string(x)), true, false};
+            m_addressBook.push_back(address);
+        }
+        
+        std::time_t now = std::time(nullptr);
+        
+        // Oldest first, the same order PyBitmessage lists them in.
+        for(int x = 0; x < m_options.inboxSize; x++){
+            MockInboxMessage message;
+            message.msgid = newID();
+            message.toAddress = m_addresses.empty() ? newAddress() : m_addresses.at(x % m_addresses.size()).address;
+            message.fromAddress = m_addressBook.empty() ? newAddress() : m_addressBook.at(x % m_addressBook.size()).address;
+            message.subject = wrappedBase64(randomText(m_options.subjectSize));
+            message.message = wrappedBase64(randomText(m_options.messageSize));
+            message.encodingType = 2;
+            message.receivedTime = now - (m_options.inboxSize - x) * 60;
+            message.read = (x % 2) == 0;
+            m_inbox.push_back(message);
+        }
+        
+        for(int x = 0; x < m_options.sentSize; x++){
+            MockSentMessage message;
+            message.msgid = newID();
+            message.toAddress = m_addressBook.empty() ? newAddress() : m_addressBook.at(x % m_addressBook.size()).address;
+            message.fromAddress = m_addresses.empty() ? newAddress() : m_addresses.at(x % m_addresses.size()).address;
+            message.subject = wrappedBase64(randomText(m_options.subjectSize));
+            message.message = wrappedBase64(randomText(m_options.messageSize));
+            message.encodingType = 2;
+            message.lastActionTime = now - (m_options.sentSize - x) * 60;
+            message.status = "ackreceived";
+            message.ackData = newID();
+            m_sent.push_back(message);
+        }
+        
+    }
+    
+    
+    std::string MockBitMessageServer::newID(){
+        
+        // A running counter keeps them unique, the rest is only there to look the part.
+        std::ostringstream id;
+        id << std::hex;
+        id.width(16);
+        id.fill('0');
+        id << m_nextID++;
+        
+        std::uniform_int_distribution<int> digit(0, 15);
+        for(int x = 0; x < 48; x++)
+            id << digit(m_random);
+        
+        return id.str();
+        
+    }
+    
+    
+    std::string MockBitMessageServer::newAddress(){
+        
+        std::uniform_int_distribution<int> digit(0, 57);
+        
+        std::string address("BM-2c");
+        for(int x = 0; x < 32; x++)
+            address += s_base58[digit(m_random)];
+        
+        return address;
+        
+    }
+    
+    
+    std::string MockBitMessageServer::randomText(int length){
+        
+        static const char letters[] = "abcdefghijklmnopqrstuvwxyz        ";
+        std::uniform_int_distribution<int> letter(0, sizeof(letters) - 2);
+        
+        std::string text;
+        text.reserve(length);
+        for(int x = 0; x < length; x++)
+            text += letters[letter(m_random)];
+        
+        return text;
+        
+    }
+    
+    
+    MockInboxMessage* MockBitMessageServer::findInbox(std::string const& msgid){
+        
+        for(unsigned int x = 0; x < m_inbox.size(); x++){
+            if(m_inbox.at(x).msgid == msgid)
+                return &m_inbox.at(x);
+        }
+        return nullptr;
+        
+    }
+    
+    
+    MockSentMessage* MockBitMessageServer::findSent(std::string const& msgid){
+        
+        for(unsigned int x = 0; x < m_sent.size(); x++){
+            if(m_sent.at(x).msgid == msgid)
+                return &m_sent.at(x);
+        }
+        return nullptr;
+        
+    }
+    
+    
+    bool MockBitMessageServer::ownAddress(std::string const& address){
+        
+        for(unsigned int x = 0; x < m_addresses.size(); x++){
+            if(m_addresses.at(x).address == address)
+                return true;
+        }
+        return false;
+        
+    }
+    
+    
+    /*
+     * API Methods
+     */
+    
+    
+    xmlrpc_c::value MockBitMessageServer::helloWorld(xmlrpc_c::paramList const& params){
+        
+        return xmlrpc_c::value_string(params.getString(0) + "-" + params.getString(1));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::add(xmlrpc_c::paramList const& params){
+        
+        return xmlrpc_c::value_int(params.getInt(0) + params.getInt(1));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getStatus(xmlrpc_c::paramList const& params){
+        
+        std::string ackData = params.getString(0);
+        std::string status = "notfound";
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_sent.size(); x++){
+            if(m_sent.at(x).ackData == ackData){
+                status = m_sent.at(x).status;
+                break;
+            }
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(status);
+        
+    }
+    
+    
+    // Inbox
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getAllInboxMessages(xmlrpc_c::paramList const& params){
+        
+        Json::Value root;
+        root["inboxMessages"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_inbox.size(); x++){
+            root["inboxMessages"].append(inboxJson(m_inbox.at(x)));
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getAllInboxMessageIds(xmlrpc_c::paramList const& params){
+        
+        Json::Value root;
+        root["inboxMessageIds"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_inbox.size(); x++){
+            Json::Value entry;
+            entry["msgid"] = m_inbox.at(x).msgid;
+            root["inboxMessageIds"].append(entry);
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getInboxMessageByID(xmlrpc_c::paramList const& params){
+        
+        std::string msgid = params.getString(0);
+        
+        Json::Value root;
+        root["inboxMessage"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        MockInboxMessage *message = findInbox(msgid);
+        if(message != nullptr){
+            // The read flag is only touched when it is passed in
+            if(params.size() > 1)
+                message->read = params.getBoolean(1);
+            root["inboxMessage"].append(inboxJson(*message));
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::trashMessage(xmlrpc_c::paramList const& params){
+        
+        std::string msgid = params.getString(0);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_inbox.size(); x++){
+            if(m_inbox.at(x).msgid == msgid){
+                m_inbox.erase(m_inbox.begin() + x);
+                break;
+            }
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string("Trashed message (assuming message existed).");
+        
+    }
+    
+    
+    // Outbox
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getAllSentMessages(xmlrpc_c::paramList const& params){
+        
+        Json::Value root;
+        root["sentMessages"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_sent.size(); x++){
+            root["sentMessages"].append(sentJson(m_sent.at(x)));
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getSentMessageByID(xmlrpc_c::paramList const& params){
+        
+        std::string msgid = params.getString(0);
+        
+        Json::Value root;
+        root["sentMessage"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        MockSentMessage *message = findSent(msgid);
+        if(message != nullptr)
+            root["sentMessage"].append(sentJson(*message));
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getSentMessageByAckData(xmlrpc_c::paramList const& params){
+        
+        std::string ackData = params.getString(0);
+        
+        Json::Value root;
+        root["sentMessage"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_sent.size(); x++){
+            if(m_sent.at(x).ackData == ackData){
+                root["sentMessage"].append(sentJson(m_sent.at(x)));
+                break;
+            }
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getSentMessagesBySender(xmlrpc_c::paramList const& params){
+        
+        std::string fromAddress = params.getString(0);
+        
+        Json::Value root;
+        root["sentMessages"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_sent.size(); x++){
+            if(m_sent.at(x).fromAddress == fromAddress)
+                root["sentMessages"].append(sentJson(m_sent.at(x)));
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::trashSentMessageByAckData(xmlrpc_c::paramList const& params){
+        
+        std::string ackData = params.getString(0);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_sent.size(); x++){
+            if(m_sent.at(x).ackData == ackData){
+                m_sent.erase(m_sent.begin() + x);
+                break;
+            }
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string("Trashed sent message (assuming message existed).");
+        
+    }
+    
+    
+    // Sending
+    
+    
+    xmlrpc_c::value MockBitMessageServer::sendMessage(xmlrpc_c::paramList const& params){
+        
+        MockSentMessage message;
+        message.toAddress = params.getString(0);
+        message.fromAddress = params.getString(1);
+        message.subject = rewrapped(params.getString(2));
+        message.message = rewrapped(params.getString(3));
+        message.encodingType = params.size() > 4 ? params.getInt(4) : 2;
+        message.lastActionTime = std::time(nullptr);
+        
+        // There is no proof of work to wait for, so it goes straight out.
+        message.status = "msgsent";
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        
+        if(!ownAddress(message.fromAddress)){
+            mlock.unlock();
+            return xmlrpc_c::value_string("API Error 0013: Could not find your fromAddress in the keys.dat file.");
+        }
+        
+        message.msgid = newID();
+        message.ackData = newID();
+        m_sent.push_back(message);
+        
+        // Mail to ourselves shows up in our inbox right away
+        if(ownAddress(message.toAddress)){
+            MockInboxMessage received;
+            received.msgid = newID();
+            received.toAddress = message.toAddress;
+            received.fromAddress = message.fromAddress;
+            received.subject = message.subject;
+            received.message = message.message;
+            received.encodingType = message.encodingType;
+            received.receivedTime = message.lastActionTime;
+            received.read = false;
+            m_inbox.push_back(received);
+        }
+        
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(message.ackData);
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::sendBroadcast(xmlrpc_c::paramList const& params){
+        
+        MockSentMessage message;
+        message.toAddress = "[Broadcast subscribers]";
+        message.fromAddress = params.getString(0);
+        message.subject = rewrapped(params.getString(1));
+        message.message = rewrapped(params.getString(2));
+        message.encodingType = params.size() > 3 ? params.getInt(3) : 2;
+        message.lastActionTime = std::time(nullptr);
+        message.status = "broadcastsent";
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        
+        if(!ownAddress(message.fromAddress)){
+            mlock.unlock();
+            return xmlrpc_c::value_string("API Error 0013: Could not find your fromAddress in the keys.dat file.");
+        }
+        
+        message.msgid = newID();
+        message.ackData = newID();
+        m_sent.push_back(message);
+        
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(message.ackData);
+        
+    }
+    
+    
+    // Addresses
+    
+    
+    xmlrpc_c::value MockBitMessageServer::listAddresses2(xmlrpc_c::paramList const& params){
+        
+        Json::Value root;
+        root["addresses"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_addresses.size(); x++){
+            Json::Value entry;
+            entry["label"] = m_addresses.at(x).label;
+            entry["address"] = m_addresses.at(x).address;
+            entry["stream"] = 1;
+            entry["enabled"] = m_addresses.at(x).enabled;
+            entry["chan"] = m_addresses.at(x).chan;
+            root["addresses"].append(entry);
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::createRandomAddress(xmlrpc_c::paramList const& params){
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        MockAddress address = {newAddress(), rewrapped(params.getString(0)), true, false};
+        m_addresses.push_back(address);
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(address.address);
+        
+    }
+    
+    
+    // Deterministic addresses are derived from the passphrase, so asking twice gives the same answer.
+    static std::string deterministicAddress(std::string const& passphrase, int index){
+        
+        std::mt19937 generator(std::hash<std::string>()(passphrase) + index);
+        std::uniform_int_distribution<int> digit(0, 57);
+        
+        std::string address("BM-2c");
+        for(int x = 0; x < 32; x++)
+            address += s_base58[digit(generator)];
+        
+        return address;
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::createDeterministicAddresses(xmlrpc_c::paramList const& params){
+        
+        std::string passphrase = base64(params.getString(0), true).decoded();
+        int count = params.size() > 1 ? params.getInt(1) : 1;
+        
+        Json::Value root;
+        root["addresses"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(int x = 0; x < count; x++){
+            MockAddress address = {deterministicAddress(passphrase, x), wrappedBase64(""), true, false};
+            if(!ownAddress(address.address))
+                m_addresses.push_back(address);
+            root["addresses"].append(address.address);
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::getDeterministicAddress(xmlrpc_c::paramList const& params){
+        
+        return xmlrpc_c::value_string(deterministicAddress(base64(params.getString(0), true).decoded(), 0));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::deleteAddress(xmlrpc_c::paramList const& params){
+        
+        std::string address = params.getString(0);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_addresses.size(); x++){
+            if(m_addresses.at(x).address == address){
+                m_addresses.erase(m_addresses.begin() + x);
+                break;
+            }
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string("success");
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::decodeAddress(xmlrpc_c::paramList const& params){
+        
+        std::string address = params.getString(0);
+        
+        Json::Value root;
+        
+        if(address.compare(0, 3, "BM-") != 0){
+            root["status"] = "invalidcharacters";
+            root["addressVersion"] = 0;
+            root["streamNumber"] = 0;
+            root["ripe"] = "";
+        }
+        else{
+            root["status"] = "success";
+            root["addressVersion"] = 4;
+            root["streamNumber"] = 1;
+            root["ripe"] = wrappedBase64(address.substr(3, 20));
+        }
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    // Chans
+    
+    
+    xmlrpc_c::value MockBitMessageServer::createChan(xmlrpc_c::paramList const& params){
+        
+        std::string passphrase = base64(params.getString(0), true).decoded();
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        MockAddress address = {deterministicAddress(passphrase, 0), wrappedBase64("[chan] " + passphrase), true, true};
+        if(!ownAddress(address.address))
+            m_addresses.push_back(address);
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(address.address);
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::joinChan(xmlrpc_c::paramList const& params){
+        
+        std::string passphrase = base64(params.getString(0), true).decoded();
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        MockAddress address = {params.getString(1), wrappedBase64("[chan] " + passphrase), true, true};
+        if(!ownAddress(address.address))
+            m_addresses.push_back(address);
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string("success");
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::leaveChan(xmlrpc_c::paramList const& params){
+        
+        return deleteAddress(params);
+        
+    }
+    
+    
+    // Subscriptions
+    
+    
+    xmlrpc_c::value MockBitMessageServer::listSubscriptions(xmlrpc_c::paramList const& params){
+        
+        Json::Value root;
+        root["subscriptions"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_subscriptions.size(); x++){
+            Json::Value entry;
+            entry["label"] = m_subscriptions.at(x).label;
+            entry["address"] = m_subscriptions.at(x).address;
+            entry["enabled"] = m_subscriptions.at(x).enabled;
+            root["subscriptions"].append(entry);
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::addSubscription(xmlrpc_c::paramList const& params){
+        
+        MockAddress address = {params.getString(0), params.size() > 1 ? rewrapped(params.getString(1)) : wrappedBase64(""), true, false};
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_subscriptions.size(); x++){
+            if(m_subscriptions.at(x).address == address.address){
+                mlock.unlock();
+                return xmlrpc_c::value_string("API Error 0016: You are already subscribed to that address.");
+            }
+        }
+        m_subscriptions.push_back(address);
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string("Added subscription.");
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::deleteSubscription(xmlrpc_c::paramList const& params){
+        
+        std::string address = params.getString(0);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_subscriptions.size(); x++){
+            if(m_subscriptions.at(x).address == address){
+                m_subscriptions.erase(m_subscriptions.begin() + x);
+                break;
+            }
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string("Deleted subscription if it existed.");
+        
+    }
+    
+    
+    // Address Book
+    
+    
+    xmlrpc_c::value MockBitMessageServer::listAddressBookEntries(xmlrpc_c::paramList const& params){
+        
+        Json::Value root;
+        root["addresses"] = Json::Value(Json::arrayValue);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_addressBook.size(); x++){
+            Json::Value entry;
+            entry["label"] = m_addressBook.at(x).label;
+            entry["address"] = m_addressBook.at(x).address;
+            root["addresses"].append(entry);
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string(toJson(root));
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::addAddressBookEntry(xmlrpc_c::paramList const& params){
+        
+        MockAddress address = {params.getString(0), rewrapped(params.getString(1)), true, false};
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_addressBook.size(); x++){
+            if(m_addressBook.at(x).address == address.address){
+                mlock.unlock();
+                return xmlrpc_c::value_string("API Error 0016: You already have this address in your address book.");
+            }
+        }
+        m_addressBook.push_back(address);
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string("Added address " + address.address + " to address book");
+        
+    }
+    
+    
+    xmlrpc_c::value MockBitMessageServer::deleteAddressBookEntry(xmlrpc_c::paramList const& params){
+        
+        std::string address = params.getString(0);
+        
+        INSTANTIATE_MLOCK(m_mailboxMutex);
+        for(unsigned int x = 0; x < m_addressBook.size(); x++){
+            if(m_addressBook.at(x).address == address){
+                m_addressBook.erase(m_addressBook.begin() + x);
+                break;
+            }
+        }
+        mlock.unlock();
+        
+        return xmlrpc_c::value_string("Deleted address book entry for " + address + " if it existed");
+        
+    }
+    
+}
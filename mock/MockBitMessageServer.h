@@ -0,0 +1,195 @@
+#pragma once
+//
+//  MockBitMessageServer.h
+//
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <random>
+
+#include <xmlrpc-c/base.hpp>
+#include <xmlrpc-c/registry.hpp>
+#include <xmlrpc-c/server_abyss.hpp>
+
+#include "BMThreading.h"
+#include "XmlTransport.h"
+
+namespace bmwrapper {
+    
+    // Shape and behaviour of the mock server, all of it can be changed while the server runs.
+    struct MockServerOptions {
+        
+        MockServerOptions() : port(8442), inboxSize(100), sentSize(100), addressCount(4), subscriptionCount(4), addressBookSize(16), subjectSize(48), messageSize(1024), latency(0), latencyJitter(0), faultRate(0.0), apiErrorRate(0.0) {}
+        
+        int port;
+        
+        // If set, listen on this Unix domain socket instead of the TCP port
+        std::string socketPath;
+        
+        // Mailbox contents generated at startup
+        int inboxSize;
+        int sentSize;
+        int addressCount;
+        int subscriptionCount;
+        int addressBookSize;
+        
+        // Plaintext bytes per generated subject and message body
+        int subjectSize;
+        int messageSize;
+        
+        // Added to every call, in milliseconds
+        int latency;
+        int latencyJitter;
+        
+        // Fraction of calls (0.0 - 1.0) answered with an XML-RPC fault, or with a PyBitmessage "API Error" string
+        double faultRate;
+        double apiErrorRate;
+        
+    };
+    
+    
+    struct MockInboxMessage {
+        std::string msgid;
+        std::string toAddress;
+        std::string fromAddress;
+        std::string subject; // base64, wrapped
+        std::string message; // base64, wrapped
+        int encodingType;
+        std::time_t receivedTime;
+        bool read;
+    };
+    
+    struct MockSentMessage {
+        std::string msgid;
+        std::string toAddress;
+        std::string fromAddress;
+        std::string subject; // base64, wrapped
+        std::string message; // base64, wrapped
+        int encodingType;
+        std::time_t lastActionTime;
+        std::string status;
+        std::string ackData;
+    };
+    
+    struct MockAddress {
+        std::string address;
+        std::string label; // base64, wrapped
+        bool enabled;
+        bool chan;
+    };
+    
+    
+    // A stand-in for the PyBitmessage API server, answering the calls BitMessage makes in the
+    // same formats PyBitmessage uses (JSON documents in strings, base64 wrapped at 76 columns).
+    // There is no proof of work or network behind it, sent messages to one of our own addresses
+    // are delivered straight back to the inbox.
+    //
+    // Basic auth is not checked, any credentials are accepted.
+    //
+    // It can also be registered with registerXmlRPCHandler and reached through "inproc:name",
+    // in which case calls skip HTTP altogether.
+    class MockBitMessageServer : public XmlRPCHandler {
+        
+    public:
+        
+        MockBitMessageServer(MockServerOptions options=MockServerOptions());
+        ~MockBitMessageServer();
+        
+        // Serves on options.port or options.socketPath, run() blocks while start() serves from a background thread.
+        void run();
+        void start();
+        void stop();
+        
+        void processCall(std::string const& callXml, std::string *responseXml);
+        
+        MockServerOptions getOptions();
+        void setLatency(int latency, int latencyJitter=0);
+        void setFailureRates(double faultRate, double apiErrorRate=0.0);
+        
+        // Throws away the mailbox and generates a new one of the given size
+        void resetMailbox(int inboxSize, int sentSize);
+        
+        int inboxSize();
+        int sentSize();
+        
+        // Called by every method before it does its work, applies injected latency and failures.
+        // Returns false if the call should be answered with an API Error instead.
+        bool beginCall(std::string const& methodName);
+        
+        // API Methods
+        
+        xmlrpc_c::value helloWorld(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value add(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value getStatus(xmlrpc_c::paramList const& params);
+        
+        xmlrpc_c::value getAllInboxMessages(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value getAllInboxMessageIds(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value getInboxMessageByID(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value trashMessage(xmlrpc_c::paramList const& params);
+        
+        xmlrpc_c::value getAllSentMessages(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value getSentMessageByID(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value getSentMessageByAckData(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value getSentMessagesBySender(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value trashSentMessageByAckData(xmlrpc_c::paramList const& params);
+        
+        xmlrpc_c::value sendMessage(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value sendBroadcast(xmlrpc_c::paramList const& params);
+        
+        xmlrpc_c::value listAddresses2(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value createRandomAddress(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value createDeterministicAddresses(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value getDeterministicAddress(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value deleteAddress(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value decodeAddress(xmlrpc_c::paramList const& params);
+        
+        xmlrpc_c::value createChan(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value joinChan(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value leaveChan(xmlrpc_c::paramList const& params);
+        
+        xmlrpc_c::value listSubscriptions(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value addSubscription(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value deleteSubscription(xmlrpc_c::paramList const& params);
+        
+        xmlrpc_c::value listAddressBookEntries(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value addAddressBookEntry(xmlrpc_c::paramList const& params);
+        xmlrpc_c::value deleteAddressBookEntry(xmlrpc_c::paramList const& params);
+        
+    private:
+        
+        MockServerOptions m_options;
+        
+        xmlrpc_c::registry m_registry;
+        xmlrpc_c::serverAbyss *m_server;
+        int m_listenSocket; // Only used when serving on a Unix domain socket
+        OT_THREAD m_thread;
+        bool m_running;
+        
+        // Guards everything below, as well as m_options
+        OT_MUTEX(m_mailboxMutex);
+        
+        std::vector<MockInboxMessage> m_inbox;
+        std::vector<MockSentMessage> m_sent;
+        std::vector<MockAddress> m_addresses;
+        std::vector<MockAddress> m_subscriptions;
+        std::vector<MockAddress> m_addressBook;
+        
+        unsigned long long m_nextID;
+        std::mt19937 m_random;
+        
+        void registerMethods();
+        int listenUnix(std::string const& socketPath);
+        void populate(); // Caller holds m_mailboxMutex
+        
+        // Caller holds m_mailboxMutex for all of these
+        std::string newID();
+        std::string newAddress();
+        std::string randomText(int length);
+        MockInboxMessage* findInbox(std::string const& msgid);
+        MockSentMessage* findSent(std::string const& msgid);
+        bool ownAddress(std::string const& address);
+        
+    };
+    
+}
@@ -0,0 +1,97 @@
+//
+//  main.cpp
+//  bmwrapper-mockd, a stand-in PyBitmessage API server for benchmarks and load tests.
+//
+
+#include "MockBitMessageServer.h"
+
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <csignal>
+
+using namespace bmwrapper;
+
+
+static void usage(const char *name){
+    
+    std::cerr << "Usage: " << name << " [options]" << std::endl
+              << "  --port N            Port to listen on (default 8442)" << std::endl
+              << "  --socket PATH       Listen on a Unix domain socket instead of a port" << std::endl
+              << "  --inbox N           Messages in the inbox (default 100)" << std::endl
+              << "  --sent N            Messages in the outbox (default 100)" << std::endl
+              << "  --addresses N       Identities we own (default 4)" << std::endl
+              << "  --message-size N    Plaintext bytes per message body (default 1024)" << std::endl
+              << "  --latency MS        Added to every call (default 0)" << std::endl
+              << "  --jitter MS         Random extra latency, up to MS (default 0)" << std::endl
+              << "  --fault-rate R      Fraction of calls answered with an XML-RPC fault (default 0)" << std::endl
+              << "  --error-rate R      Fraction of calls answered with an API Error string (default 0)" << std::endl;
+    
+}
+
+
+int main(int argc, char **argv){
+    
+    MockServerOptions options;
+    
+    for(int x = 1; x < argc; x++){
+        
+        std::string option(argv[x]);
+        
+        if(option == "--help" || option == "-h"){
+            usage(argv[0]);
+            return 0;
+        }
+        
+        if(x + 1 >= argc){
+            usage(argv[0]);
+            return 1;
+        }
+        
+        const char *value = argv[++x];
+        
+        if(option == "--port")
+            options.port = std::atoi(value);
+        else if(option == "--socket")
+            options.socketPath = value;
+        else if(option == "--inbox")
+            options.inboxSize = std::atoi(value);
+        else if(option == "--sent")
+            options.sentSize = std::atoi(value);
+        else if(option == "--addresses")
+            options.addressCount = std::atoi(value);
+        else if(option == "--message-size")
+            options.messageSize = std::atoi(value);
+        else if(option == "--latency")
+            options.latency = std::atoi(value);
+        else if(option == "--jitter")
+            options.latencyJitter = std::atoi(value);
+        else if(option == "--fault-rate")
+            options.faultRate = std::atof(value);
+        else if(option == "--error-rate")
+            options.apiErrorRate = std::atof(value);
+        else{
+            usage(argv[0]);
+            return 1;
+        }
+        
+    }
+    
+    // The server doesn't own signals, a client hanging up mid-response shouldn't take us down.
+    std::signal(SIGPIPE, SIG_IGN);
+    
+    try{
+        MockBitMessageServer server(options);
+        std::string where = options.socketPath.empty() ? "port " + std::to_string(options.port) : options.socketPath;
+        std::cerr << "Mock BitMessage API server listening on " << where << " with " << server.inboxSize() << " inbox and " << server.sentSize() << " sent messages" << std::endl;
+        server.run();
+    }
+    catch(std::exception const& e){
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    
+    return 0;
+    
+}
@@ -0,0 +1,66 @@
+//
+//  AddressIndex.cpp
+//
+
+#include "AddressIndex.h"
+
+#include <algorithm>
+
+namespace bmwrapper {
+    
+    
+    void AddressIndex::add(std::string const& address, std::string const& label){
+        
+        // An address listed twice keeps its first label
+        if(hasAddress(address))
+            return;
+        
+        m_labels[address] = label;
+        m_addresses[label].push_back(address);
+        
+    }
+    
+    
+    void AddressIndex::erase(std::string const& address){
+        
+        std::unordered_map<std::string, std::string>::iterator it = m_labels.find(address);
+        if(it == m_labels.end())
+            return;
+        
+        std::unordered_map<std::string, std::vector<std::string> >::iterator labelled = m_addresses.find(it->second);
+        if(labelled != m_addresses.end()){
+            
+            std::vector<std::string> &addresses = labelled->second;
+            addresses.erase(std::remove(addresses.begin(), addresses.end(), address), addresses.end());
+            
+            if(addresses.empty())
+                m_addresses.erase(labelled);
+        }
+        
+        m_labels.erase(it);
+        
+    }
+    
+    
+    std::string AddressIndex::label(std::string const& address) const {
+        
+        std::unordered_map<std::string, std::string>::const_iterator it = m_labels.find(address);
+        if(it == m_labels.end())
+            return "";
+        
+        return it->second;
+        
+    }
+    
+    
+    std::string AddressIndex::address(std::string const& label) const {
+        
+        std::unordered_map<std::string, std::vector<std::string> >::const_iterator it = m_addresses.find(label);
+        if(it == m_addresses.end())
+            return "";
+        
+        return it->second.front();
+        
+    }
+    
+}
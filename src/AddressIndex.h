@@ -0,0 +1,63 @@
+#pragma once
+//
+//  AddressIndex.h
+//
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace bmwrapper {
+    
+    // Hash lookups between addresses and their decoded labels, so that finding or checking for a label
+    // doesn't mean decoding every entry's base64 label. Rebuilt whenever the list is refreshed, and kept
+    // up to date by hand for local changes. Labels needn't be unique, a label finds the first address
+    // listed with it.
+    class AddressIndex {
+        
+    public:
+        
+        // Entry has getAddressRef() and a base64 getLabelRef(), as the identities and address book do.
+        template<typename Entry>
+        void rebuild(std::vector<Entry> const& entries){
+            
+            m_labels.clear();
+            m_addresses.clear();
+            
+            m_labels.reserve(entries.size());
+            
+            for(std::size_t x = 0; x < entries.size(); x++)
+                add(entries[x].getAddressRef(), entries[x].getLabelRef().decoded());
+            
+        }
+        
+        void add(std::string const& address, std::string const& label);
+        void erase(std::string const& address);
+        
+        bool hasAddress(std::string const& address) const {return m_labels.find(address) != m_labels.end();}
+        bool hasLabel(std::string const& label) const {return m_addresses.find(label) != m_addresses.end();}
+        
+        // Empty if there is no such address or label.
+        std::string label(std::string const& address) const;
+        std::string address(std::string const& label) const;
+        
+    private:
+        
+        std::unordered_map<std::string, std::string> m_labels; // By address
+        std::unordered_map<std::string, std::vector<std::string> > m_addresses; // By label, in the order listed
+        
+    };
+    
+    
+    
+    // A list of identities or address book entries published together with its index through a Snapshot,
+    // so that readers always see the two from the same refresh.
+    template<typename Entry>
+    struct AddressSnapshot {
+        
+        std::vector<Entry> entries; // As the API listed them
+        AddressIndex index;
+        
+    };
+    
+}
@@ -16,18 +16,23 @@
 #include <functional>
 #include <atomic>
 #include <thread>
+#include <future>
 #define OT_THREAD std::thread
 #define OT_MUTEX(MT) std::mutex MT
 #define OT_THREAD_SLEEP(DURA) std::this_thread::sleep_for(DURA)
 #define INSTANTIATE_MLOCK(MT) std::unique_lock<std::mutex>mlock(MT)
 #define CONDITION_VARIABLE(VAR) std::condition_variable VAR
 #define OT_ATOMIC(THE_ATOM) std::atomic<bool> THE_ATOM
+#define OT_ATOMIC_INT(THE_ATOM) std::atomic<int> THE_ATOM
 #define OT_ATOMIC_TRUE true
 #define OT_ATOMIC_FALSE false
 #define OT_ATOMIC_ISTRUE(THE_VAL) (true == THE_VAL)
 #define OT_ATOMIC_ISFALSE(THE_VAL) (false == THE_VAL)
 #define OT_STD_FUNCTION(FUNC_TYPE) std::function< FUNC_TYPE >
 #define OT_STD_BIND std::bind
+#define OT_STD_PLACEHOLDERS std::placeholders
+#define OT_PROMISE(TYPE) std::promise< TYPE >
+#define OT_FUTURE(TYPE) std::future< TYPE >
 #endif
 
 #ifdef __APPLE__
@@ -36,18 +41,23 @@
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <future>
 #define OT_THREAD std::thread
 #define OT_THREAD_SLEEP(DURA) std::this_thread::sleep_for(DURA)
 #define OT_MUTEX(MT) std::mutex MT
 #define INSTANTIATE_MLOCK(MT) std::unique_lock<std::mutex>mlock(MT)
 #define CONDITION_VARIABLE(VAR) std::condition_variable VAR
 #define OT_ATOMIC(THE_ATOM) std::atomic<bool> THE_ATOM
+#define OT_ATOMIC_INT(THE_ATOM) std::atomic<int> THE_ATOM
 #define OT_ATOMIC_TRUE true
 #define OT_ATOMIC_FALSE false
 #define OT_ATOMIC_ISTRUE(THE_VAL) (true == THE_VAL)
 #define OT_ATOMIC_ISFALSE(THE_VAL) (false == THE_VAL)
 #define OT_STD_FUNCTION(FUNC_TYPE) std::function< FUNC_TYPE >
 #define OT_STD_BIND std::bind
+#define OT_STD_PLACEHOLDERS std::placeholders
+#define OT_PROMISE(TYPE) std::promise< TYPE >
+#define OT_FUTURE(TYPE) std::future< TYPE >
 #endif
 
 #else
@@ -55,6 +65,7 @@
 #include <boost/thread.hpp>
 #include <boost/atomic.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/future.hpp>
 #include <tr1/functional>
 #define OT_THREAD boost::thread
 #define OT_THREAD_SLEEP(DURA) boost::this_thread::sleep_for(DURA)
@@ -62,12 +73,16 @@
 #define INSTANTIATE_MLOCK(MT) boost::unique_lock<boost::mutex>mlock(MT)
 #define CONDITION_VARIABLE(VAR) boost::condition_variable VAR
 #define OT_ATOMIC(THE_ATOM) boost::atomic<bool> THE_ATOM
+#define OT_ATOMIC_INT(THE_ATOM) boost::atomic<int> THE_ATOM
 #define OT_ATOMIC_TRUE 1
 #define OT_ATOMIC_FALSE 0
 #define OT_ATOMIC_ISTRUE(THE_VAL) (true == THE_VAL)
 #define OT_ATOMIC_ISFALSE(THE_VAL) (false == THE_VAL)
 #define OT_STD_FUNCTION(FUNC_TYPE) std::tr1::function< FUNC_TYPE >
 #define OT_STD_BIND std::tr1::bind
+#define OT_STD_PLACEHOLDERS std::tr1::placeholders
+#define OT_PROMISE(TYPE) boost::promise< TYPE >
+#define OT_FUTURE(TYPE) boost::unique_future< TYPE >
 #ifndef nullptr
 #define nullptr NULL
 #endif
@@ -3,7 +3,8 @@
 //
 
 #include "BitMessage.h"
-#include <json/json.h>
+#include "ResponseDecoder.h"
+#include "MailboxCache.h"
 #include<boost/tokenizer.hpp>
 
 #include <string>
@@ -12,6 +13,7 @@
 #include <utility>
 #include <algorithm>
 #include <functional>
+#include <map>
 
 #ifndef OT_USE_TR1
 #include <chrono>
@@ -25,7 +27,7 @@
 namespace bmwrapper {
     
     
-    BitMessage::BitMessage(std::string commstring) : NetworkModule(commstring, ModuleType::BITMESSAGE) {
+    BitMessage::BitMessage(std::string commstring) : NetworkModule(commstring, ModuleType::BITMESSAGE), m_localInbox(new InboxSnapshot(MailboxIndex::RECIPIENT)), m_localOutbox(new OutboxSnapshot(MailboxIndex::SENDER)) {
         
         // Pass our config string to be parsed locally
         parseCommstring(commstring);
@@ -34,25 +36,68 @@ namespace bmwrapper {
         m_xmllib = new XmlRPC(m_host, m_port, true, 10000);
         m_xmllib->setAuth(m_username, m_pass);
         
-        // Runs to setup our counter
-        checkAlive();
+        m_serverAvailable = false;
+        m_stopProber = false;
+        
+        m_incrementalSync = true;
+        m_decodePool = nullptr;
+        m_parallelDecodeThreshold = 256;
+        
+        // Message bodies, kept apart from the snapshots and fetched again once evicted. The caches are
+        // closed before we go, so their fetchers never run on a BitMessage that is gone.
+        m_inboxBodies.reset(new MailBodyCache(OT_STD_BIND(&BitMessage::fetchInboxBody, this, OT_STD_PLACEHOLDERS::_1, OT_STD_PLACEHOLDERS::_2), 64 * 1024 * 1024));
+        m_outboxBodies.reset(new MailBodyCache(OT_STD_BIND(&BitMessage::fetchSentBody, this, OT_STD_PLACEHOLDERS::_1, OT_STD_PLACEHOLDERS::_2), 64 * 1024 * 1024));
         
-        // Not necessary because checkAlive will take care of this for us.
-        // initializeUserData();
+        // The last session's data, if there is a cache, answers queries until the server has been asked
+        bool cached = loadCache();
+        
+        // Runs to setup our counter
+        bool available = probeServer();
+        if(!available)
+            std::cerr << "Error: BitMessage API service is inaccessible" << std::endl;
         
         // Thread Handler
-        bm_queue = new BitMessageQueue();
+        bm_queue = new BitMessageQueue(m_xmllib);
         
         startQueue();   // Start Listener Thread
         
+        // Pulls down our data if the server is there, catching up on a cache in the background
+        if(available){
+            if(cached)
+                bm_queue->addToQueue(OT_STD_BIND(&BitMessage::initializeUserData, this));
+            else
+                initializeUserData();
+        }
+        
+        m_prober = OT_THREAD(&BitMessage::runProber, this);   // Start Health Check Thread
+        
     }
     
     
     BitMessage::~BitMessage(){
         
+        // Mail handed out earlier can outlive us and keep the body caches alive, stop them fetching
+        // through us first, waiting for any fetch under way
+        m_inboxBodies->close();
+        m_outboxBodies->close();
+        
+        // Stop health checks before the objects they use go away
+        INSTANTIATE_MLOCK(m_proberMutex);
+        m_stopProber = true;
+        mlock.unlock();
+        m_proberWake.notify_all();
+        m_prober.join();
+        
         // Clean up Objects
         
         delete bm_queue;  // Queue will be stopped automatically upon deletion
+        delete m_decodePool;
+        
+        saveCache();
+        
+        m_inboxBodies.reset();
+        m_outboxBodies.reset();
+        
         delete m_xmllib;
         
     }
@@ -87,23 +132,17 @@ namespace bmwrapper {
         
         listAddresses();
         
-        INSTANTIATE_MLOCK(m_localIdentitiesMutex);
+        Snapshot<IdentitySnapshot>::Handle identities = m_localIdentities.load();
         
         try{
             if(label == ""){
                 std::cerr << "Will Not Create Address with Blank Label" << std::endl;
-                mlock.unlock();
                 return false;
             }
             
-            
-            for(unsigned int x = 0; x < m_localIdentities.size(); x++){
-                if(m_localIdentities.at(x).getLabel().decoded() == label){
-                    std::cerr << "Cannot Create Address: Label " << label << " already in Use" << std::endl;
-                    mlock.unlock();
-                    return false;
-                }
-                
+            if(identities->index.hasLabel(label)){
+                std::cerr << "Cannot Create Address: Label " << label << " already in Use" << std::endl;
+                return false;
             }
             
             OT_STD_FUNCTION(void()) firstCommand = OT_STD_BIND(&BitMessage::createRandomAddress, this, base64(label), false, 1, 1);
@@ -111,11 +150,9 @@ namespace bmwrapper {
             
             checkLocalAddresses();
             
-            mlock.unlock();
             return true;
         }
         catch(...){
-            mlock.unlock();
             return false;
         }
     }
@@ -130,29 +167,23 @@ namespace bmwrapper {
         
         listAddresses();
         
-        INSTANTIATE_MLOCK(m_localIdentitiesMutex);
+        Snapshot<IdentitySnapshot>::Handle identities = m_localIdentities.load();
         
         try{
             
             if(label == ""){
                 std::cerr << "Will Not Create Address with Blank Label" << std::endl;
-                mlock.unlock();
                 return false;
             }
             
-            if(m_localIdentities.size() == 0){
+            if(identities->entries.size() == 0){
                 checkLocalAddresses();
-                mlock.unlock();
                 return false;
             }
             
-            for(unsigned int x = 0; x < m_localIdentities.size(); x++){
-                if(m_localIdentities.at(x).getLabel().decoded() == label){
-                    std::cerr << "Cannot Create Address: Label " << label << " already in Use" << std::endl;
-                    mlock.unlock();
-                    return false;
-                }
-                
+            if(identities->index.hasLabel(label)){
+                std::cerr << "Cannot Create Address: Label " << label << " already in Use" << std::endl;
+                return false;
             }
             
             
@@ -161,11 +192,9 @@ namespace bmwrapper {
             
             checkLocalAddresses();
             
-            mlock.unlock();
             return true;
         }
         catch(...){
-            mlock.unlock();
             return false;
         }
         
@@ -201,15 +230,8 @@ namespace bmwrapper {
             return false;
         }
         
-        INSTANTIATE_MLOCK(m_localIdentitiesMutex);
-        
-        for(unsigned int x = 0; x < m_localIdentities.size(); x++){
-            if(m_localIdentities.at(x).getAddress() == address){
-                mlock.unlock();
-                return true;
-            }
-        }
-        mlock.unlock();
+        if(m_localIdentities.load()->index.hasAddress(address))
+            return true;
         
         // If the address isn't acccessible, try and fetch the latest
         // Address book from the API server for another try later.
@@ -222,33 +244,31 @@ namespace bmwrapper {
     
     std::vector<std::pair<std::string, std::string> > BitMessage::getRemoteAddresses(){
         
-        INSTANTIATE_MLOCK(m_localAddressBookMutex);
+        Snapshot<AddressBookSnapshot>::Handle addressBook = m_localAddressBook.load();
         
         std::vector<std::pair<std::string, std::string> > addresses;
-        for(unsigned int x = 0; x < m_localAddressBook.size(); x++){
-            std::pair<std::string, std::string> address(m_localAddressBook.at(x).getLabel().decoded(), m_localAddressBook.at(x).getAddress());
+        for(unsigned int x = 0; x < addressBook->entries.size(); x++){
+            std::string const& entryAddress = addressBook->entries[x].getAddressRef();
+            std::pair<std::string, std::string> address(addressBook->index.label(entryAddress), entryAddress);
             addresses.push_back(address);
         }
         
-        mlock.unlock();
-        
         return addresses;
         
     }
     
     std::vector<std::pair<std::string, std::string> > BitMessage::getLocalAddresses(){
         
-        INSTANTIATE_MLOCK(m_localIdentitiesMutex);
+        Snapshot<IdentitySnapshot>::Handle identities = m_localIdentities.load();
         
         std::vector<std::pair<std::string, std::string> > addresses;
         
-        for(unsigned int x = 0; x < m_localIdentities.size(); x++){
-            std::pair<std::string, std::string> address(m_localIdentities.at(x).getLabel().decoded(), m_localIdentities.at(x).getAddress());
+        for(unsigned int x = 0; x < identities->entries.size(); x++){
+            std::string const& identityAddress = identities->entries[x].getAddressRef();
+            std::pair<std::string, std::string> address(identities->index.label(identityAddress), identityAddress);
             addresses.push_back(address);
         }
         
-        mlock.unlock();
-        
         return addresses;
     }
     
@@ -261,8 +281,9 @@ namespace bmwrapper {
         }
         
         try{
-            OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::listAddresses, this);
-            bm_queue->addToQueue(command);
+            Parameters params;
+            XmlResponseHandler handler = OT_STD_BIND(&BitMessage::parseAddresses, this, OT_STD_PLACEHOLDERS::_1);
+            bm_queue->addToQueue("listAddresses2", params, handler);
             return true;
         }
         catch(...){
@@ -297,10 +318,22 @@ namespace bmwrapper {
         }
         
         try{
-            OT_STD_FUNCTION(void()) getInboxMessages = OT_STD_BIND(&BitMessage::getAllInboxMessages, this);
-            bm_queue->addToQueue(getInboxMessages);
-            OT_STD_FUNCTION(void()) getSentMessages = OT_STD_BIND(&BitMessage::getAllSentMessages, this);
-            bm_queue->addToQueue(getSentMessages);
+            // Queued back to back so that both go out in the same batch.
+            Parameters params;
+            
+            // An empty cache is filled in one go, there is nothing to diff against
+            bool incremental = OT_ATOMIC_ISTRUE(m_incrementalSync) && !m_localInbox.load()->records->empty();
+            
+            if(incremental){
+                XmlResponseHandler inboxHandler = OT_STD_BIND(&BitMessage::parseInboxMessageIds, this, OT_STD_PLACEHOLDERS::_1);
+                bm_queue->addToQueue("getAllInboxMessageIds", params, inboxHandler);
+            }
+            else{
+                XmlResponseHandler inboxHandler = OT_STD_BIND(&BitMessage::parseAllInboxMessages, this, OT_STD_PLACEHOLDERS::_1);
+                bm_queue->addToQueue("getAllInboxMessages", params, inboxHandler);
+            }
+            XmlResponseHandler outboxHandler = OT_STD_BIND(&BitMessage::parseAllSentMessages, this, OT_STD_PLACEHOLDERS::_1);
+            bm_queue->addToQueue("getAllSentMessages", params, outboxHandler);
             return true;
         }
         catch(...){
@@ -316,63 +349,37 @@ namespace bmwrapper {
             return false;
         }
         
-        if(m_localInbox.size() == 0){
-            getAllInboxMessages(); // Blocking call, otherwise this may cause problems.
-        }
-        INSTANTIATE_MLOCK(m_localInboxMutex);
+        // Counted as the inbox changes, so a poll is an atomic read that never waits on the API server.
+        // The inbox is filled at startup, and kept up to date by checkMail.
+        Snapshot<InboxSnapshot>::Handle inbox = m_localInbox.load();
         
-        if(address != ""){
-            for(unsigned int x=0; x<m_localInbox.size(); x++){
-                
-                if(m_localInbox.at(x)->getTo() == address && m_localInbox.at(x)->getRead() == false){
-                    mlock.unlock();
-                    return true;
-                }
-            }
-        }
-        else{
-            for(unsigned int x = 0; x < m_localInbox.size(); x++){
-                if(m_localInbox.at(x)->getRead() == false){
-                    mlock.unlock();
-                    return true;
-                }
-            }
-        }
-        mlock.unlock();
-        return false;
+        if(address == "")
+            return inbox->index.unread() > 0;
+        
+        return inbox->index.unread(address) > 0;
         
     }
     
     std::vector<_SharedPtr<NetworkMail> > BitMessage::getInbox(std::string address){
         
-        if(m_localInbox.size() == 0){
+        Snapshot<InboxSnapshot>::Handle inbox = m_localInbox.load();
+        
+        if(inbox->mail.size() == 0){
             // Blocking call, otherwise this may cause problems.
             getAllInboxMessages();
+            inbox = m_localInbox.load();
         }
         
-        INSTANTIATE_MLOCK(m_localInboxMutex);
-        
         try{
             
-            if(address != ""){
-                std::vector<_SharedPtr<NetworkMail> > inboxForAddress;
-                for(unsigned int x=0; x<m_localInbox.size(); x++){
-                    if(m_localInbox.at(x)->getTo() == address)
-                        inboxForAddress.push_back(m_localInbox.at(x));
-                }
-                mlock.unlock();
-                return inboxForAddress;
-            }
-            else{
-                mlock.unlock();
-                return m_localInbox;
-            }
+            if(address != "")
+                return inbox->index.forAddress(address);
+            else
+                return inbox->mail;
         }
         catch(...){
-            mlock.unlock();
             return std::vector<_SharedPtr<NetworkMail> >();
         }
-        mlock.unlock();
         return std::vector<_SharedPtr<NetworkMail> >();
         
     }
@@ -382,32 +389,23 @@ namespace bmwrapper {
     
     std::vector<_SharedPtr<NetworkMail> > BitMessage::getOutbox(std::string address){
         
-        if(m_localOutbox.size() == 0){
+        Snapshot<OutboxSnapshot>::Handle outbox = m_localOutbox.load();
+        
+        if(outbox->mail.size() == 0){
             // Blocking call, otherwise this may cause problems.
             getAllSentMessages();
+            outbox = m_localOutbox.load();
         }
-        INSTANTIATE_MLOCK(m_localOutboxMutex);
         try{
             
-            if(address != ""){
-                std::vector<_SharedPtr<NetworkMail> > outboxForAddress;
-                for(unsigned int x=0; x<m_localOutbox.size(); x++){
-                    if(m_localOutbox.at(x)->getFrom() == address)
-                        outboxForAddress.push_back(m_localOutbox.at(x));
-                }
-                mlock.unlock();
-                return outboxForAddress;
-            }
-            else{
-                mlock.unlock();
-                return m_localOutbox;
-            }
+            if(address != "")
+                return outbox->index.forAddress(address);
+            else
+                return outbox->mail;
         }
         catch(...){
-            mlock.unlock();
             return std::vector<_SharedPtr<NetworkMail> >();
         }
-        mlock.unlock();
         return std::vector<_SharedPtr<NetworkMail> >();
         
     }
@@ -420,41 +418,72 @@ namespace bmwrapper {
         
         std::vector<_SharedPtr<NetworkMail> > unreadMail;
         
-        if(m_localInbox.size() == 0){
+        Snapshot<InboxSnapshot>::Handle inbox = m_localInbox.load();
+        
+        if(inbox->mail.size() == 0){
             // Blocking call, otherwise this may cause problems.
             getAllInboxMessages();
+            inbox = m_localInbox.load();
         }
-        INSTANTIATE_MLOCK(m_localInboxMutex);
         try{
             
-            if(address != ""){
-                for(unsigned int x=0; x<m_localInbox.size(); x++){
-                    if(m_localInbox.at(x)->getTo() == address && m_localInbox.at(x)->getRead() == false)
-                        unreadMail.push_back(m_localInbox.at(x));
-                }
-                mlock.unlock();
-                return unreadMail;
-            }
-            else{
-                for(unsigned int x=0; x<m_localInbox.size(); x++){
-                    if(m_localInbox.at(x)->getRead() == false)
-                        unreadMail.push_back(m_localInbox.at(x));
-                }
-                mlock.unlock();
-                return unreadMail;
+            std::vector<_SharedPtr<NetworkMail> > const& mail = address != "" ? inbox->index.forAddress(address) : inbox->mail;
+            
+            for(unsigned int x=0; x<mail.size(); x++){
+                if(mail.at(x)->getRead() == false)
+                    unreadMail.push_back(mail.at(x));
             }
+            return unreadMail;
         }
         catch(...){
-            mlock.unlock();
             return unreadMail;
         }
-        mlock.unlock();
         return unreadMail;
     }
     
     // Note that this is just a passthrough way of calling getUnreadMail() to adhere to the interface.
     std::vector<_SharedPtr<NetworkMail> > BitMessage::getAllUnreadMail(){return getUnreadMail("");}
     
+    BitMessage::MailboxHandle BitMessage::getInboxSnapshot(){
+        
+        Snapshot<InboxSnapshot>::Handle inbox = m_localInbox.load();
+        
+        // Shares ownership of the whole snapshot, so the mail lives as long as the handle does
+        return MailboxHandle(inbox, &inbox->mail);
+        
+    }
+    
+    BitMessage::MailboxHandle BitMessage::getOutboxSnapshot(){
+        
+        Snapshot<OutboxSnapshot>::Handle outbox = m_localOutbox.load();
+        
+        return MailboxHandle(outbox, &outbox->mail);
+        
+    }
+    
+    _SharedPtr<const BitInboxMessage> BitMessage::getInboxRecord(std::string messageID){
+        
+        _SharedPtr<NetworkMail> mail = m_localInbox.load()->index.find(messageID);
+        if(!mail)
+            return _SharedPtr<const BitInboxMessage>();
+        
+        // Everything in the inbox is a view over one of its records
+        _SharedPtr<const NetworkMailHeaders> headers = mail->getHeaders();
+        return _SharedPtr<const BitInboxMessage>(headers, static_cast<const BitInboxMessage*>(headers.get()));
+        
+    }
+    
+    _SharedPtr<const BitSentMessage> BitMessage::getOutboxRecord(std::string messageID){
+        
+        _SharedPtr<NetworkMail> mail = m_localOutbox.load()->index.find(messageID);
+        if(!mail)
+            return _SharedPtr<const BitSentMessage>();
+        
+        _SharedPtr<const NetworkMailHeaders> headers = mail->getHeaders();
+        return _SharedPtr<const BitSentMessage>(headers, static_cast<const BitSentMessage*>(headers.get()));
+        
+    }
+    
     bool BitMessage::deleteMessage(std::string messageID){
         
         if(!accessible()){
@@ -462,30 +491,41 @@ namespace bmwrapper {
             return false;
         }
         
-        if(m_localInbox.size() == 0){
+        if(m_localInbox.load()->mail.size() == 0){
             // Blocking call, otherwise this may cause problems.
             getAllInboxMessages();
         }
         INSTANTIATE_MLOCK(m_localInboxMutex);
-        for(unsigned int x=0; x<m_localInbox.size(); x++){
-            
-            if(m_localInbox.at(x)->getMessageID() == messageID){
-                m_localInbox.erase(m_localInbox.begin() + x);
-            }
-            try{
-                OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::trashMessage, this, messageID);
-                bm_queue->addToQueue(command);
-                mlock.unlock();
-                return true;
-            }
-            catch(...){
-                mlock.unlock();
-                return false;
-            }
+        
+        Snapshot<InboxSnapshot>::Handle inbox = m_localInbox.load();
+        
+        _SharedPtr<NetworkMail> mail = inbox->index.find(messageID);
+        if(!mail){
+            mlock.unlock();
+            return false;
         }
         
-        mlock.unlock();
-        return false;
+        // Readers may still hold the current snapshot, so the change goes into a copy. The copy shares the
+        // records and index tables, only the mail's pointers are copied.
+        _SharedPtr<InboxSnapshot> next(new InboxSnapshot(*inbox));
+        next->mail.erase(std::find(next->mail.begin(), next->mail.end(), mail));
+        next->index.erase(mail);
+        m_localInbox.publish(next);
+        m_inboxBodies->erase(messageID);
+        
+        setDeletionPending(messageID, true);
+        
+        try{
+            OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::trashMessage, this, messageID);
+            bm_queue->addToQueue(command);
+            mlock.unlock();
+            return true;
+        }
+        catch(...){
+            setDeletionPending(messageID, false);
+            mlock.unlock();
+            return false;
+        }
         
     }
     
@@ -498,30 +538,39 @@ namespace bmwrapper {
             return false;
         }
         
-        if(m_localOutbox.size() == 0){
+        if(m_localOutbox.load()->mail.size() == 0){
             // Blocking call, otherwise this may cause problems.
             getAllSentMessages();
         }
         INSTANTIATE_MLOCK(m_localOutboxMutex);
-        for(unsigned int x=0; x<m_localOutbox.size(); x++){
-            
-            if(m_localOutbox.at(x)->getMessageID() == messageID){
-                m_localOutbox.erase(m_localOutbox.begin() + x);
-            }
-            try{
-                OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::trashMessage, this, messageID);
-                bm_queue->addToQueue(command);
-                mlock.unlock();
-                return true;
-            }
-            catch(...){
-                mlock.unlock();
-                return false;
-            }
+        
+        Snapshot<OutboxSnapshot>::Handle outbox = m_localOutbox.load();
+        
+        _SharedPtr<NetworkMail> mail = outbox->index.find(messageID);
+        if(!mail){
+            mlock.unlock();
+            return false;
         }
         
-        mlock.unlock();
-        return false;
+        _SharedPtr<OutboxSnapshot> next(new OutboxSnapshot(*outbox));
+        next->mail.erase(std::find(next->mail.begin(), next->mail.end(), mail));
+        next->index.erase(mail);
+        m_localOutbox.publish(next);
+        m_outboxBodies->erase(messageID);
+        
+        setDeletionPending(messageID, true);
+        
+        try{
+            OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::trashMessage, this, messageID);
+            bm_queue->addToQueue(command);
+            mlock.unlock();
+            return true;
+        }
+        catch(...){
+            setDeletionPending(messageID, false);
+            mlock.unlock();
+            return false;
+        }
         
     }
     
@@ -533,30 +582,34 @@ namespace bmwrapper {
             return false;
         }
         
-        if(m_localInbox.size() == 0){
+        if(m_localInbox.load()->mail.size() == 0){
             // Blocking call, otherwise this may cause problems.
             getAllInboxMessages();
         }
         
         INSTANTIATE_MLOCK(m_localInboxMutex);
-        for(unsigned int x=0; x<m_localInbox.size(); x++){
-            
-            if(m_localInbox.at(x)->getMessageID() == messageID){
-                m_localInbox.at(x)->setRead(read);
-            }
-            try{
-                OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::getInboxMessageByID, this, messageID, read);
-                bm_queue->addToQueue(command);
-                mlock.unlock();
-                return true;
-            }
-            catch(...){
-                mlock.unlock();
-                return false;
-            }
+        
+        Snapshot<InboxSnapshot>::Handle inbox = m_localInbox.load();
+        
+        _SharedPtr<NetworkMail> mail = inbox->index.find(messageID);
+        if(!mail){
+            mlock.unlock();
+            return false;
+        }
+        
+        // The flag lives in the shared NetworkMail and the counts are atomic, neither needs a new snapshot
+        inbox->index.setRead(mail, read);
+        
+        try{
+            OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::getInboxMessageByID, this, messageID, read);
+            bm_queue->addToQueue(command);
+            mlock.unlock();
+            return true;
+        }
+        catch(...){
+            mlock.unlock();
+            return false;
         }
-        mlock.unlock();
-        return false;
     }
     
     
@@ -569,8 +622,8 @@ namespace bmwrapper {
         
         try{
             
-            OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::sendMessage, this, message.getTo(), message.getFrom(), base64(message.getSubject()), base64(message.getMessage()), 2);
-            bm_queue->addToQueue(command);
+            XmlResponseHandler handler = OT_STD_BIND(&BitMessage::parseSendMessage, this, OT_STD_PLACEHOLDERS::_1);
+            bm_queue->addToQueue("sendMessage", sendMessageParameters(message.getTo(), message.getFrom(), base64(message.getSubject()), base64(message.getMessage()), 2), handler);
             return true;
         }
         catch(...){
@@ -587,24 +640,21 @@ namespace bmwrapper {
             return std::vector<std::pair<std::string, std::string> >();
         }
         
-        INSTANTIATE_MLOCK(m_localSubscriptionListMutex);
+        Snapshot<BitMessageSubscriptionList>::Handle subscriptions = m_localSubscriptionList.load();
         
-        if(m_localSubscriptionList.size() == 0){
-            mlock.unlock();
+        if(subscriptions->size() == 0){
             refreshSubscriptions();
             return std::vector<std::pair<std::string, std::string> >();
         }
         else{
             std::vector<std::pair<std::string, std::string> > subscriptionList;
-            for(unsigned int x = 0; x < m_localSubscriptionList.size(); x++){
-                std::pair<std::string, std::string> subscription(m_localSubscriptionList.at(x).getLabel().decoded(), m_localSubscriptionList.at(x).getAddress());
+            for(unsigned int x = 0; x < subscriptions->size(); x++){
+                std::pair<std::string, std::string> subscription(subscriptions->at(x).getLabelRef().decoded(), subscriptions->at(x).getAddressRef());
                 subscriptionList.push_back(subscription);
             }
-            mlock.unlock();
             return subscriptionList;
         }
         
-        mlock.unlock();
         return std::vector<std::pair<std::string, std::string> >();
         
     }
@@ -618,8 +668,9 @@ namespace bmwrapper {
         }
         
         try{
-            OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::listSubscriptions, this);
-            bm_queue->addToQueue(command);
+            Parameters params;
+            XmlResponseHandler handler = OT_STD_BIND(&BitMessage::parseSubscriptions, this, OT_STD_PLACEHOLDERS::_1);
+            bm_queue->addToQueue("listSubscriptions", params, handler);
             return true;
         }
         catch(...){
@@ -745,11 +796,112 @@ namespace bmwrapper {
     
     // Functions for importing/exporting from BitMessage server addressbook
     
-    std::string BitMessage::getLabel(std::string address){return "";}
-    bool BitMessage::setLabel(std::string label, std::string address){return false;}
-    std::string BitMessage::getAddressFromLabel(std::string label){return "";}
+    std::string BitMessage::getLabel(std::string address){
+        
+        Snapshot<IdentitySnapshot>::Handle identities = m_localIdentities.load();
+        if(identities->index.hasAddress(address))
+            return identities->index.label(address);
+        
+        return m_localAddressBook.load()->index.label(address);
+        
+    }
+    
+    
+    bool BitMessage::setLabel(std::string label, std::string address){
+        
+        if(!accessible()){
+            checkAlive();
+            return false;
+        }
+        
+        if(label == ""){
+            std::cerr << "Will Not Set a Blank Label" << std::endl;
+            return false;
+        }
+        
+        INSTANTIATE_MLOCK(m_localAddressBookMutex);
+        
+        Snapshot<AddressBookSnapshot>::Handle addressBook = m_localAddressBook.load();
+        
+        if(!addressBook->index.hasAddress(address)){
+            mlock.unlock();
+            return false;
+        }
+        
+        // Lookups see the new label straight away, rather than once the server has answered
+        _SharedPtr<AddressBookSnapshot> next(new AddressBookSnapshot(*addressBook));
+        for(std::size_t x = 0; x < next->entries.size(); x++){
+            if(next->entries[x].getAddressRef() == address)
+                next->entries[x] = BitMessageAddressBookEntry(address, base64(label));
+        }
+        next->index.erase(address);
+        next->index.add(address, label);
+        m_localAddressBook.publish(next);
+        
+        try{
+            OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::storeContact, this, address, base64(label), true);
+            bm_queue->addToQueue(command);
+            mlock.unlock();
+            return true;
+        }
+        catch(...){
+            mlock.unlock();
+            return false;
+        }
+        
+    }
+    
+    
+    std::string BitMessage::getAddressFromLabel(std::string label){
+        
+        Snapshot<IdentitySnapshot>::Handle identities = m_localIdentities.load();
+        if(identities->index.hasLabel(label))
+            return identities->index.address(label);
+        
+        return m_localAddressBook.load()->index.address(label);
+        
+    }
+    
     
-    bool BitMessage::addContact(std::string label, std::string address){return false;}
+    bool BitMessage::addContact(std::string label, std::string address){
+        
+        if(!accessible()){
+            checkAlive();
+            return false;
+        }
+        
+        if(label == "" || address == ""){
+            std::cerr << "Will Not Add a Contact without a Label and Address" << std::endl;
+            return false;
+        }
+        
+        INSTANTIATE_MLOCK(m_localAddressBookMutex);
+        
+        Snapshot<AddressBookSnapshot>::Handle addressBook = m_localAddressBook.load();
+        
+        // Use setLabel to change an existing contact
+        if(addressBook->index.hasAddress(address)){
+            mlock.unlock();
+            return false;
+        }
+        
+        _SharedPtr<AddressBookSnapshot> next(new AddressBookSnapshot(*addressBook));
+        next->entries.push_back(BitMessageAddressBookEntry(address, base64(label)));
+        next->index.add(address, label);
+        m_localAddressBook.publish(next);
+        
+        try{
+            OT_STD_FUNCTION(void()) command = OT_STD_BIND(&BitMessage::storeContact, this, address, base64(label), false);
+            bm_queue->addToQueue(command);
+            mlock.unlock();
+            return true;
+        }
+        catch(...){
+            mlock.unlock();
+            return false;
+        }
+        
+    }
     
     
     // Binary Streaming Functions
@@ -809,391 +961,626 @@ namespace bmwrapper {
         }
     }
     
-    
-    
-    
+    bool BitMessage::queueIdle(){
+        if(bm_queue != nullptr){
+            // Size first, the queue marks itself as processing before it pops anything.
+            return bm_queue->queueSize() == 0 && !bm_queue->processing();
+        }
+        else{
+            return true;
+        }
+    }
+    
+    
+    
+    
     /*
-     * Direct "Low-Level" API Functions
+     * API Response Decoding
      */
     
-    // Inbox Management
+    // The field tables for every record decoded from an API response. Keys are PyBitmessage's.
     
+    template<> struct ResponseFields<BitInboxMessage> { static const ResponseField<BitInboxMessage> fields[]; };
     
-    void BitMessage::getAllInboxMessages(){
+    const ResponseField<BitInboxMessage> ResponseFields<BitInboxMessage>::fields[] = {
+        {"msgid", &readField<BitInboxMessage, std::string, &BitInboxMessage::m_msgID>},
+        {"toAddress", &readField<BitInboxMessage, BitMessageAddress, &BitInboxMessage::m_toAddress>},
+        {"fromAddress", &readField<BitInboxMessage, BitMessageAddress, &BitInboxMessage::m_fromAddress>},
+        {"subject", &readField<BitInboxMessage, base64, &BitInboxMessage::m_subject>},
+        {"message", &readField<BitInboxMessage, base64, &BitInboxMessage::m_message>},
+        {"encodingType", &readField<BitInboxMessage, int, &BitInboxMessage::m_encodingType>},
+        {"receivedTime", &readField<BitInboxMessage, std::time_t, &BitInboxMessage::m_receivedTime>},
+        {"read", &readField<BitInboxMessage, bool, &BitInboxMessage::m_read>},
+        {nullptr, nullptr}
+    };
+    
+    
+    template<> struct ResponseFields<BitSentMessage> { static const ResponseField<BitSentMessage> fields[]; };
+    
+    const ResponseField<BitSentMessage> ResponseFields<BitSentMessage>::fields[] = {
+        {"msgid", &readField<BitSentMessage, std::string, &BitSentMessage::m_msgID>},
+        {"toAddress", &readField<BitSentMessage, BitMessageAddress, &BitSentMessage::m_toAddress>},
+        {"fromAddress", &readField<BitSentMessage, BitMessageAddress, &BitSentMessage::m_fromAddress>},
+        {"subject", &readField<BitSentMessage, base64, &BitSentMessage::m_subject>},
+        {"message", &readField<BitSentMessage, base64, &BitSentMessage::m_message>},
+        {"encodingType", &readField<BitSentMessage, int, &BitSentMessage::m_encodingType>},
+        {"lastActionTime", &readField<BitSentMessage, std::time_t, &BitSentMessage::m_lastActionTime>},
+        {"status", &readField<BitSentMessage, std::string, &BitSentMessage::m_status>},
+        {"ackData", &readField<BitSentMessage, std::string, &BitSentMessage::m_ackData>},
+        {nullptr, nullptr}
+    };
+    
+    
+    template<> struct ResponseFields<BitMessageSubscription> { static const ResponseField<BitMessageSubscription> fields[]; };
+    
+    const ResponseField<BitMessageSubscription> ResponseFields<BitMessageSubscription>::fields[] = {
+        {"address", &readField<BitMessageSubscription, std::string, &BitMessageSubscription::m_address>},
+        {"enabled", &readField<BitMessageSubscription, bool, &BitMessageSubscription::m_enabled>},
+        {"label", &readField<BitMessageSubscription, base64, &BitMessageSubscription::m_label>},
+        {nullptr, nullptr}
+    };
+    
+    
+    template<> struct ResponseFields<BitMessageIdentity> { static const ResponseField<BitMessageIdentity> fields[]; };
+    
+    const ResponseField<BitMessageIdentity> ResponseFields<BitMessageIdentity>::fields[] = {
+        {"label", &readField<BitMessageIdentity, base64, &BitMessageIdentity::m_label>},
+        {"address", &readField<BitMessageIdentity, BitMessageAddress, &BitMessageIdentity::m_address>},
+        {"stream", &readField<BitMessageIdentity, int, &BitMessageIdentity::m_stream>},
+        {"enabled", &readField<BitMessageIdentity, bool, &BitMessageIdentity::m_enabled>},
+        {"chan", &readField<BitMessageIdentity, bool, &BitMessageIdentity::m_chan>},
+        {nullptr, nullptr}
+    };
+    
+    
+    template<> struct ResponseFields<BitMessageAddressBookEntry> { static const ResponseField<BitMessageAddressBookEntry> fields[]; };
+    
+    const ResponseField<BitMessageAddressBookEntry> ResponseFields<BitMessageAddressBookEntry>::fields[] = {
+        {"address", &readField<BitMessageAddressBookEntry, BitMessageAddress, &BitMessageAddressBookEntry::m_address>},
+        {"label", &readField<BitMessageAddressBookEntry, base64, &BitMessageAddressBookEntry::m_label>},
+        {nullptr, nullptr}
+    };
+    
+    
+    template<> struct ResponseFields<BitDecodedAddress> { static const ResponseField<BitDecodedAddress> fields[]; };
+    
+    const ResponseField<BitDecodedAddress> ResponseFields<BitDecodedAddress>::fields[] = {
+        {"status", &readField<BitDecodedAddress, std::string, &BitDecodedAddress::m_status>},
+        {"addressVersion", &readField<BitDecodedAddress, int, &BitDecodedAddress::m_addressVersion>},
+        {"ripe", &readUnwrappedField<BitDecodedAddress, &BitDecodedAddress::m_ripe>},
+        {"streamNumber", &readField<BitDecodedAddress, int, &BitDecodedAddress::m_streamNumber>},
+        {nullptr, nullptr}
+    };
+    
+    
+    // An entry of getAllInboxMessageIds, which lists nothing but the IDs.
+    struct BitMessageID {
+        std::string msgID;
+    };
+    
+    template<> struct ResponseFields<BitMessageID> { static const ResponseField<BitMessageID> fields[]; };
+    
+    const ResponseField<BitMessageID> ResponseFields<BitMessageID>::fields[] = {
+        {"msgid", &readField<BitMessageID, std::string, &BitMessageID::msgID>},
+        {nullptr, nullptr}
+    };
+    
+    
+    // PyBitmessage reports errors as a string reply starting with "API Error", which no real reply can start with.
+    static bool isAPIError(std::string const& reply){
+        return reply.compare(0, 9, "API Error") == 0;
+    }
+    
+    
+    bool BitMessage::checkResponse(const char *methodName, XmlResponse const& result){
         
-        Parameters params;
-        std::vector<BitInboxMessage> inbox;
+        if(result.first == false){
+            std::cerr << "Error: BitMessage " << methodName << " failed" << std::endl;
+            setServerAlive(false);
+            return false;
+        }
+        
+        if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
+            std::string reply = ValueString(result.second);
+            if(isAPIError(reply)){
+                std::cerr << reply << std::endl;
+                return false;
+            }
+        }
         
-        XmlResponse result = m_xmllib->run("getAllInboxMessages", params);
+        return true;
+        
+    }
+    
+    
+    std::string BitMessage::responseString(const char *methodName, XmlResponse const& result){
         
         if(result.first == false){
-            std::cerr << "Error: BitMessage getAllInboxMessages failed" << std::endl;
+            std::cerr << "Error: BitMessage " << methodName << " failed" << std::endl;
             setServerAlive(false);
-            
+            return "";
         }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
+        
+        if(result.second.type() != xmlrpc_c::value::TYPE_STRING){
+            std::cerr << "Unexpected Response to API Command: " << methodName << std::endl;
+            return "";
         }
         
-        Json::Value root;
-        Json::Reader reader;
+        std::string reply = ValueString(result.second);
+        if(isAPIError(reply)){
+            std::cerr << reply << std::endl;
+            return "";
+        }
         
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse inbox" << std::endl; // << reader.getFormatedErrorMessages();
+        return reply;
+        
+    }
+    
+    
+    template<typename Record>
+    bool BitMessage::decodeResponse(const char *methodName, XmlResponse const& result, Record &record){
+        
+        std::string document = responseString(methodName, result);
+        if(document.empty())
+            return false;
+        
+        if(!decodeRecord(document, record)){
+            std::cerr << "Error: Failed to parse the response to BitMessage " << methodName << std::endl;
+            return false;
         }
         
-        const Json::Value inboxMessages = root["inboxMessages"];
-        for ( unsigned int index = 0; index < inboxMessages.size(); ++index ){
+        return true;
+        
+    }
+    
+    
+    template<typename Record>
+    bool BitMessage::decodeResponse(const char *methodName, XmlResponse const& result, const char *listKey, std::vector<Record> &records){
+        
+        std::string document = responseString(methodName, result);
+        if(document.empty())
+            return false;
+        
+        if(!decodeRecordList(document, listKey, records)){
+            std::cerr << "Error: Failed to parse the response to BitMessage " << methodName << std::endl;
+            return false;
+        }
+        
+        return true;
+        
+    }
+    
+    
+    
+    /*
+     * Mailbox Building
+     */
+    
+    // Each job builds mail[count - 1 - x] over records[x] for its range, which gives the same newest first
+    // order whether the ranges run on one thread or many. Subjects are decoded up front only when
+    // running in parallel, as the list views ask for every one of them. Bodies aren't held by the mail,
+    // it reads them through the mailbox's MailBodyCache.
+    
+    static void buildInboxRange(BitInboxRecords const *records, std::vector<_SharedPtr<NetworkMail> > *mail, _WeakPtr<NetworkMailBodySource> bodies, bool decodeSubjects, std::size_t begin, std::size_t end){
+        
+        std::size_t count = records->size();
+        
+        for(std::size_t x = begin; x < end; x++){
             
-            // We need to sanitize our string, or else it will get cut off because of the newlines.
-            std::string dirtyMessage = inboxMessages[index].get("message", "").asString();
-            dirtyMessage.erase(std::remove(dirtyMessage.begin(), dirtyMessage.end(), '\n'), dirtyMessage.end());
-            base64 cleanMessage(dirtyMessage, true);
+            _SharedPtr<const BitInboxMessage> const& message = (*records)[x];
             
-            BitInboxMessage message(inboxMessages[index].get("msgid", "").asString(),
-                                    inboxMessages[index].get("toAddress", "").asString(),
-                                    inboxMessages[index].get("fromAddress", "").asString(),
-                                    base64(inboxMessages[index].get("subject", "").asString(), true),
-                                    cleanMessage, inboxMessages[index].get("encodingType", 0).asInt(),
-                                    std::atoi(inboxMessages[index].get("receivedTime", 0).asString().c_str()),
-                                    inboxMessages[index].get("read", false).asBool()
-                                    );
+            _SharedPtr<NetworkMail> l_mail(new NetworkMail(&base64::decode, message, bodies, message->getRead()));
             
-            inbox.push_back(message);
+            if(decodeSubjects)
+                l_mail->getSubjectRef();
             
+            (*mail)[count - 1 - x] = l_mail;
         }
         
-        // Lock so that we dont have a race condition.
-        INSTANTIATE_MLOCK(m_localInboxMutex);
+    }
+    
+    
+    static void buildOutboxRange(BitSentRecords const *records, std::vector<_SharedPtr<NetworkMail> > *mail, _WeakPtr<NetworkMailBodySource> bodies, bool decodeSubjects, std::size_t begin, std::size_t end){
         
-        // Populate our local inbox.
-        m_localInbox.clear();
-        m_localUnformattedInbox.clear();
+        std::size_t count = records->size();
         
-        for(unsigned int x=0; x<inbox.size(); x++){
+        for(std::size_t x = begin; x < end; x++){
             
-            m_localUnformattedInbox.push_back(inbox.at(x));
+            _SharedPtr<NetworkMail> l_mail(new NetworkMail(&base64::decode, (*records)[x], bodies, true));
             
-            _SharedPtr<NetworkMail> l_mail( new NetworkMail(inbox.at(x).getFromAddress(),
-                                                            inbox.at(x).getToAddress(),
-                                                            inbox.at(x).getSubject().decoded(),
-                                                            inbox.at(x).getMessage().decoded(),
-                                                            inbox.at(x).getRead(),
-                                                            inbox.at(x).getMessageID(),
-                                                            inbox.at(x).getReceivedTime())
-                                           );
+            if(decodeSubjects)
+                l_mail->getSubjectRef();
             
-            m_localInbox.push_back(l_mail);
+            (*mail)[count - 1 - x] = l_mail;
         }
         
-        // New messages at the front
-        std::reverse(m_localInbox.begin(), m_localInbox.end());
+    }
+    
+    
+    WorkerPool* BitMessage::decodePool(std::size_t count){
+        
+        INSTANTIATE_MLOCK(m_decodePoolMutex);
+        
+        if(m_parallelDecodeThreshold == 0 || count < m_parallelDecodeThreshold){
+            mlock.unlock();
+            return nullptr;
+        }
+        
+        if(m_decodePool == nullptr)
+            m_decodePool = new WorkerPool();
         
-        // Release our lock so that others can access the inbox
         mlock.unlock();
         
+        // Single core machines get a pool with no workers, no point going through it
+        return m_decodePool->workers() > 0 ? m_decodePool : nullptr;
+        
     }
     
     
-    void BitMessage::getInboxMessageByID(std::string msgID, bool setRead){
+    void BitMessage::buildMailbox(BitMessageInbox &inbox, InboxSnapshot &mailbox){
         
-        Parameters params;
+        _SharedPtr<BitInboxRecords> shared(new BitInboxRecords());
+        BitInboxRecords &records = *shared;
+        records.reserve(inbox.size());
         
-        params.push_back(ValueString(msgID));
-        params.push_back(ValueBool(setRead));
+        // Oldest first, so that the newest bodies are the last to be evicted
+        for(std::size_t x = 0; x < inbox.size(); x++){
+            m_inboxBodies->insert(inbox[x].getMessageIDRef(), inbox[x].releaseMessage());
+            records.push_back(_SharedPtr<const BitInboxMessage>(new BitInboxMessage(std::move(inbox[x]))));
+        }
+        inbox.clear();
         
-        XmlResponse result = m_xmllib->run("getInboxMessageByID", params);
+        std::vector<_SharedPtr<NetworkMail> > &mail = mailbox.mail;
+        mail.resize(records.size());
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage getInboxMessageByID failed" << std::endl;
-            setServerAlive(false);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
-        }
+        _WeakPtr<NetworkMailBodySource> bodies(m_inboxBodies);
+        WorkerPool *pool = decodePool(records.size());
         
+        if(pool != nullptr)
+            pool->parallelFor(records.size(), OT_STD_BIND(&buildInboxRange, &records, &mail, bodies, true, OT_STD_PLACEHOLDERS::_1, OT_STD_PLACEHOLDERS::_2));
+        else
+            buildInboxRange(&records, &mail, bodies, false, 0, records.size());
         
-        Json::Value root;
-        Json::Reader reader;
+        mailbox.records = shared;
         
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse inbox" << std::endl; //reader.getFormatedErrorMessages();
-            BitInboxMessage message("", "", "", base64(""), base64(""), 0, 0, false);
+    }
+    
+    
+    void BitMessage::buildMailbox(BitMessageOutbox &outbox, OutboxSnapshot &mailbox){
+        
+        _SharedPtr<BitSentRecords> shared(new BitSentRecords());
+        BitSentRecords &records = *shared;
+        records.reserve(outbox.size());
+        
+        for(std::size_t x = 0; x < outbox.size(); x++){
+            m_outboxBodies->insert(outbox[x].getMessageIDRef(), outbox[x].releaseMessage());
+            records.push_back(_SharedPtr<const BitSentMessage>(new BitSentMessage(std::move(outbox[x]))));
         }
+        outbox.clear();
         
-        const Json::Value inboxMessage = root["inboxMessage"];
+        std::vector<_SharedPtr<NetworkMail> > &mail = mailbox.mail;
+        mail.resize(records.size());
         
-        std::string dirtyMessage = inboxMessage[0u].get("message", "").asString();
-        dirtyMessage.erase(std::remove(dirtyMessage.begin(), dirtyMessage.end(), '\n'), dirtyMessage.end());
-        base64 cleanMessage(dirtyMessage, true);
+        _WeakPtr<NetworkMailBodySource> bodies(m_outboxBodies);
+        WorkerPool *pool = decodePool(records.size());
         
+        if(pool != nullptr)
+            pool->parallelFor(records.size(), OT_STD_BIND(&buildOutboxRange, &records, &mail, bodies, true, OT_STD_PLACEHOLDERS::_1, OT_STD_PLACEHOLDERS::_2));
+        else
+            buildOutboxRange(&records, &mail, bodies, false, 0, records.size());
         
-        BitInboxMessage message(inboxMessage[0u].get("msgid", "").asString(),
-                                inboxMessage[0u].get("toAddress", "").asString(),
-                                inboxMessage[0u].get("fromAddress", "").asString(),
-                                base64(inboxMessage[0u].get("subject", "").asString(), true),
-                                cleanMessage, inboxMessage[0u].get("encodingType", 0).asInt(),
-                                std::atoi(inboxMessage[0u].get("receivedTime", 0).asString().c_str()),
-                                inboxMessage[0u].get("read", false).asBool()
-                                );
+        mailbox.records = shared;
         
     }
     
     
-    void BitMessage::getAllSentMessages(){
+    void BitMessage::getAllInboxMessages(){
         
         Parameters params;
-        std::vector<BitSentMessage> outbox;
         
-        XmlResponse result = m_xmllib->run("getAllSentMessages", params);
+        parseAllInboxMessages(m_xmllib->run("getAllInboxMessages", params));
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage getAllSentMessages failed" << std::endl;
-            setServerAlive(false);
+    }
+    
+    
+    void BitMessage::parseAllInboxMessages(XmlResponse result){
+        
+        std::vector<BitInboxMessage> inbox;
+        
+        // Keep what we have rather than emptying the inbox over a failed refresh
+        if(!decodeResponse("getAllInboxMessages", result, "inboxMessages", inbox))
+            return;
+        
+        publishInbox(inbox);
+        
+    }
+    
+    
+    void BitMessage::publishInbox(BitMessageInbox &inbox){
+        
+        dropPendingDeletions(inbox);
+        
+        // Readers carry on with the current snapshot while the next one is built
+        _SharedPtr<InboxSnapshot> next(new InboxSnapshot(MailboxIndex::RECIPIENT));
+        buildMailbox(inbox, *next);
+        next->index.rebuild(next->mail);
+        
+        // Lock so that we dont have a race condition with a delete or markRead.
+        INSTANTIATE_MLOCK(m_localInboxMutex);
+        Snapshot<InboxSnapshot>::Handle previous = m_localInbox.load();
+        m_localInbox.publish(next);
+        mlock.unlock();
+        
+        // The server no longer lists these, so nothing will read their bodies again
+        for(std::size_t x = 0; x < previous->records->size(); x++){
+            std::string const& msgID = (*previous->records)[x]->getMessageIDRef();
+            if(!next->index.find(msgID))
+                m_inboxBodies->erase(msgID);
         }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
+        
+    }
+    
+    
+    void BitMessage::parseInboxMessageIds(XmlResponse result){
+        
+        std::vector<BitMessageID> serverIDs;
+        
+        if(!decodeResponse("getAllInboxMessageIds", result, "inboxMessageIds", serverIDs))
+            return;
+        
+        // Work out which of the server's messages we don't have yet
+        Snapshot<InboxSnapshot>::Handle current = m_localInbox.load();
+        
+        std::map<std::string, std::size_t> cached;
+        for(std::size_t x = 0; x < current->records->size(); x++)
+            cached[(*current->records)[x]->getMessageIDRef()] = x;
+        
+        std::vector<XmlCall> calls;
+        for(std::size_t x = 0; x < serverIDs.size(); x++){
+            if(cached.find(serverIDs[x].msgID) == cached.end() && !deletionPending(serverIDs[x].msgID)){
+                // Without the read flag the server leaves the message's read state alone
+                Parameters params;
+                params.push_back(ValueString(serverIDs[x].msgID));
+                calls.push_back(XmlCall("getInboxMessageByID", params));
             }
         }
         
-        Json::Value root;
-        Json::Reader reader;
+        // Fetching most of the inbox one message at a time costs more than fetching all of it at once
+        if(calls.size() > bm_queue->getBatchSize() && calls.size() > serverIDs.size() / 2){
+            getAllInboxMessages();
+            return;
+        }
+        
+        // Everything is already here, only removals to deal with. Otherwise fetch in batches, so that a
+        // long backlog doesn't go in one response over the size limit and fail on every sync.
+        BitMessageInbox fetchedMessages;
+        std::size_t batchSize = bm_queue->getBatchSize();
+        for(std::size_t first = 0; first < calls.size(); first += batchSize){
+            std::vector<XmlCall> batch(calls.begin() + first, calls.begin() + std::min(first + batchSize, calls.size()));
+            std::vector<XmlResponse> responses = m_xmllib->multicall(batch);
+            for(std::size_t x = 0; x < responses.size(); x++){
+                // A message that didn't come through is tried again on the next sync
+                decodeResponse("getInboxMessageByID", responses[x], "inboxMessage", fetchedMessages);
+            }
+        }
         
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse outbox" << std::endl; //reader.getFormatedErrorMessages();
+        InboxSnapshot fetched(MailboxIndex::RECIPIENT);
+        buildMailbox(fetchedMessages, fetched); // Mail is newest first, so records[x] is mail[count - 1 - x]
+        
+        std::map<std::string, std::size_t> fetchedIndex;
+        BitInboxRecords const& fetchedRecords = *fetched.records;
+        for(std::size_t x = 0; x < fetchedRecords.size(); x++)
+            fetchedIndex[fetchedRecords[x]->getMessageIDRef()] = x;
+        
+        // Rebuild in the server's order, dropping whatever it no longer lists
+        INSTANTIATE_MLOCK(m_localInboxMutex);
+        
+        // The cached positions are stale if the inbox changed while we were fetching
+        Snapshot<InboxSnapshot>::Handle latest = m_localInbox.load();
+        if(latest != current){
+            cached.clear();
+            for(std::size_t x = 0; x < latest->records->size(); x++)
+                cached[(*latest->records)[x]->getMessageIDRef()] = x;
         }
         
-        const Json::Value sentMessages = root["sentMessages"];
-        for ( unsigned int index = 0; index < sentMessages.size(); ++index ){
+        BitInboxRecords const& latestRecords = *latest->records;
+        
+        _SharedPtr<InboxSnapshot> next(new InboxSnapshot(MailboxIndex::RECIPIENT));
+        _SharedPtr<BitInboxRecords> records(new BitInboxRecords());
+        BitInboxRecords &inbox = *records;
+        std::vector<_SharedPtr<NetworkMail> > &mail = next->mail;
+        inbox.reserve(serverIDs.size());
+        mail.reserve(serverIDs.size());
+        
+        for(std::size_t x = 0; x < serverIDs.size(); x++){
+            
+            std::string const& msgID = serverIDs[x].msgID;
             
-            // We need to sanitize our string, or else it will get cut off because of the newlines.
-            std::string dirtyMessage = sentMessages[index].get("message", "").asString();
-            dirtyMessage.erase(std::remove(dirtyMessage.begin(), dirtyMessage.end(), '\n'), dirtyMessage.end());
-            base64 cleanMessage(dirtyMessage, true);
+            // Deleted locally, but the server lists it until the trashMessage call has gone through
+            if(deletionPending(msgID))
+                continue;
             
-            BitSentMessage message(sentMessages[index].get("msgid", "").asString(),
-                                   sentMessages[index].get("toAddress", "").asString(),
-                                   sentMessages[index].get("fromAddress", "").asString(),
-                                   base64(sentMessages[index].get("subject", "").asString(), true),
-                                   cleanMessage,
-                                   sentMessages[index].get("encodingType", 0).asInt(),
-                                   sentMessages[index].get("lastActionTime", 0).asInt(),
-                                   sentMessages[index].get("status", false).asString(),
-                                   sentMessages[index].get("ackData", false).asString()
-                                   );
+            std::map<std::string, std::size_t>::iterator it = cached.find(msgID);
+            if(it != cached.end()){
+                // Deleted locally since the last refresh, the records still have it but the mail doesn't
+                _SharedPtr<NetworkMail> local = latest->index.find(msgID);
+                if(local){
+                    inbox.push_back(latestRecords[it->second]);
+                    mail.push_back(local);
+                }
+                continue;
+            }
             
-            outbox.push_back(message);
+            it = fetchedIndex.find(msgID);
+            if(it != fetchedIndex.end()){
+                inbox.push_back(fetchedRecords[it->second]);
+                mail.push_back(fetched.mail[fetchedRecords.size() - 1 - it->second]);
+            }
         }
         
-        // Lock so that we dont have a race condition.
-        INSTANTIATE_MLOCK(m_localOutboxMutex);
-
-        // Populate our local outbox.
-        m_localOutbox.clear();
-        m_localUnformattedOutbox.clear();
-        for(unsigned int x=0; x<outbox.size(); x++){
-            m_localUnformattedOutbox.push_back(outbox.at(x));
-            _SharedPtr<NetworkMail> l_mail( new NetworkMail(outbox.at(x).getFromAddress(),
-                                                            outbox.at(x).getToAddress(),
-                                                            outbox.at(x).getSubject().decoded(),
-                                                            outbox.at(x).getMessage().decoded(),
-                                                            true,
-                                                            outbox.at(x).getMessageID(),
-                                                            0,
-                                                            outbox.at(x).getLastActionTime())
-                                           );
-            
-            m_localOutbox.push_back(l_mail);
+        // Nothing new and nothing gone, the inbox we have is still right
+        if(fetchedIndex.empty() && mail.size() == latest->mail.size()){
+            mlock.unlock();
+            return;
+        }
+        
+        // The mail kept from the old inbox is copied, so that marking it read in the new one leaves the old
+        // one's flags and counts alone
+        for(std::size_t x = 0; x < mail.size(); x++){
+            if(latest->index.find(mail[x]->getMessageIDRef()) == mail[x])
+                mail[x].reset(new NetworkMail(*mail[x]));
         }
         
         // New messages at the front
-        std::reverse(m_localOutbox.begin(), m_localOutbox.end());
+        std::reverse(mail.begin(), mail.end());
+        
+        next->records = records;
+        next->index.rebuild(mail);
+        m_localInbox.publish(next);
         
-        // Release our lock so that others can access the outbox
         mlock.unlock();
+        
+        // The server no longer lists these, so nothing will read their bodies again
+        for(std::size_t x = 0; x < latestRecords.size(); x++){
+            std::string const& msgID = latestRecords[x]->getMessageIDRef();
+            if(!next->index.find(msgID))
+                m_inboxBodies->erase(msgID);
+        }
+        
     }
     
-    BitSentMessage BitMessage::getSentMessageByID(std::string msgID){
+    
+    void BitMessage::getInboxMessageByID(std::string msgID, bool setRead){
         
         Parameters params;
         
         params.push_back(ValueString(msgID));
+        params.push_back(ValueBool(setRead));
         
-        XmlResponse result = m_xmllib->run("getSentMessageByID", params);
+        // Only called for its side effect of setting the read flag on the server
+        checkResponse("getInboxMessageByID", m_xmllib->run("getInboxMessageByID", params));
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage getSentMessageByID failed" << std::endl;;
-            setServerAlive(false);
-            return BitSentMessage("", "", "", base64(""), base64(""), 0, 0, "", "");
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return BitSentMessage("", "", "", base64(""), base64(""), 0, 0, "", "");
-            }
-        }
+    }
+    
+    
+    bool BitMessage::fetchInboxBody(std::string const& msgID, std::string &encoded){
         
+        Parameters params;
         
-        Json::Value root;
-        Json::Reader reader;
+        // Without the read flag the server leaves the message's read state alone
+        params.push_back(ValueString(msgID));
         
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse outbox" << std::endl; //reader.getFormatedErrorMessages();
-            return BitSentMessage("", "", "", base64(""), base64(""), 0, 0, "", "");
-        }
+        std::vector<BitInboxMessage> messages;
+        if(!decodeResponse("getInboxMessageByID", m_xmllib->run("getInboxMessageByID", params), "inboxMessage", messages) || messages.empty())
+            return false;
         
-        const Json::Value sentMessage = root["sentMessage"];
+        encoded = messages.front().releaseMessage();
+        return true;
         
-        std::string dirtyMessage = sentMessage[0u].get("message", "").asString();
-        dirtyMessage.erase(std::remove(dirtyMessage.begin(), dirtyMessage.end(), '\n'), dirtyMessage.end());
-        base64 cleanMessage(dirtyMessage, true);
+    }
+    
+    
+    void BitMessage::getAllSentMessages(){
         
+        Parameters params;
         
-        BitSentMessage message(sentMessage[0u].get("msgid", "").asString(),
-                               sentMessage[0u].get("toAddress", "").asString(),
-                               sentMessage[0u].get("fromAddress", "").asString(),
-                               base64(sentMessage[0u].get("subject", "").asString(), true),
-                               cleanMessage,
-                               sentMessage[0u].get("encodingType", 0).asInt(),
-                               sentMessage[0u].get("lastActionTime", 0).asInt(),
-                               sentMessage[0u].get("status", false).asString(),
-                               sentMessage[0u].get("ackData", false).asString()
-                               );
+        parseAllSentMessages(m_xmllib->run("getAllSentMessages", params));
         
-        return message;
+    }
+    
+    
+    void BitMessage::parseAllSentMessages(XmlResponse result){
+        
+        std::vector<BitSentMessage> outbox;
+        
+        // Keep what we have rather than emptying the outbox over a failed refresh
+        if(!decodeResponse("getAllSentMessages", result, "sentMessages", outbox))
+            return;
+        
+        publishOutbox(outbox);
         
     }
     
     
-    BitSentMessage BitMessage::getSentMessageByAckData(std::string ackData){
+    void BitMessage::publishOutbox(BitMessageOutbox &outbox){
         
-        Parameters params;
+        dropPendingDeletions(outbox);
         
-        params.push_back(ValueString(ackData));
+        _SharedPtr<OutboxSnapshot> next(new OutboxSnapshot(MailboxIndex::SENDER));
+        buildMailbox(outbox, *next);
+        next->index.rebuild(next->mail);
         
-        XmlResponse result = m_xmllib->run("getSentMessageByAckData", params);
+        // Lock so that we dont have a race condition with a delete.
+        INSTANTIATE_MLOCK(m_localOutboxMutex);
+        Snapshot<OutboxSnapshot>::Handle previous = m_localOutbox.load();
+        m_localOutbox.publish(next);
+        mlock.unlock();
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage getSentMessageByAckData failed" << std::endl;
-            setServerAlive(false);
-            return BitSentMessage("", "", "", base64(""), base64(""), 0, 0, "", "");
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return BitSentMessage("", "", "", base64(""), base64(""), 0, 0, "", "");
-            }
+        // The server no longer lists these, so nothing will read their bodies again
+        for(std::size_t x = 0; x < previous->records->size(); x++){
+            std::string const& msgID = (*previous->records)[x]->getMessageIDRef();
+            if(!next->index.find(msgID))
+                m_outboxBodies->erase(msgID);
         }
         
+    }
+    
+    BitSentMessage BitMessage::getSentMessageByID(std::string msgID){
         
-        Json::Value root;
-        Json::Reader reader;
+        Parameters params;
         
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse outbox" << std::endl; //reader.getFormatedErrorMessages();
-            return BitSentMessage("", "", "", base64(""), base64(""), 0, 0, "", "");
-        }
+        params.push_back(ValueString(msgID));
         
-        const Json::Value sentMessage = root["sentMessage"];
+        std::vector<BitSentMessage> messages;
+        if(!decodeResponse("getSentMessageByID", m_xmllib->run("getSentMessageByID", params), "sentMessage", messages) || messages.empty())
+            return BitSentMessage();
         
-        std::string dirtyMessage = sentMessage[0u].get("message", "").asString();
-        dirtyMessage.erase(std::remove(dirtyMessage.begin(), dirtyMessage.end(), '\n'), dirtyMessage.end());
-        base64 cleanMessage(dirtyMessage, true);
+        return messages.front();
         
+    }
+    
+    
+    BitSentMessage BitMessage::getSentMessageByAckData(std::string ackData){
         
-        BitSentMessage message(sentMessage[0u].get("msgid", "").asString(),
-                               sentMessage[0u].get("toAddress", "").asString(),
-                               sentMessage[0u].get("fromAddress", "").asString(),
-                               base64(sentMessage[0u].get("subject", "").asString(), true),
-                               cleanMessage,
-                               sentMessage[0u].get("encodingType", 0).asInt(),
-                               sentMessage[0u].get("lastActionTime", 0).asInt(),
-                               sentMessage[0u].get("status", false).asString(),
-                               sentMessage[0u].get("ackData", false).asString()
-                               );
+        Parameters params;
         
-        return message;
+        params.push_back(ValueString(ackData));
+        
+        std::vector<BitSentMessage> messages;
+        if(!decodeResponse("getSentMessageByAckData", m_xmllib->run("getSentMessageByAckData", params), "sentMessage", messages) || messages.empty())
+            return BitSentMessage();
+        
+        return messages.front();
         
     }
     
     
     std::vector<BitSentMessage> BitMessage::getSentMessagesBySender(std::string address){
         
-        
         Parameters params;
         BitMessageOutbox outbox;
         
         params.push_back(ValueString(address));
         
-        XmlResponse result = m_xmllib->run("getSentMessagesBySender", params);
+        decodeResponse("getSentMessagesBySender", m_xmllib->run("getSentMessagesBySender", params), "sentMessages", outbox);
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage getAllSentMessages failed" << std::endl;
-            setServerAlive(false);
-            return outbox;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                BitSentMessage message("", "", "", base64(""), base64(""), 0, 0, "", "");
-                return outbox;
-            }
-        }
+        return outbox;
         
-        Json::Value root;
-        Json::Reader reader;
+    }
+    
+    
+    bool BitMessage::fetchSentBody(std::string const& msgID, std::string &encoded){
         
-        const Json::Value sentMessages = root["sentMessages"];
-        for ( unsigned int index = 0; index < sentMessages.size(); ++index ){  // Iterates over the sequence elements.
-            
-            // We need to sanitize our string, or else it will get cut off because of the newlines.
-            std::string dirtyMessage = sentMessages[index].get("message", "").asString();
-            dirtyMessage.erase(std::remove(dirtyMessage.begin(), dirtyMessage.end(), '\n'), dirtyMessage.end());
-            base64 cleanMessage(dirtyMessage, true);
-            
-            BitSentMessage message(sentMessages[index].get("msgid", "").asString(),
-                                   sentMessages[index].get("toAddress", "").asString(),
-                                   sentMessages[index].get("fromAddress", "").asString(),
-                                   base64(sentMessages[index].get("subject", "").asString(), true),
-                                   cleanMessage,
-                                   sentMessages[index].get("encodingType", 0).asInt(),
-                                   std::atoi(sentMessages[index].get("lastActionTime", 0).asString().c_str()),
-                                   sentMessages[index].get("status", false).asString(),
-                                   sentMessages[index].get("ackData", false).asString()
-                                   );
-            
-            outbox.push_back(message);
-            
-        }
+        Parameters params;
+        params.push_back(ValueString(msgID));
         
-        return outbox;
+        // Not through getSentMessageByID, which can't tell a failed call from an empty message
+        std::vector<BitSentMessage> messages;
+        if(!decodeResponse("getSentMessageByID", m_xmllib->run("getSentMessageByID", params), "sentMessage", messages) || messages.empty())
+            return false;
+        
+        encoded = messages.front().releaseMessage();
+        return true;
         
     }
     
@@ -1203,19 +1590,60 @@ namespace bmwrapper {
         Parameters params;
         params.push_back(ValueString(msgID));
         
-        XmlResponse result = m_xmllib->run("trashMessage", params);
+        checkResponse("trashMessage", m_xmllib->run("trashMessage", params));
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage trashMessage failed" << std::endl;
-            setServerAlive(false);
+        // Done either way, if the server refused the next refresh brings the message back as it should
+        setDeletionPending(msgID, false);
+        
+    }
+    
+    
+    void BitMessage::setDeletionPending(std::string const& msgID, bool pending){
+        
+        INSTANTIATE_MLOCK(m_pendingDeletionsMutex);
+        
+        if(pending)
+            m_pendingDeletions.insert(msgID);
+        else
+            m_pendingDeletions.erase(msgID);
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    bool BitMessage::deletionPending(std::string const& msgID){
+        
+        INSTANTIATE_MLOCK(m_pendingDeletionsMutex);
+        bool pending = m_pendingDeletions.find(msgID) != m_pendingDeletions.end();
+        mlock.unlock();
+        
+        return pending;
+        
+    }
+    
+    
+    template<typename Record>
+    void BitMessage::dropPendingDeletions(std::vector<Record> &mailbox){
+        
+        INSTANTIATE_MLOCK(m_pendingDeletionsMutex);
+        
+        if(m_pendingDeletions.empty()){
+            mlock.unlock();
+            return;
         }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
+        
+        std::size_t kept = 0;
+        for(std::size_t x = 0; x < mailbox.size(); x++){
+            if(m_pendingDeletions.find(mailbox[x].getMessageIDRef()) == m_pendingDeletions.end()){
+                if(kept != x)
+                    mailbox[kept] = std::move(mailbox[x]);
+                kept++;
             }
         }
+        mailbox.resize(kept);
+        
+        mlock.unlock();
         
     }
     
@@ -1225,23 +1653,7 @@ namespace bmwrapper {
         Parameters params;
         params.push_back(ValueString(ackData));
         
-        XmlResponse result = m_xmllib->run("trashSentMessageByAckData", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage trashSentMessageByAckData failed" << std::endl;
-            setServerAlive(false);
-            return false;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return false;
-            }
-        }
-        
-        return true;
+        return checkResponse("trashSentMessageByAckData", m_xmllib->run("trashSentMessageByAckData", params));
         
     }
     
@@ -1251,6 +1663,13 @@ namespace bmwrapper {
     
     void BitMessage::sendMessage(std::string fromAddress, std::string toAddress, base64 subject, base64 message, int encodingType){
         
+        parseSendMessage(m_xmllib->run("sendMessage", sendMessageParameters(fromAddress, toAddress, subject, message, encodingType)));
+        
+    }
+    
+    
+    BitMessage::Parameters BitMessage::sendMessageParameters(std::string fromAddress, std::string toAddress, base64 subject, base64 message, int encodingType){
+        
         Parameters params;
         params.push_back(ValueString(fromAddress));
         params.push_back(ValueString(toAddress));
@@ -1258,20 +1677,15 @@ namespace bmwrapper {
         params.push_back(ValueString(message.encoded()));
         params.push_back(ValueInt(encodingType));
         
+        return params;
         
-        XmlResponse result = m_xmllib->run("sendMessage", params);
+    }
+    
+    
+    void BitMessage::parseSendMessage(XmlResponse result){
+        
+        checkResponse("sendMessage", result);
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage sendMessage failed" << std::endl;
-            setServerAlive(false);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
-        }
     }
     
     
@@ -1283,24 +1697,7 @@ namespace bmwrapper {
         params.push_back(ValueString(message.encoded()));
         params.push_back(ValueInt(encodingType));
         
-        
-        XmlResponse result = m_xmllib->run("sendBroadcast", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage sendBroadcast failed" << std::endl;
-            setServerAlive(false);
-            //return "";
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                //return "";
-            }
-        }
-        
-        //return std::string(ValueString(result.second));
+        checkResponse("sendBroadcast", m_xmllib->run("sendBroadcast", params));
         
     }
     
@@ -1312,47 +1709,20 @@ namespace bmwrapper {
     void BitMessage::listSubscriptions(){
         
         Parameters params;
-        BitMessageSubscriptionList subscriptionList;
         
-        XmlResponse result = m_xmllib->run("listSubscriptions", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage listSubscriptions failed" << std::endl;
-            setServerAlive(false);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
-        }
+        parseSubscriptions(m_xmllib->run("listSubscriptions", params));
         
-        Json::Value root;
-        Json::Reader reader;
+    }
+    
+    
+    void BitMessage::parseSubscriptions(XmlResponse result){
         
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse subscription list" << std::endl; //reader.getFormatedErrorMessages();
-        }
+        _SharedPtr<BitMessageSubscriptionList> subscriptionList(new BitMessageSubscriptionList());
         
-        const Json::Value subscriptions = root["subscriptions"];
-        for ( unsigned int index = 0; index < subscriptions.size(); ++index ){
-            
-            std::string dirtyLabel = subscriptions[index].get("label", "").asString();
-            dirtyLabel.erase(std::remove(dirtyLabel.begin(), dirtyLabel.end(), '\n'), dirtyLabel.end());
-            std::string cleanRipe(dirtyLabel);
-            
-            BitMessageSubscription subscription(subscriptions[index].get("address", "").asString(), subscriptions[index].get("enabled", "").asBool(), base64(cleanRipe, true));
-            
-            subscriptionList.push_back(subscription);
-            
-        }
+        if(!decodeResponse("listSubscriptions", result, "subscriptions", *subscriptionList))
+            return;
         
-        INSTANTIATE_MLOCK(m_localSubscriptionListMutex);
-        m_localSubscriptionList = subscriptionList;
-        mlock.unlock();
+        m_localSubscriptionList.publish(subscriptionList);
     }
     
     
@@ -1362,24 +1732,7 @@ namespace bmwrapper {
         params.push_back(ValueString(address));
         params.push_back(ValueString(label.encoded()));
         
-        
-        XmlResponse result = m_xmllib->run("addSubscription", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage addSubscription failed" << std::endl;
-            setServerAlive(false);
-            //return false;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                //return false;
-            }
-        }
-        
-        //return true;
+        checkResponse("addSubscription", m_xmllib->run("addSubscription", params));
         
     }
     
@@ -1389,23 +1742,7 @@ namespace bmwrapper {
         Parameters params;
         params.push_back(ValueString(address));
         
-        XmlResponse result = m_xmllib->run("deleteSubscription", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage createChan failed" << std::endl;
-            setServerAlive(false);
-            return false;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return false;
-            }
-        }
-        
-        return true;
+        return checkResponse("deleteSubscription", m_xmllib->run("deleteSubscription", params));
         
     }
     
@@ -1419,50 +1756,18 @@ namespace bmwrapper {
         Parameters params;
         params.push_back(ValueString(password.encoded()));
         
-        XmlResponse result = m_xmllib->run("createChan", params);
+        return responseString("createChan", m_xmllib->run("createChan", params));
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage createChan failed" << std::endl;
-            setServerAlive(false);
-            return "";
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return "";
-            }
-        }
-        
-        return std::string(ValueString(result.second));
-        
-    }
-    
-    
-    bool BitMessage::joinChan(base64 password, std::string address){
-        
-        Parameters params;
-        params.push_back(ValueString(password.encoded()));
-        params.push_back(ValueString(address));
-        
-        XmlResponse result = m_xmllib->run("joinChan", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage joinChan failed" << std::endl;
-            setServerAlive(false);
-            return false;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return false;
-            }
-        }
+    }
+    
+    
+    bool BitMessage::joinChan(base64 password, std::string address){
         
-        return true;
+        Parameters params;
+        params.push_back(ValueString(password.encoded()));
+        params.push_back(ValueString(address));
+        
+        return checkResponse("joinChan", m_xmllib->run("joinChan", params));
         
     }
     
@@ -1472,23 +1777,8 @@ namespace bmwrapper {
         Parameters params;
         params.push_back(ValueString(address));
         
-        XmlResponse result = m_xmllib->run("leaveChan", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage leaveChan failed" << std::endl;
-            setServerAlive(false);
-            return false;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return false;
-            }
-        }
+        return checkResponse("leaveChan", m_xmllib->run("leaveChan", params));
         
-        return true;
     }
     
     
@@ -1499,48 +1789,22 @@ namespace bmwrapper {
     
     void BitMessage::listAddresses(){
         
-        std::vector<xmlrpc_c::value> params;
-        BitMessageIdentities responses;
-        
-        XmlResponse result = m_xmllib->run("listAddresses2", params);
+        Parameters params;
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage listAddresses2 failed" << std::endl;
-            setServerAlive(false);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
-        }
+        parseAddresses(m_xmllib->run("listAddresses2", params));
         
-        Json::Value root;
-        Json::Reader reader;
+    }
+    
+    
+    void BitMessage::parseAddresses(XmlResponse result){
         
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr << "Failed to parse configuration" << std::endl; //reader.getFormatedErrorMessages();
-        }
+        _SharedPtr<IdentitySnapshot> identities(new IdentitySnapshot());
         
-        const Json::Value addresses = root["addresses"];
-        for ( unsigned int index = 0; index < addresses.size(); ++index ){
-            BitMessageIdentity entry(base64(addresses[index].get("label", "").asString(), true),
-                                     addresses[index].get("address", "").asString(),
-                                     addresses[index].get("stream", 0).asInt(),
-                                     addresses[index].get("enabled", false).asBool(),
-                                     addresses[index].get("chan", false).asBool()
-                                     );
-            
-            responses.push_back(entry);
-            
-        }
+        if(!decodeResponse("listAddresses2", result, "addresses", identities->entries))
+            return;
         
-        INSTANTIATE_MLOCK(m_localIdentitiesMutex);
-        m_localIdentities = responses;
-        mlock.unlock();
+        identities->index.rebuild(identities->entries);
+        m_localIdentities.publish(identities);
         
     }
     
@@ -1553,23 +1817,12 @@ namespace bmwrapper {
         params.push_back(ValueInt(totalDifficulty));
         params.push_back(ValueInt(smallMessageDifficulty));
         
-        
-        XmlResponse result = m_xmllib->run("createRandomAddress", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage createRandomAddress failed" << std::endl;
-            setServerAlive(false);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
-        }
+        std::string address = responseString("createRandomAddress", m_xmllib->run("createRandomAddress", params));
+        if(address.empty())
+            return;
         
         INSTANTIATE_MLOCK(m_newestCreatedAddressMutex);
-        newestCreatedAddress = std::string(ValueString(result.second));
+        newestCreatedAddress = address;
         mlock.unlock();
         
     }
@@ -1578,7 +1831,6 @@ namespace bmwrapper {
     void BitMessage::createDeterministicAddresses(base64 password, int numberOfAddresses, int addressVersionNumber, int streamNumber, bool eighteenByteRipe, int totalDifficulty, int smallMessageDifficulty){
         
         Parameters params;
-        std::vector<BitMessageAddress> addressList;
         
         params.push_back(ValueString(password.encoded()));
         params.push_back(ValueInt(numberOfAddresses));
@@ -1588,37 +1840,12 @@ namespace bmwrapper {
         params.push_back(ValueInt(totalDifficulty));
         params.push_back(ValueInt(smallMessageDifficulty));
         
+        std::string document = responseString("createDeterministicAddresses", m_xmllib->run("createDeterministicAddresses", params));
         
-        XmlResponse result = m_xmllib->run("createDeterministicAddresses", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage createDeterministicAddresses failed" << std::endl;
-            setServerAlive(false);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
-        }
-        
-        Json::Value root;
-        Json::Reader reader;
-        
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse address list" << std::endl; //reader.getFormatedErrorMessages();
-        }
-        
-        const Json::Value addresses = root["addresses"];
-        for ( unsigned int index = 0; index < addresses.size(); ++index ){  // Iterates over the sequence elements.
-            BitMessageAddress generatedAddress = addresses[index].asString();
-            
-            addressList.push_back(generatedAddress);
-            
-        }
+        // The new addresses turn up in listAddresses2, which we refresh either way
+        std::vector<BitMessageAddress> addressList;
+        if(!document.empty() && !decodeStringList(document, "addresses", addressList))
+            std::cerr << "Error: Failed to parse the response to BitMessage createDeterministicAddresses" << std::endl;
         
         OT_STD_FUNCTION(void()) secondCommand = OT_STD_BIND(&BitMessage::listAddresses, this);
         bm_queue->addToQueue(secondCommand);
@@ -1633,24 +1860,7 @@ namespace bmwrapper {
         params.push_back(ValueInt(addressVersionNumber));
         params.push_back(ValueInt(streamNumber));
         
-        
-        XmlResponse result = m_xmllib->run("getDeterministicAddress", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage getDeterministicAddress failed" << std::endl;
-            setServerAlive(false);
-            return "";
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return "";
-            }
-        }
-        
-        return std::string(ValueString(result.second));
+        return responseString("getDeterministicAddress", m_xmllib->run("getDeterministicAddress", params));
         
     }
     
@@ -1659,74 +1869,50 @@ namespace bmwrapper {
         
         Parameters params;
         
-        BitMessageAddressBook addressBook;
+        parseAddressBookEntries(m_xmllib->run("listAddressBookEntries", params));
         
-        XmlResponse result = m_xmllib->run("listAddressBookEntries", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage listAddressBookEntries failed" << std::endl;
-            setServerAlive(false);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
-        }
+    }
+    
+    
+    void BitMessage::parseAddressBookEntries(XmlResponse result){
         
-        Json::Value root;
-        Json::Reader reader;
+        _SharedPtr<AddressBookSnapshot> addressBook(new AddressBookSnapshot());
         
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse address list" << std::endl; //reader.getFormatedErrorMessages();
-        }
+        if(!decodeResponse("listAddressBookEntries", result, "addresses", addressBook->entries))
+            return;
         
-        const Json::Value addresses = root["addresses"];
-        for ( unsigned int index = 0; index < addresses.size(); ++index ){
-            
-            std::string dirtyLabel = addresses[index].get("label", "").asString();
-            dirtyLabel.erase(std::remove(dirtyLabel.begin(), dirtyLabel.end(), '\n'), dirtyLabel.end());
-            std::string cleanRipe(dirtyLabel);
-            
-            BitMessageAddressBookEntry address(addresses[index].get("address", "").asString(), base64(cleanRipe, true));
-            
-            addressBook.push_back(address);
-            
-        }
+        addressBook->index.rebuild(addressBook->entries);
         
+        // Lock so that we dont have a race condition with addContact or setLabel.
         INSTANTIATE_MLOCK(m_localAddressBookMutex);
-        m_localAddressBook = addressBook;
+        m_localAddressBook.publish(addressBook);
         mlock.unlock();
         
     }
     
     
+    void BitMessage::storeContact(std::string address, base64 label, bool replace){
+        
+        if(replace)
+            deleteAddressBookEntry(address);
+        
+        addAddressBookEntry(address, label);
+        listAddressBookEntries();
+        
+    }
+    
+    
     bool BitMessage::addAddressBookEntry(std::string address, base64 label){
         
         Parameters params;
         params.push_back(ValueString(address));
         params.push_back(ValueString(label.encoded()));
         
-        XmlResponse result = m_xmllib->run("addAddressBookEntry", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage addAddressBookEntry failed" << std::endl;
-            setServerAlive(false);
+        std::string reply = responseString("addAddressBookEntry", m_xmllib->run("addAddressBookEntry", params));
+        if(reply.empty())
             return false;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return false;
-            }
-        }
         
-        std::cerr << "BitMessage API Response: " << std::string(ValueString(result.second)) << std::endl;
+        std::cerr << "BitMessage API Response: " << reply << std::endl;
         
         return true;
         
@@ -1738,23 +1924,11 @@ namespace bmwrapper {
         Parameters params;
         params.push_back(ValueString(address));
         
-        XmlResponse result = m_xmllib->run("deleteAddressBookEntry", params);
-        
-        if(result.first == false){
-            std::cerr << "Error: BitMessage deleteAddressBookEntry failed" << std::endl;
-            setServerAlive(false);
+        std::string reply = responseString("deleteAddressBookEntry", m_xmllib->run("deleteAddressBookEntry", params));
+        if(reply.empty())
             return false;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return false;
-            }
-        }
         
-        std::cerr << "BitMessage API Response: " << std::string(ValueString(result.second)) << std::endl;
+        std::cerr << "BitMessage API Response: " << reply << std::endl;
         
         return true;
         
@@ -1766,19 +1940,8 @@ namespace bmwrapper {
         Parameters params;
         params.push_back(ValueString(address));
         
-        XmlResponse result = m_xmllib->run("deleteAddress", params);
+        checkResponse("deleteAddress", m_xmllib->run("deleteAddress", params));
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage deleteAddress " << address << " failed" << std::endl;
-            setServerAlive(false);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-            }
-        }
     }
     
     
@@ -1788,40 +1951,11 @@ namespace bmwrapper {
         
         params.push_back(ValueString(address));
         
-        XmlResponse result = m_xmllib->run("decodeAddress", params);
-        
-        if(result.first == false){
-            std::cerr << "Error Accessing BitMessage API" << std::endl;
-            setServerAlive(false);
-            return BitDecodedAddress("", 0, "", 0);
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return BitDecodedAddress("", 0, "", 0);
-            }
-        }
-        
-        
-        Json::Value root;
-        Json::Reader reader;
-        
-        bool parsesuccess = reader.parse( ValueString(result.second), root );
-        if ( !parsesuccess )
-        {
-            std::cerr  << "Failed to parse configuration" << std::endl; //reader.getFormatedErrorMessages();
-            return BitDecodedAddress("", 0, "", 0);
-        }
-        
-        const Json::Value decodedAddress = root;
+        BitDecodedAddress decodedAddress;
+        if(!decodeResponse("decodeAddress", m_xmllib->run("decodeAddress", params), decodedAddress))
+            return BitDecodedAddress();
         
-        std::string dirtyRipe = decodedAddress.get("ripe", "").asString();
-        dirtyRipe.erase(std::remove(dirtyRipe.begin(), dirtyRipe.end(), '\n'), dirtyRipe.end());
-        std::string cleanRipe(dirtyRipe);
-        
-        return BitDecodedAddress(decodedAddress.get("status", "").asString(), decodedAddress.get("addressVersion", "").asInt(), cleanRipe, decodedAddress.get("streamNumber", "").asInt());
+        return decodedAddress;
         
     }
     
@@ -1838,22 +1972,7 @@ namespace bmwrapper {
         params.push_back(ValueString(first));
         params.push_back(ValueString(second));
         
-        XmlResponse result = m_xmllib->run("helloWorld", params);
-        
-        if(result.first == false){
-            setServerAlive(false);
-            return "";
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return "";
-            }
-        }
-        
-        return std::string(ValueString(result.second));
+        return responseString("helloWorld", m_xmllib->run("helloWorld", params));
         
     }
     
@@ -1866,25 +1985,15 @@ namespace bmwrapper {
         
         XmlResponse result = m_xmllib->run("add", params);
         
-        if(result.first == false){
-            std::cerr << "Error: BitMessage add failed" << std::endl;
-            setServerAlive(false);
+        if(!checkResponse("add", result))
             return -1;
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return -1;
-            }
+        
+        if(result.second.type() != xmlrpc_c::value::TYPE_INT){
             std::cerr << "Unexpected Response to API Command: add" << std::endl;
-            std::cerr << std::string(ValueString(result.second)) << std::endl;
             return -1;
         }
-        else{
-            return ValueInt(result.second);
-        }
+        
+        return ValueInt(result.second);
         
     }
     
@@ -1895,52 +2004,168 @@ namespace bmwrapper {
         
         params.push_back(ValueString(ackData));
         
-        XmlResponse result = m_xmllib->run("getStatus", params);
+        return responseString("getStatus", m_xmllib->run("getStatus", params));
         
-        if(result.first == false){
-            std::cerr << "Error Accessing BitMessage API" << std::endl;
-            setServerAlive(false);
-            return "";
-        }
-        else if(result.second.type() == xmlrpc_c::value::TYPE_STRING){
-            std::size_t found;
-            found=std::string(ValueString(result.second)).find("API Error");
-            if(found!=std::string::npos){
-                std::cerr << std::string(ValueString(result.second)) << std::endl;
-                return "";
-            }
-        }
+    }
+    
+    
+    
+    // Extra BitMessage Options
+    
+    void BitMessage::setTimeout(int timeout){
+        
+        m_xmllib->setTimeout(timeout);
+        
+    }
+    
+    
+    void BitMessage::setConnectionPoolSize(int poolSize){
+        
+        m_xmllib->setPoolSize(poolSize);
+        
+    }
+    
+    
+    void BitMessage::setResponseSizeLimit(std::size_t sizeLimit){
+        
+        m_xmllib->setResponseSizeLimit(sizeLimit);
+        
+    }
+    
+    
+    RPCStatsSnapshot BitMessage::getRPCStats(){
+        
+        return m_xmllib->getStats();
+        
+    }
+    
+    
+    void BitMessage::resetRPCStats(){
+        
+        m_xmllib->resetStats();
+        
+    }
+    
+    
+    void BitMessage::setCircuitBreaker(int failureThreshold, int baseBackoff, int maxBackoff){
+        
+        m_xmllib->setCircuitBreaker(failureThreshold, baseBackoff, maxBackoff);
+        
+    }
+    
+    
+    void BitMessage::setIncrementalSync(bool incremental){
+        
+        m_incrementalSync = incremental;
+        
+    }
+    
+    
+    void BitMessage::setMailBodyBudget(std::size_t budget){
+        
+        m_inboxBodies->setBudget(budget);
+        m_outboxBodies->setBudget(budget);
+        
+    }
+    
+    
+    void BitMessage::setParallelDecodeThreshold(std::size_t threshold){
         
-        return std::string(ValueString(result.second));
+        INSTANTIATE_MLOCK(m_decodePoolMutex);
+        m_parallelDecodeThreshold = threshold;
+        mlock.unlock();
         
     }
     
     
     void BitMessage::setServerAlive(bool alive){
         
+        INSTANTIATE_MLOCK(m_proberMutex);
+        
         if(alive){
-            NetCounter::setAlive();
-            m_serverAvailable = true;
+            if(OT_ATOMIC_ISFALSE(m_serverAvailable)){
+                std::cerr << "BitMessage API Service is now accessible" << std::endl;
+                NetCounter::setAlive();
+                m_serverAvailable = true;
+            }
         }
-        else{
+        else if(OT_ATOMIC_ISTRUE(m_serverAvailable) && m_xmllib->circuitState() != CircuitBreaker::CLOSED){
+            // A single failed call doesn't write the server off, only a tripped breaker does.
+            std::cerr << "Error: BitMessage API service is inaccessible" << std::endl;
             NetCounter::dead();
             m_serverAvailable = false;
         }
         
+        mlock.unlock();
+        
+        // Either way the prober decides what happens next
+        m_proberWake.notify_one();
+        
     }
     
     void BitMessage::checkAlive(){
         
+        // Taking the lock makes sure the prober is either waiting or about to look at the server state.
+        INSTANTIATE_MLOCK(m_proberMutex);
+        mlock.unlock();
+        m_proberWake.notify_one();
+        
+    }
+    
+    bool BitMessage::probeServer(){
+        
         if(helloWorld("Check","Alive") != "Check-Alive"){
-            std::cerr << "Error: BitMessage API service is inaccessible" << std::endl;
             setServerAlive(false);
+            return false;
         }
-        else{
-            std::cerr << "BitMessage API Service is now accessible" << std::endl;
-            setServerAlive(true);
-            initializeUserData();
+        
+        setServerAlive(true);
+        return true;
+        
+    }
+    
+    void BitMessage::runProber(){
+        
+        bool probeFailed = false;
+        
+        INSTANTIATE_MLOCK(m_proberMutex);
+        
+        while(!m_stopProber){
+            
+            // Nothing to do while the server is up, a failed call will wake us.
+            if(OT_ATOMIC_ISTRUE(m_serverAvailable) && m_xmllib->circuitState() == CircuitBreaker::CLOSED){
+                probeFailed = false;
+                m_proberWake.wait(mlock);
+                continue;
+            }
+            
+            // Wait out the breaker's backoff. If the server answered our last probe with something other
+            // than a pong the breaker is still closed, so hold off for a moment on our own.
+            int wait = m_xmllib->circuitRetryMillis();
+            if(wait == 0 && probeFailed)
+                wait = 1000;
+            
+            if(wait > 0){
+                probeFailed = false;
+                m_proberWake.wait_for(mlock, std::chrono::milliseconds(wait));
+                continue;
+            }
+            
+            mlock.unlock();
+            
+            bool wasAvailable = OT_ATOMIC_ISTRUE(m_serverAvailable);
+            probeFailed = !probeServer();
+            
+            // The server is back, bring our local copies up to date in the background.
+            if(!probeFailed && !wasAvailable)
+                bm_queue->addToQueue(OT_STD_BIND(&BitMessage::initializeUserData, this));
+            
+            mlock.lock();
+            
         }
         
+        mlock.unlock();
+        
     }
     
     void BitMessage::parseCommstring(std::string commstring){
@@ -1972,15 +2197,95 @@ namespace bmwrapper {
         else
             m_pass = "defaultpass";
         
+        // Optional, no cache file is kept without it
+        if(parsedList.size() > 4)
+            m_cachePath = parsedList.at(4);
+        
     }
     
     void BitMessage::initializeUserData(){
         
-        listAddresses(); // Populates Local Owned Addresses.
-        listAddressBookEntries();  // Populates address book data.
-        getAllInboxMessages(); // Populates local Inbox object.
-        getAllSentMessages(); // Populates local Outbox (sent messages) object.
-        listSubscriptions(); // Populates local subscriptions list.
+        Parameters params;
+        
+        // An inbox we already have, from the cache or before the server went away, only needs what changed
+        bool incremental = OT_ATOMIC_ISTRUE(m_incrementalSync) && !m_localInbox.load()->records->empty();
+        
+        // Start every request up front so that their round trips overlap.
+        XmlAsyncResponse addresses = m_xmllib->runAsync("listAddresses2", params);
+        XmlAsyncResponse addressBook = m_xmllib->runAsync("listAddressBookEntries", params);
+        XmlAsyncResponse inbox = m_xmllib->runAsync(incremental ? "getAllInboxMessageIds" : "getAllInboxMessages", params);
+        XmlAsyncResponse outbox = m_xmllib->runAsync("getAllSentMessages", params);
+        XmlAsyncResponse subscriptions = m_xmllib->runAsync("listSubscriptions", params);
+        
+        m_xmllib->finishAsync();
+        
+        parseAddresses(addresses.get()); // Populates Local Owned Addresses.
+        parseAddressBookEntries(addressBook.get());  // Populates address book data.
+        
+        // Populates local Inbox object.
+        if(incremental)
+            parseInboxMessageIds(inbox.get());
+        else
+            parseAllInboxMessages(inbox.get());
+        
+        parseAllSentMessages(outbox.get()); // Populates local Outbox (sent messages) object.
+        parseSubscriptions(subscriptions.get()); // Populates local subscriptions list.
+        
+        saveCache();
+        
+    }
+    
+    
+    std::string BitMessage::cacheSource(){
+        
+        return m_host + ":" + std::to_string(m_port);
+        
+    }
+    
+    
+    bool BitMessage::loadCache(){
+        
+        if(m_cachePath.empty())
+            return false;
+        
+        _SharedPtr<IdentitySnapshot> identities(new IdentitySnapshot());
+        _SharedPtr<AddressBookSnapshot> addressBook(new AddressBookSnapshot());
+        _SharedPtr<BitMessageSubscriptionList> subscriptions(new BitMessageSubscriptionList());
+        BitMessageInbox inbox;
+        BitMessageOutbox outbox;
+        
+        MailboxCache cache(m_cachePath, cacheSource());
+        if(!cache.load(identities->entries, addressBook->entries, *subscriptions, inbox, outbox))
+            return false;
+        
+        identities->index.rebuild(identities->entries);
+        addressBook->index.rebuild(addressBook->entries);
+        
+        m_localIdentities.publish(identities);
+        m_localAddressBook.publish(addressBook);
+        m_localSubscriptionList.publish(subscriptions);
+        publishInbox(inbox);
+        publishOutbox(outbox);
+        
+        return true;
+        
+    }
+    
+    
+    bool BitMessage::saveCache(){
+        
+        if(m_cachePath.empty())
+            return false;
+        
+        // Handles, so the caches can keep refreshing while we write
+        Snapshot<IdentitySnapshot>::Handle identities = m_localIdentities.load();
+        Snapshot<AddressBookSnapshot>::Handle addressBook = m_localAddressBook.load();
+        Snapshot<BitMessageSubscriptionList>::Handle subscriptions = m_localSubscriptionList.load();
+        Snapshot<InboxSnapshot>::Handle inbox = m_localInbox.load();
+        Snapshot<OutboxSnapshot>::Handle outbox = m_localOutbox.load();
+        
+        MailboxCache cache(m_cachePath, cacheSource());
+        return cache.save(identities->entries, addressBook->entries, *subscriptions, *inbox, *outbox);
         
     }
     
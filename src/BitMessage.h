@@ -5,12 +5,18 @@
 
 #include <string>
 #include <ctime>
+#include <unordered_set>
 #include "Network.h"
 #include "TR1_Wrapper.hpp"
 #include "BMThreading.h"
 #include "base64.h"
 #include "XmlRPC.h"
 #include "BitMessageQueue.h"
+#include "WorkerPool.h"
+#include "MailboxIndex.h"
+#include "Snapshot.h"
+#include "MailBodyCache.h"
+#include "AddressIndex.h"
 
 
 namespace bmwrapper{
@@ -18,10 +24,16 @@ namespace bmwrapper{
     
     typedef std::string BitMessageAddress;
     
+    // Field tables for decoding API responses into the classes below, see ResponseDecoder.h
+    template<typename Record> struct ResponseFields;
+    
+    class MailboxCache;
+    
     class BitMessageIdentity {
         
     public:
         
+        BitMessageIdentity() : m_stream(0), m_enabled(false), m_chan(false) {}
         BitMessageIdentity(base64 label, BitMessageAddress address, int stream=1, bool enabled=true, bool chan=false) : m_label(label), m_address(address), m_stream(stream), m_enabled(enabled), m_chan(chan) {}
         
         // Note "getLabel" returns a base64 formatted label, you will need to decode this object via base64::decoded
@@ -31,6 +43,9 @@ namespace bmwrapper{
         bool getEnabled(){return m_enabled;}
         bool getChan(){return m_chan;}
         
+        const base64& getLabelRef() const {return m_label;}
+        const BitMessageAddress& getAddressRef() const {return m_address;}
+        
     private:
         
         base64 m_label;
@@ -39,6 +54,9 @@ namespace bmwrapper{
         bool m_enabled;
         bool m_chan;
         
+        friend struct ResponseFields<BitMessageIdentity>;
+        friend class MailboxCache;
+        
     };
     
     typedef std::vector<BitMessageIdentity> BitMessageIdentities;
@@ -48,16 +66,23 @@ namespace bmwrapper{
         
     public:
         
+        BitMessageAddressBookEntry() {}
         BitMessageAddressBookEntry(BitMessageAddress address, base64 label) : m_address(address), m_label(label) {}
         
         BitMessageAddress getAddress(){return m_address;}
         base64 getLabel(){return m_label;}
         
+        const BitMessageAddress& getAddressRef() const {return m_address;}
+        const base64& getLabelRef() const {return m_label;}
+        
     private:
         
         BitMessageAddress m_address;
         base64 m_label;
         
+        friend struct ResponseFields<BitMessageAddressBookEntry>;
+        friend class MailboxCache;
+        
     };
     
     typedef std::vector<BitMessageAddressBookEntry> BitMessageAddressBook;
@@ -67,27 +92,35 @@ namespace bmwrapper{
         
     public:
         
+        BitMessageSubscription() : m_enabled(false) {}
         BitMessageSubscription(std::string address, bool enabled, base64 label) : m_address(address), m_enabled(enabled), m_label(label) {}
         
         std::string getAddress(){return m_address;}
         bool getEnabled(){return m_enabled;}
         base64 getLabel(){return m_label;}
         
+        const std::string& getAddressRef() const {return m_address;}
+        const base64& getLabelRef() const {return m_label;}
+        
     private:
         
         std::string m_address;
         bool m_enabled;
         base64 m_label;
         
+        friend struct ResponseFields<BitMessageSubscription>;
+        friend class MailboxCache;
+        
     };
     
     typedef std::vector<BitMessageSubscription> BitMessageSubscriptionList;
     
     
-    class BitInboxMessage {
+    class BitInboxMessage : public NetworkMailHeaders {
         
     public:
         
+        BitInboxMessage() : m_encodingType(0), m_receivedTime(0), m_read(false) {}
         BitInboxMessage(std::string msgID, BitMessageAddress toAddress, BitMessageAddress fromAddress, base64 subject, base64 message, int encodingType, std::time_t m_receivedTime, bool m_read) : m_msgID(msgID), m_toAddress(toAddress), m_fromAddress(fromAddress), m_subject(subject), m_message(message), m_encodingType(encodingType), m_receivedTime(m_receivedTime), m_read(m_read) {}
         
         std::string getMessageID(){return m_msgID;}
@@ -96,8 +129,26 @@ namespace bmwrapper{
         base64 getSubject(){return m_subject;}
         base64 getMessage(){return m_message;}
         int getEncodingType(){return m_encodingType;}
-        std::time_t getReceivedTime(){return m_receivedTime;}
-        bool getRead(){return m_read;}
+        std::time_t getReceivedTime() const {return m_receivedTime;}
+        bool getRead() const {return m_read;}
+        
+        // By reference, without copying the strings out
+        const std::string& getMessageIDRef() const {return m_msgID;}
+        const BitMessageAddress& getToAddressRef() const {return m_toAddress;}
+        const BitMessageAddress& getFromAddressRef() const {return m_fromAddress;}
+        const base64& getSubjectRef() const {return m_subject;}
+        const base64& getMessageRef() const {return m_message;}
+        
+        // Moves the encoded message out, once the body is kept somewhere else
+        std::string releaseMessage(){return m_message.release();}
+        
+        // NetworkMailHeaders, for the NetworkMail views over the local inbox
+        const std::string& fromRef() const {return m_fromAddress;}
+        const std::string& toRef() const {return m_toAddress;}
+        const std::string& encodedSubjectRef() const {return m_subject.encodedRef();}
+        const std::string& messageIDRef() const {return m_msgID;}
+        std::time_t receivedTime() const {return m_receivedTime;}
+        std::time_t sentTime() const {return 0;}
         
         
     private:
@@ -111,15 +162,20 @@ namespace bmwrapper{
         std::time_t m_receivedTime;
         bool m_read;
         
+        friend struct ResponseFields<BitInboxMessage>;
+        friend class MailboxCache;
+        
     };
     
     typedef std::vector<BitInboxMessage> BitMessageInbox;
+    typedef std::vector<_SharedPtr<const BitInboxMessage> > BitInboxRecords; // Shared with the NetworkMail views over them
     
     
-    class BitSentMessage {
+    class BitSentMessage : public NetworkMailHeaders {
         
     public:
         
+        BitSentMessage() : m_encodingType(0), m_lastActionTime(0) {}
         BitSentMessage(std::string msgID, BitMessageAddress toAddress, BitMessageAddress fromAddress, base64 subject, base64 message, int encodingType, std::time_t lastActionTime, std::string status, std::string ackData) : m_msgID(msgID), m_toAddress(toAddress), m_fromAddress(fromAddress), m_subject(subject), m_message(message), m_encodingType(encodingType), m_lastActionTime(lastActionTime), m_status(status), m_ackData(ackData) {}
         
         std::string getMessageID(){return m_msgID;}
@@ -128,10 +184,30 @@ namespace bmwrapper{
         base64 getSubject(){return m_subject;}
         base64 getMessage(){return m_message;}
         int getEncodingType(){return m_encodingType;}
-        std::time_t getLastActionTime(){return m_lastActionTime;}
+        std::time_t getLastActionTime() const {return m_lastActionTime;}
         std::string getStatus(){return m_status;}
         std::string getAckData(){return m_ackData;}
         
+        // By reference, without copying the strings out
+        const std::string& getMessageIDRef() const {return m_msgID;}
+        const BitMessageAddress& getToAddressRef() const {return m_toAddress;}
+        const BitMessageAddress& getFromAddressRef() const {return m_fromAddress;}
+        const base64& getSubjectRef() const {return m_subject;}
+        const base64& getMessageRef() const {return m_message;}
+        const std::string& getStatusRef() const {return m_status;}
+        const std::string& getAckDataRef() const {return m_ackData;}
+        
+        // Moves the encoded message out, once the body is kept somewhere else
+        std::string releaseMessage(){return m_message.release();}
+        
+        // NetworkMailHeaders, for the NetworkMail views over the local outbox
+        const std::string& fromRef() const {return m_fromAddress;}
+        const std::string& toRef() const {return m_toAddress;}
+        const std::string& encodedSubjectRef() const {return m_subject.encodedRef();}
+        const std::string& messageIDRef() const {return m_msgID;}
+        std::time_t receivedTime() const {return 0;}
+        std::time_t sentTime() const {return m_lastActionTime;}
+        
         
     private:
         
@@ -145,15 +221,20 @@ namespace bmwrapper{
         std::string m_status;
         std::string m_ackData;
         
+        friend struct ResponseFields<BitSentMessage>;
+        friend class MailboxCache;
+        
     };
     
     typedef std::vector<BitSentMessage> BitMessageOutbox;
+    typedef std::vector<_SharedPtr<const BitSentMessage> > BitSentRecords;
     
     
     class BitDecodedAddress {
         
     public:
         
+        BitDecodedAddress() : m_addressVersion(0), m_streamNumber(0) {}
         BitDecodedAddress(std::string status, int addressVersion, std::string ripe, int streamNumber) : m_status(status), m_addressVersion(addressVersion), m_ripe(ripe), m_streamNumber(streamNumber) {}
         
         std::string getStatus(){return m_status;}
@@ -169,6 +250,8 @@ namespace bmwrapper{
         std::string m_ripe;
         int m_streamNumber;
         
+        friend struct ResponseFields<BitDecodedAddress>;
+        
     };
     
     // Pre-defined here so we can hold one as an object in our BitMessage class.
@@ -178,6 +261,8 @@ namespace bmwrapper{
         
     public:
         
+        // commstring is "host,port,user,pass". The host may also be "unix:/path/to/socket" or
+        // "inproc:name" to reach the API server without TCP, see XmlTransportType.
         BitMessage(std::string commstring);
         ~BitMessage();
         
@@ -220,6 +305,20 @@ namespace bmwrapper{
         std::vector<_SharedPtr<NetworkMail> > getUnreadMail(std::string address);
         std::vector<_SharedPtr<NetworkMail> > getAllUnreadMail();
         
+        // The whole inbox or outbox as of the last refresh, newest first, without copying it.
+        // The handle stays valid however long it is kept, later refreshes don't change what it holds.
+        typedef _SharedPtr<const std::vector<_SharedPtr<NetworkMail> > > MailboxHandle;
+        
+        MailboxHandle getInboxSnapshot();
+        MailboxHandle getOutboxSnapshot();
+        
+        // The API's record behind a mail in the local inbox or outbox, for the fields NetworkMail doesn't
+        // carry (encoding type, status, ackData). The mail is a view over this same record. Empty if there's no such message.
+        // Records are never changed once published, so a record's read flag is as the API last listed it, the
+        // mail's getRead is the current one.
+        _SharedPtr<const BitInboxMessage> getInboxRecord(std::string messageID);
+        _SharedPtr<const BitSentMessage> getOutboxRecord(std::string messageID);
+        
         // Any part of the message should be able to be used to delete it from an inbox
         bool deleteMessage(std::string messageID);
         // Any part of the message should be able to be used to delete it from an outbox
@@ -240,8 +339,10 @@ namespace bmwrapper{
         bool subscribeToAddress(std::string address, std::string label);
         
         // Functions for importing/exporting from BitMessage server addressbook
+        // Lookups check our own addresses first and then the address book, both as of their last refresh.
         
         std::string getLabel(std::string address);
+        // Relabels an address book entry, our own addresses can't be relabeled through the API.
         bool setLabel(std::string label, std::string address);
         std::string getAddressFromLabel(std::string label);
         bool addContact(std::string label, std::string address);
@@ -258,6 +359,9 @@ namespace bmwrapper{
         bool flushQueue();
         int queueSize();
         
+        // True once everything queued so far has been processed
+        bool queueIdle();
+        
         
         //
         // Core API Functions
@@ -349,6 +453,34 @@ namespace bmwrapper{
         
         void setTimeout(int timeout);
         
+        // Number of API server connections shared by the queue and caller threads.
+        void setConnectionPoolSize(int poolSize);
+        
+        // Largest API response, in bytes, that will be accepted. Raise this for very large mailboxes.
+        void setResponseSizeLimit(std::size_t sizeLimit);
+        
+        // Latency histograms, byte counts and error counters for each API method called so far.
+        RPCStatsSnapshot getRPCStats();
+        void resetRPCStats();
+        
+        // After failureThreshold consecutive failed calls, calls fail immediately while the API server
+        // is given time to recover. Backoffs are in milliseconds and double on every failed probe.
+        void setCircuitBreaker(int failureThreshold, int baseBackoff, int maxBackoff);
+        
+        // On by default. checkMail() then asks for the inbox's message IDs and downloads only the messages
+        // it hasn't cached yet, dropping the ones the server no longer has. Read flags of messages that
+        // are already cached aren't refreshed, turn this off to pick up changes made by other clients,
+        // or for API servers without getAllInboxMessageIds.
+        void setIncrementalSync(bool incremental);
+        
+        // Bytes of message bodies held in memory for each of the inbox and outbox, 64MB by default.
+        // The least recently read go first, and are fetched from the API server again when next read.
+        void setMailBodyBudget(std::size_t budget);
+        
+        // Inbox and outbox refreshes of at least this many messages are built across a pool of worker
+        // threads, which also decode the subjects ahead of time. 0 keeps every refresh on one thread.
+        void setParallelDecodeThreshold(std::size_t threshold);
+        
         
     private:
         
@@ -371,8 +503,9 @@ namespace bmwrapper{
         int m_port;
         std::string m_pass;
         std::string m_username;
+        std::string m_cachePath;
         
-        bool m_serverAvailable;
+        OT_ATOMIC(m_serverAvailable);
         
         // If this is set, the class will ignore the status of the queue processing and force a shut down of the network.
         bool m_forceKill;
@@ -385,7 +518,27 @@ namespace bmwrapper{
         
         void setServerAlive(bool alive);
         void parseCommstring(std::string commstring);
-        void checkAlive(); // Forces a health check of the BitMessage API Server
+        
+        // Every API response goes through these. A failed call or an "API Error" reply is logged and
+        // reported as false, otherwise the payload is decoded through the record's field table.
+        bool checkResponse(const char *methodName, XmlResponse const& result);
+        std::string responseString(const char *methodName, XmlResponse const& result);
+        template<typename Record> bool decodeResponse(const char *methodName, XmlResponse const& result, Record &record);
+        template<typename Record> bool decodeResponse(const char *methodName, XmlResponse const& result, const char *listKey, std::vector<Record> &records);
+        void checkAlive(); // Asks the prober to run a health check of the BitMessage API Server, does not block
+        
+        
+        // Server Health Checks
+        // A single background thread probes the server while it is unreachable, so that callers
+        // fail fast instead of each running their own blocking health check.
+        
+        OT_THREAD m_prober;
+        OT_MUTEX(m_proberMutex); // Also guards changes to m_serverAvailable
+        CONDITION_VARIABLE(m_proberWake);
+        bool m_stopProber;
+        
+        void runProber();
+        bool probeServer();
         
         
         // Message Queing Plugs
@@ -396,37 +549,92 @@ namespace bmwrapper{
         
         void initializeUserData(); // Manually pulls down startup data for BitMessage Class.
         
+        // The startup cache, see MailboxCache. Both do nothing without a cache path in the commstring.
+        std::string cacheSource();
+        bool loadCache();
+        bool saveCache();
+        
+        // Response handlers for the calls above, so their requests can be issued asynchronously
+        // or batched through the message queue.
+        void parseAllInboxMessages(XmlResponse result);
+        void parseInboxMessageIds(XmlResponse result); // Incremental sync, fetches whatever is new
+        void parseAllSentMessages(XmlResponse result);
+        void parseSubscriptions(XmlResponse result);
+        void parseAddresses(XmlResponse result);
+        void parseAddressBookEntries(XmlResponse result);
+        
+        // Queued by addContact and setLabel, replace deletes the old entry first. The address book is
+        // listed again afterwards, which also undoes the local change if the server refused it.
+        void storeContact(std::string address, base64 label, bool replace);
+        void parseSendMessage(XmlResponse result);
+        
+        // Moves the records into mailbox, their bodies into the mailbox's MailBodyCache, and fills its mail
+        // with views over them, newest first. In parallel when there are enough messages to be worth it.
+        void buildMailbox(BitMessageInbox &inbox, MailboxSnapshot<BitInboxMessage> &mailbox);
+        void buildMailbox(BitMessageOutbox &outbox, MailboxSnapshot<BitSentMessage> &mailbox);
+        WorkerPool* decodePool(std::size_t count); // nullptr if count is below the threshold
+        
+        // Replaces the local inbox or outbox, the records are moved out.
+        void publishInbox(BitMessageInbox &inbox);
+        void publishOutbox(BitMessageOutbox &outbox);
         
-        // Local Objects and their corresponding Mutexes for thread safety.
+        // Messages deleted locally whose trashMessage call hasn't finished yet. The server still lists them
+        // until it has, so refreshes skip them rather than bring them back.
+        void setDeletionPending(std::string const& msgID, bool pending);
+        bool deletionPending(std::string const& msgID);
+        template<typename Record> void dropPendingDeletions(std::vector<Record> &mailbox);
+        
+        Parameters sendMessageParameters(std::string fromAddress, std::string toAddress, base64 subject, base64 message, int encodingType);
+        
+        
+        // Mailbox Decoding
+        
+        WorkerPool *m_decodePool; // Created on the first refresh that is large enough to need it
+        OT_MUTEX(m_decodePoolMutex);
+        std::size_t m_parallelDecodeThreshold;
+        
+        
+        // Local Objects
+        // Each is published as an immutable Snapshot, so readers never wait on a refresh. The mutexes
+        // only keep writers that change a snapshot in place (delete, markRead) from losing each other's changes.
         
         OT_MUTEX(m_newestCreatedAddressMutex);
         std::string newestCreatedAddress;
         
-        OT_MUTEX(m_localIdentitiesMutex);
+        typedef AddressSnapshot<BitMessageIdentity> IdentitySnapshot;
+        typedef AddressSnapshot<BitMessageAddressBookEntry> AddressBookSnapshot;
         
         // The addresses we have the ability to decrypt messages for.
-        BitMessageIdentities m_localIdentities;
+        Snapshot<IdentitySnapshot> m_localIdentities;
         
+        // Remote user addresses.
         OT_MUTEX(m_localAddressBookMutex);
+        Snapshot<AddressBookSnapshot> m_localAddressBook;
         
-        // Remote user addresses.
-        BitMessageAddressBook m_localAddressBook;
+        OT_ATOMIC(m_incrementalSync);
         
-        OT_MUTEX(m_localInboxMutex);
-        std::vector<_SharedPtr<NetworkMail> > m_localInbox;
+        typedef MailboxSnapshot<BitInboxMessage> InboxSnapshot; // Indexed by recipient
+        typedef MailboxSnapshot<BitSentMessage> OutboxSnapshot; // Indexed by sender
         
-        // Necessary for doing operations on BitMessage-specific messages
-        BitMessageInbox m_localUnformattedInbox;
+        OT_MUTEX(m_localInboxMutex);
+        Snapshot<InboxSnapshot> m_localInbox;
         OT_ATOMIC(m_newMailExists);
         
         OT_MUTEX(m_localOutboxMutex);
-        std::vector<_SharedPtr<NetworkMail> > m_localOutbox;
+        Snapshot<OutboxSnapshot> m_localOutbox;
+        
+        // Taken inside the inbox and outbox mutexes, never the other way around
+        OT_MUTEX(m_pendingDeletionsMutex);
+        std::unordered_set<std::string> m_pendingDeletions;
+        
+        // The snapshots only hold headers, bodies live here within a memory budget.
+        _SharedPtr<MailBodyCache> m_inboxBodies;
+        _SharedPtr<MailBodyCache> m_outboxBodies;
         
-        // Necessary for doing operations on BitMessage-specific messages
-        BitMessageOutbox m_localUnformattedOutbox;
+        bool fetchInboxBody(std::string const& msgID, std::string &encoded);
+        bool fetchSentBody(std::string const& msgID, std::string &encoded);
         
-        OT_MUTEX(m_localSubscriptionListMutex);
-        BitMessageSubscriptionList m_localSubscriptionList;
+        Snapshot<BitMessageSubscriptionList> m_localSubscriptionList;
         
     };
     
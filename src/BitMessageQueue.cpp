@@ -8,6 +8,11 @@
 
 namespace bmwrapper {
     
+    static bool isRPCCommand(BitMessageCommand const& command){
+        return command.rpc;
+    }
+    
+    
     bool BitMessageQueue::start() {
         
         if(m_stop){
@@ -48,7 +53,14 @@ namespace bmwrapper {
     
     void BitMessageQueue::addToQueue(OT_STD_FUNCTION(void()) command){
         
-        MasterQueue.push(command);
+        MasterQueue.push(BitMessageCommand(command));
+        
+    }
+    
+    
+    void BitMessageQueue::addToQueue(std::string methodName, std::vector<xmlrpc_c::value> parameters, XmlResponseHandler handler){
+        
+        MasterQueue.push(BitMessageCommand(std::make_pair(methodName, parameters), handler));
         
     }
     
@@ -73,8 +85,8 @@ namespace bmwrapper {
         
         while(!m_stop){
             if(!parseNextMessage()){
-                std::chrono::seconds dura( 1 );
-                OT_THREAD_SLEEP( dura );
+                // Pick new work up as soon as it arrives, but look at m_stop at least once a second.
+                MasterQueue.waitForItem(1000);
             }
         }
         
@@ -94,10 +106,23 @@ namespace bmwrapper {
         // Don't let other functions interfere with our message parsing
         INSTANTIATE_MLOCK(m_processing);
         
-        // Pull out our function to run
-        OT_STD_FUNCTION(void()) message = MasterQueue.pop();
+        // Set before popping, so that an empty queue that isn't processing really is idle
+        m_working = true;
+        
+        // Pull out our next command to run
+        BitMessageCommand message = MasterQueue.pop();
         
-        message();
+        if(message.rpc){
+            // Take every RPC queued right behind this one along in the same request.
+            std::vector<BitMessageCommand> batch = MasterQueue.popWhile(isRPCCommand, m_batchSize - 1);
+            batch.insert(batch.begin(), message);
+            runBatch(batch);
+        }
+        else{
+            message.command();
+        }
+        
+        m_working = false;
         
         mlock.unlock();
         
@@ -111,6 +136,29 @@ namespace bmwrapper {
     }
     
     
+    void BitMessageQueue::runBatch(std::vector<BitMessageCommand> batch){
+        
+        std::vector<XmlResponse> responses;
+        
+        if(m_xmllib != nullptr){
+            std::vector<XmlCall> calls;
+            for(unsigned int x = 0; x < batch.size(); x++){
+                calls.push_back(batch.at(x).call);
+            }
+            responses = m_xmllib->multicall(calls);
+        }
+        
+        // Hand every response back to the handler that asked for it, failures included.
+        for(unsigned int x = 0; x < batch.size(); x++){
+            if(x < responses.size())
+                batch.at(x).handler(responses.at(x));
+            else
+                batch.at(x).handler(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(""))));
+        }
+        
+    }
+    
+    
     BitMessageQueue::~BitMessageQueue(){
         
         try{
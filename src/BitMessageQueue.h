@@ -4,16 +4,34 @@
 //
 #include <iostream>
 #include "MsgQueue.h"
+#include "XmlRPC.h"
 
 namespace bmwrapper {
     
     class BitMessage;
     
+    typedef OT_STD_FUNCTION(void(XmlResponse)) XmlResponseHandler;
+    
+    // A queued unit of work, either a plain command or an RPC whose response is passed to a handler.
+    // RPCs that sit next to each other in the queue are sent together in one system.multicall request.
+    struct BitMessageCommand {
+        
+        BitMessageCommand() : rpc(false) {}
+        BitMessageCommand(OT_STD_FUNCTION(void()) function) : command(function), rpc(false) {}
+        BitMessageCommand(XmlCall xmlCall, XmlResponseHandler responseHandler) : call(xmlCall), handler(responseHandler), rpc(true) {}
+        
+        OT_STD_FUNCTION(void()) command;
+        XmlCall call;
+        XmlResponseHandler handler;
+        bool rpc;
+        
+    };
+    
     class BitMessageQueue {
         
     public:
         
-        BitMessageQueue() : m_stop(true), m_thread() { }
+        BitMessageQueue(XmlRPC *xmllib=nullptr) : m_stop(true), m_thread(), m_working(false), m_xmllib(xmllib), m_batchSize(32) { }
         ~BitMessageQueue();
         
         // Public Thread Managers
@@ -23,10 +41,15 @@ namespace bmwrapper {
         bool processing();
         // Queue Managers
         void addToQueue(OT_STD_FUNCTION(void()) command);
+        void addToQueue(std::string methodName, std::vector<xmlrpc_c::value> parameters, XmlResponseHandler handler);
         
         int queueSize();
         void clearQueue();
         
+        // Maximum number of queued RPCs sent in a single system.multicall request.
+        void setBatchSize(unsigned int batchSize){m_batchSize = batchSize > 0 ? batchSize : 1;}
+        unsigned int getBatchSize(){return m_batchSize;}
+        
     protected:
         
         OT_ATOMIC(m_stop);
@@ -41,11 +64,15 @@ namespace bmwrapper {
         CONDITION_VARIABLE(m_conditional);
         OT_ATOMIC(m_working);
         
-        MsgQueue<OT_STD_FUNCTION(void())> MasterQueue;
+        XmlRPC *m_xmllib;
+        unsigned int m_batchSize;
+        
+        MsgQueue<BitMessageCommand> MasterQueue;
         
         // Functions
         
         bool parseNextMessage();
+        void runBatch(std::vector<BitMessageCommand> batch);
         
     };
     
@@ -0,0 +1,142 @@
+//
+//  CircuitBreaker.cpp
+//
+
+#include "CircuitBreaker.h"
+
+namespace bmwrapper {
+    
+    
+    CircuitBreaker::CircuitBreaker(int failureThreshold, int baseBackoff, int maxBackoff) : m_state(CLOSED), m_failureThreshold(failureThreshold > 0 ? failureThreshold : 1), m_baseBackoff(baseBackoff > 0 ? baseBackoff : 1), m_maxBackoff(maxBackoff > baseBackoff ? maxBackoff : baseBackoff), m_consecutiveFailures(0), m_trips(0), m_probeInFlight(false), m_jitter(std::random_device()()) {
+        
+    }
+    
+    
+    void CircuitBreaker::configure(int failureThreshold, int baseBackoff, int maxBackoff){
+        
+        INSTANTIATE_MLOCK(m_breakerMutex);
+        
+        m_failureThreshold = failureThreshold > 0 ? failureThreshold : 1;
+        m_baseBackoff = baseBackoff > 0 ? baseBackoff : 1;
+        m_maxBackoff = maxBackoff > m_baseBackoff ? maxBackoff : m_baseBackoff;
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    bool CircuitBreaker::allowRequest(){
+        
+        INSTANTIATE_MLOCK(m_breakerMutex);
+        
+        if(m_state == OPEN && std::chrono::steady_clock::now() >= m_retryAt){
+            m_state = HALF_OPEN;
+            m_probeInFlight = false;
+        }
+        
+        bool allowed = false;
+        
+        if(m_state == CLOSED){
+            allowed = true;
+        }
+        else if(m_state == HALF_OPEN && !m_probeInFlight){
+            // This call is the probe, everyone else keeps failing fast until it comes back.
+            m_probeInFlight = true;
+            allowed = true;
+        }
+        
+        mlock.unlock();
+        return allowed;
+        
+    }
+    
+    
+    void CircuitBreaker::recordSuccess(){
+        
+        INSTANTIATE_MLOCK(m_breakerMutex);
+        
+        m_state = CLOSED;
+        m_consecutiveFailures = 0;
+        m_trips = 0;
+        m_probeInFlight = false;
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    void CircuitBreaker::recordFailure(){
+        
+        INSTANTIATE_MLOCK(m_breakerMutex);
+        
+        if(m_state == HALF_OPEN){
+            // The probe failed, back off for longer this time.
+            trip();
+        }
+        else if(m_state == CLOSED){
+            m_consecutiveFailures++;
+            if(m_consecutiveFailures >= m_failureThreshold)
+                trip();
+        }
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    CircuitBreaker::State CircuitBreaker::state(){
+        
+        INSTANTIATE_MLOCK(m_breakerMutex);
+        
+        if(m_state == OPEN && std::chrono::steady_clock::now() >= m_retryAt)
+            m_state = HALF_OPEN;
+        
+        State current = m_state;
+        mlock.unlock();
+        return current;
+        
+    }
+    
+    
+    int CircuitBreaker::retryInMillis(){
+        
+        INSTANTIATE_MLOCK(m_breakerMutex);
+        
+        int wait = 0;
+        
+        if(m_state == OPEN){
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if(m_retryAt > now)
+                wait = std::chrono::duration_cast<std::chrono::milliseconds>(m_retryAt - now).count();
+        }
+        else if(m_state == HALF_OPEN && m_probeInFlight){
+            // Someone else is probing, check back once it should have finished.
+            wait = m_baseBackoff;
+        }
+        
+        mlock.unlock();
+        return wait;
+        
+    }
+    
+    
+    void CircuitBreaker::trip(){
+        
+        // Exponential backoff, capped, with the upper half of it jittered.
+        long long backoff = m_baseBackoff;
+        for(int x = 0; x < m_trips && backoff < m_maxBackoff; x++)
+            backoff *= 2;
+        if(backoff > m_maxBackoff)
+            backoff = m_maxBackoff;
+        
+        std::uniform_int_distribution<long long> jitter(backoff / 2, backoff);
+        
+        m_state = OPEN;
+        m_trips++;
+        m_consecutiveFailures = 0;
+        m_probeInFlight = false;
+        m_retryAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(jitter(m_jitter));
+        
+    }
+    
+}
@@ -0,0 +1,70 @@
+#pragma once
+//
+//  CircuitBreaker.h
+//
+
+#include <chrono>
+#include <random>
+
+#include "BMThreading.h"
+
+namespace bmwrapper {
+    
+    // Tracks whether the API server is reachable so that callers can fail fast while it is down.
+    //
+    // CLOSED:    calls go through, consecutive transport failures are counted.
+    // OPEN:      calls are rejected until the backoff period runs out.
+    // HALF_OPEN: a single probe call is let through, its outcome closes or re-opens the breaker.
+    //
+    // Each time the breaker re-opens the backoff doubles, up to maxBackoff, and is jittered so that
+    // several clients don't all come back at the same moment.
+    class CircuitBreaker {
+        
+    public:
+        
+        enum State {
+            CLOSED,
+            OPEN,
+            HALF_OPEN
+        };
+        
+        // Backoffs are in milliseconds
+        CircuitBreaker(int failureThreshold=3, int baseBackoff=1000, int maxBackoff=60000);
+        
+        void configure(int failureThreshold, int baseBackoff, int maxBackoff);
+        
+        // Returns false if the call should fail without touching the network.
+        bool allowRequest();
+        
+        // Only transport failures count against the server, a fault response or an HTTP error status
+        // means it is up.
+        void recordSuccess();
+        void recordFailure();
+        
+        State state();
+        
+        // Milliseconds until the breaker will let a probe through, 0 if it already would.
+        int retryInMillis();
+        
+    private:
+        
+        OT_MUTEX(m_breakerMutex);
+        
+        State m_state;
+        
+        int m_failureThreshold;
+        int m_baseBackoff;
+        int m_maxBackoff;
+        
+        int m_consecutiveFailures;
+        int m_trips; // Times opened since the last success, drives the backoff
+        bool m_probeInFlight;
+        
+        std::chrono::steady_clock::time_point m_retryAt;
+        std::mt19937 m_jitter;
+        
+        void trip(); // Caller holds m_breakerMutex
+        
+    };
+    
+}
@@ -0,0 +1,500 @@
+//
+//  JsonStreamReader.cpp
+//
+
+#include "JsonStreamReader.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+
+namespace bmwrapper {
+    
+    
+    bool JsonStreamReader::fail(){
+        
+        m_failed = true;
+        m_position = m_end;
+        return false;
+        
+    }
+    
+    
+    void JsonStreamReader::skipWhitespace(){
+        
+        while(m_position < m_end && (*m_position == ' ' || *m_position == '\n' || *m_position == '\r' || *m_position == '\t'))
+            m_position++;
+        
+    }
+    
+    
+    bool JsonStreamReader::consume(char expected){
+        
+        skipWhitespace();
+        if(m_position >= m_end || *m_position != expected)
+            return fail();
+        m_position++;
+        return true;
+        
+    }
+    
+    
+    bool JsonStreamReader::beginObject(){
+        
+        if(m_failed || !consume('{'))
+            return false;
+        m_first = true;
+        return true;
+        
+    }
+    
+    
+    bool JsonStreamReader::beginArray(){
+        
+        if(m_failed || !consume('['))
+            return false;
+        m_first = true;
+        return true;
+        
+    }
+    
+    
+    bool JsonStreamReader::nextItem(char closing){
+        
+        if(m_failed)
+            return false;
+        
+        skipWhitespace();
+        if(m_position >= m_end)
+            return fail();
+        
+        if(*m_position == closing){
+            m_position++;
+            m_first = false;
+            return false;
+        }
+        
+        if(!m_first && !consume(','))
+            return false;
+        
+        m_first = false;
+        return true;
+        
+    }
+    
+    
+    bool JsonStreamReader::nextMember(std::string &key){
+        
+        if(!nextItem('}'))
+            return false;
+        
+        skipWhitespace();
+        if(!parseString(key))
+            return false;
+        
+        return consume(':');
+        
+    }
+    
+    
+    bool JsonStreamReader::nextElement(){
+        
+        return nextItem(']');
+        
+    }
+    
+    
+    static void appendUTF8(std::string &value, unsigned long codepoint){
+        
+        if(codepoint < 0x80){
+            value += (char)codepoint;
+        }
+        else if(codepoint < 0x800){
+            value += (char)(0xC0 | (codepoint >> 6));
+            value += (char)(0x80 | (codepoint & 0x3F));
+        }
+        else if(codepoint < 0x10000){
+            value += (char)(0xE0 | (codepoint >> 12));
+            value += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+            value += (char)(0x80 | (codepoint & 0x3F));
+        }
+        else{
+            value += (char)(0xF0 | (codepoint >> 18));
+            value += (char)(0x80 | ((codepoint >> 12) & 0x3F));
+            value += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+            value += (char)(0x80 | (codepoint & 0x3F));
+        }
+        
+    }
+    
+    
+    static bool readHex4(const char *position, const char *end, unsigned long &value){
+        
+        if(end - position < 4)
+            return false;
+        
+        value = 0;
+        for(int x = 0; x < 4; x++){
+            char c = position[x];
+            value <<= 4;
+            if(c >= '0' && c <= '9')
+                value |= c - '0';
+            else if(c >= 'a' && c <= 'f')
+                value |= c - 'a' + 10;
+            else if(c >= 'A' && c <= 'F')
+                value |= c - 'A' + 10;
+            else
+                return false;
+        }
+        
+        return true;
+        
+    }
+    
+    
+    // Expects to sit on the opening quote. Runs without escapes are copied in one go.
+    bool JsonStreamReader::parseString(std::string &value){
+        
+        if(m_position >= m_end || *m_position != '"')
+            return fail();
+        m_position++;
+        
+        value.clear();
+        
+        while(true){
+            
+            const char *run = m_position;
+            while(m_position < m_end && *m_position != '"' && *m_position != '\\')
+                m_position++;
+            value.append(run, m_position - run);
+            
+            if(m_position >= m_end)
+                return fail();
+            
+            if(*m_position == '"'){
+                m_position++;
+                return true;
+            }
+            
+            // Escape sequence
+            m_position++;
+            if(m_position >= m_end)
+                return fail();
+            
+            switch(*m_position++){
+                case '"': value += '"'; break;
+                case '\\': value += '\\'; break;
+                case '/': value += '/'; break;
+                case 'b': value += '\b'; break;
+                case 'f': value += '\f'; break;
+                case 'n': value += '\n'; break;
+                case 'r': value += '\r'; break;
+                case 't': value += '\t'; break;
+                case 'u': {
+                    unsigned long codepoint;
+                    if(!readHex4(m_position, m_end, codepoint))
+                        return fail();
+                    m_position += 4;
+                    
+                    // A high surrogate should be followed by its low half
+                    if(codepoint >= 0xD800 && codepoint <= 0xDBFF){
+                        unsigned long low;
+                        if(m_end - m_position >= 6 && m_position[0] == '\\' && m_position[1] == 'u' && readHex4(m_position + 2, m_end, low) && low >= 0xDC00 && low <= 0xDFFF){
+                            codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                            m_position += 6;
+                        }
+                    }
+                    
+                    appendUTF8(value, codepoint);
+                    break;
+                }
+                default:
+                    return fail();
+            }
+            
+        }
+        
+    }
+    
+    
+    bool JsonStreamReader::skipString(){
+        
+        if(m_position >= m_end || *m_position != '"')
+            return fail();
+        m_position++;
+        
+        while(m_position < m_end){
+            if(*m_position == '\\'){
+                m_position += 2;
+                continue;
+            }
+            if(*m_position == '"'){
+                m_position++;
+                return true;
+            }
+            m_position++;
+        }
+        
+        return fail();
+        
+    }
+    
+    
+    static bool isDigit(char c){
+        return c >= '0' && c <= '9';
+    }
+    
+    
+    bool JsonStreamReader::scanNumber(std::string *digits, long long *point, bool *negative){
+        
+        const char *position = m_position;
+        bool minus = false;
+        long long integerDigits = 0;
+        long long exponent = 0;
+        
+        if(position < m_end && *position == '-'){
+            minus = true;
+            position++;
+        }
+        
+        // A leading zero is the whole integer part
+        if(position >= m_end || !isDigit(*position))
+            return fail();
+        if(*position == '0')
+            position++;
+        else{
+            while(position < m_end && isDigit(*position)){
+                if(digits != nullptr)
+                    *digits += *position;
+                integerDigits++;
+                position++;
+            }
+        }
+        
+        if(position < m_end && *position == '.'){
+            position++;
+            if(position >= m_end || !isDigit(*position))
+                return fail();
+            while(position < m_end && isDigit(*position)){
+                if(digits != nullptr)
+                    *digits += *position;
+                position++;
+            }
+        }
+        
+        if(position < m_end && (*position == 'e' || *position == 'E')){
+            position++;
+            bool negativeExponent = false;
+            if(position < m_end && (*position == '+' || *position == '-')){
+                negativeExponent = *position == '-';
+                position++;
+            }
+            if(position >= m_end || !isDigit(*position))
+                return fail();
+            while(position < m_end && isDigit(*position)){
+                // Far past anything a long long holds, there is no need to keep counting
+                if(exponent < 100000)
+                    exponent = exponent * 10 + (*position - '0');
+                position++;
+            }
+            if(negativeExponent)
+                exponent = -exponent;
+        }
+        
+        if(point != nullptr)
+            *point = integerDigits + exponent;
+        if(negative != nullptr)
+            *negative = minus;
+        
+        m_position = position;
+        return true;
+        
+    }
+    
+    
+    // The digits before the point, truncated toward zero the way a cast from double would, and clamped
+    // to long long's range.
+    static long long integerPart(std::string const& digits, long long point, bool negative){
+        
+        std::size_t first = digits.find_first_not_of('0');
+        if(first == std::string::npos || point - (long long)first <= 0)
+            return 0;
+        point -= first;
+        
+        unsigned long long limit = negative ? (unsigned long long)LLONG_MAX + 1 : (unsigned long long)LLONG_MAX;
+        long long clamped = negative ? LLONG_MIN : LLONG_MAX;
+        
+        if(point > 19)
+            return clamped;
+        
+        unsigned long long result = 0;
+        for(long long x = 0; x < point; x++){
+            std::size_t index = first + x;
+            unsigned int digit = index < digits.size() ? digits[index] - '0' : 0;
+            if(result > (limit - digit) / 10)
+                return clamped;
+            result = result * 10 + digit;
+        }
+        
+        if(!negative)
+            return (long long)result;
+        return result == limit ? LLONG_MIN : -(long long)result;
+        
+    }
+    
+    
+    bool JsonStreamReader::skipLiteral(const char *literal){
+        
+        std::size_t length = std::strlen(literal);
+        if((std::size_t)(m_end - m_position) < length || std::strncmp(m_position, literal, length) != 0)
+            return fail();
+        m_position += length;
+        return true;
+        
+    }
+    
+    
+    bool JsonStreamReader::readString(std::string &value){
+        
+        if(m_failed)
+            return false;
+        
+        skipWhitespace();
+        if(m_position >= m_end)
+            return fail();
+        
+        if(*m_position == '"')
+            return parseString(value);
+        
+        if(*m_position == 'n')
+            return skipLiteral("null");
+        if(*m_position == 't'){
+            value = "true";
+            return skipLiteral("true");
+        }
+        if(*m_position == 'f'){
+            value = "false";
+            return skipLiteral("false");
+        }
+        
+        // A number, kept as it was written
+        const char *start = m_position;
+        if(!skipValue())
+            return false;
+        value.assign(start, m_position - start);
+        return true;
+        
+    }
+    
+    
+    bool JsonStreamReader::readInt(long long &value){
+        
+        if(m_failed)
+            return false;
+        
+        skipWhitespace();
+        if(m_position >= m_end)
+            return fail();
+        
+        if(*m_position == '"'){
+            std::string text;
+            if(!parseString(text))
+                return false;
+            value = std::atoll(text.c_str());
+            return true;
+        }
+        
+        if(*m_position == 'n')
+            return skipLiteral("null");
+        if(*m_position == 't'){
+            value = 1;
+            return skipLiteral("true");
+        }
+        if(*m_position == 'f'){
+            value = 0;
+            return skipLiteral("false");
+        }
+        
+        // Converted from the digits themselves, so large integers keep every digit
+        std::string digits;
+        long long point;
+        bool negative;
+        if(!scanNumber(&digits, &point, &negative))
+            return false;
+        value = integerPart(digits, point, negative);
+        return true;
+        
+    }
+    
+    
+    bool JsonStreamReader::readBool(bool &value){
+        
+        if(m_failed)
+            return false;
+        
+        skipWhitespace();
+        if(m_position >= m_end)
+            return fail();
+        
+        if(*m_position == 't'){
+            value = true;
+            return skipLiteral("true");
+        }
+        if(*m_position == 'f'){
+            value = false;
+            return skipLiteral("false");
+        }
+        if(*m_position == 'n')
+            return skipLiteral("null");
+        
+        long long number;
+        if(!readInt(number))
+            return false;
+        value = number != 0;
+        return true;
+        
+    }
+    
+    
+    bool JsonStreamReader::skipValue(){
+        
+        if(m_failed)
+            return false;
+        
+        skipWhitespace();
+        if(m_position >= m_end)
+            return fail();
+        
+        switch(*m_position){
+            case '"':
+                return skipString();
+            case 't':
+                return skipLiteral("true");
+            case 'f':
+                return skipLiteral("false");
+            case 'n':
+                return skipLiteral("null");
+            case '{': {
+                std::string key;
+                beginObject();
+                while(nextMember(key)){
+                    if(!skipValue())
+                        return false;
+                }
+                return !m_failed;
+            }
+            case '[': {
+                beginArray();
+                while(nextElement()){
+                    if(!skipValue())
+                        return false;
+                }
+                return !m_failed;
+            }
+            default:
+                return scanNumber(nullptr, nullptr, nullptr);
+        }
+        
+    }
+    
+}
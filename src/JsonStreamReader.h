@@ -0,0 +1,71 @@
+#pragma once
+//
+//  JsonStreamReader.h
+//
+
+#include <string>
+#include <cstddef>
+
+namespace bmwrapper {
+    
+    // A forward-only JSON reader that walks a document in place, without building a DOM.
+    // Callers pull the structure they expect and skip whatever they don't care about:
+    //
+    //   reader.beginObject();
+    //   while(reader.nextMember(key)){
+    //       if(key == "wanted") reader.readString(value);
+    //       else reader.skipValue();
+    //   }
+    //
+    // Any malformed input puts the reader in a failed state, after which every call returns false.
+    class JsonStreamReader {
+        
+    public:
+        
+        // The document must outlive the reader.
+        JsonStreamReader(std::string const& document) : m_position(document.c_str()), m_end(document.c_str() + document.size()), m_failed(false), m_first(false) {}
+        
+        bool beginObject();
+        bool beginArray();
+        
+        // Move to the next member or element, false once the closing bracket has been consumed.
+        bool nextMember(std::string &key);
+        bool nextElement();
+        
+        // Values are converted the way jsoncpp's as*() would, so numbers may arrive as strings and
+        // booleans as numbers. null leaves value untouched. readInt truncates a fraction toward zero and
+        // clamps a number too large for a long long.
+        bool readString(std::string &value);
+        bool readInt(long long &value);
+        bool readBool(bool &value);
+        
+        bool skipValue();
+        
+        bool failed() const {return m_failed;}
+        
+    private:
+        
+        const char *m_position;
+        const char *m_end;
+        bool m_failed;
+        
+        // Set when an object or array has just been opened, so the first member needs no comma.
+        bool m_first;
+        
+        bool fail();
+        void skipWhitespace();
+        bool consume(char expected);
+        bool nextItem(char closing);
+        
+        bool parseString(std::string &value);
+        bool skipString();
+        bool skipLiteral(const char *literal);
+        
+        // Steps over a number in JSON's own grammar. Unlike strtod that takes no locale, and no hex, inf
+        // or nan. If digits is given it gets the significant digits, point is where the decimal point
+        // falls among them once the exponent is applied.
+        bool scanNumber(std::string *digits, long long *point, bool *negative);
+        
+    };
+    
+}
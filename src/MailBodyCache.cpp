@@ -0,0 +1,166 @@
+//
+//  MailBodyCache.cpp
+//
+
+#include "MailBodyCache.h"
+#include "base64.h"
+
+namespace bmwrapper {
+    
+    
+    std::string MailBodyCache::body(std::string const& messageID){
+        
+        INSTANTIATE_MLOCK(m_cacheMutex);
+        
+        std::unordered_map<std::string, Entries::iterator>::iterator it = m_lookup.find(messageID);
+        
+        if(it == m_lookup.end()){
+            
+            if(m_closed){
+                mlock.unlock();
+                return "";
+            }
+            
+            m_fetching++;
+            mlock.unlock();
+            
+            std::string encoded;
+            bool fetched = false;
+            try{
+                fetched = m_fetcher(messageID, encoded);
+            }
+            catch(...){
+                fetched = false;
+            }
+            
+            mlock.lock();
+            
+            m_fetching--;
+            if(m_closed)
+                m_fetchDone.notify_all();
+            
+            if(!fetched){
+                mlock.unlock();
+                return "";
+            }
+            
+            // Someone else may have fetched it while we were
+            it = m_lookup.find(messageID);
+            if(it == m_lookup.end()){
+                store(messageID, encoded);
+                it = m_lookup.find(messageID);
+            }
+        }
+        
+        Entry &entry = *it->second;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        
+        if(!entry.decoded){
+            m_bytes -= entry.data.size();
+            entry.data = base64::decode(entry.data);
+            entry.decoded = true;
+            m_bytes += entry.data.size();
+        }
+        
+        std::string body = entry.data;
+        
+        // A body larger than the whole budget is handed out but not kept
+        evict();
+        
+        mlock.unlock();
+        
+        return body;
+        
+    }
+    
+    
+    void MailBodyCache::insert(std::string const& messageID, std::string encoded){
+        
+        if(encoded.empty())
+            return;
+        
+        INSTANTIATE_MLOCK(m_cacheMutex);
+        
+        std::unordered_map<std::string, Entries::iterator>::iterator it = m_lookup.find(messageID);
+        if(it != m_lookup.end()){
+            m_bytes -= it->second->data.size();
+            m_entries.erase(it->second);
+            m_lookup.erase(it);
+        }
+        
+        store(messageID, encoded);
+        evict();
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    void MailBodyCache::erase(std::string const& messageID){
+        
+        INSTANTIATE_MLOCK(m_cacheMutex);
+        
+        std::unordered_map<std::string, Entries::iterator>::iterator it = m_lookup.find(messageID);
+        if(it != m_lookup.end()){
+            m_bytes -= it->second->data.size();
+            m_entries.erase(it->second);
+            m_lookup.erase(it);
+        }
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    void MailBodyCache::close(){
+        
+        INSTANTIATE_MLOCK(m_cacheMutex);
+        
+        m_closed = true;
+        while(m_fetching > 0)
+            m_fetchDone.wait(mlock);
+        
+        m_fetcher = BodyFetcher();
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    void MailBodyCache::setBudget(std::size_t budget){
+        
+        INSTANTIATE_MLOCK(m_cacheMutex);
+        m_budget = budget;
+        evict();
+        mlock.unlock();
+        
+    }
+    
+    
+    void MailBodyCache::store(std::string const& messageID, std::string &encoded){
+        
+        m_entries.push_front(Entry());
+        
+        Entry &entry = m_entries.front();
+        entry.messageID = messageID;
+        entry.data.swap(encoded);
+        entry.decoded = false;
+        
+        m_bytes += entry.data.size();
+        m_lookup[messageID] = m_entries.begin();
+        
+    }
+    
+    
+    void MailBodyCache::evict(){
+        
+        while(m_bytes > m_budget && !m_entries.empty()){
+            Entry &oldest = m_entries.back();
+            m_bytes -= oldest.data.size();
+            m_lookup.erase(oldest.messageID);
+            m_entries.pop_back();
+        }
+        
+    }
+    
+}
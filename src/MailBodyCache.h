@@ -0,0 +1,71 @@
+#pragma once
+//
+//  MailBodyCache.h
+//
+
+#include <string>
+#include <list>
+#include <unordered_map>
+
+#include "Network.h"
+#include "BMThreading.h"
+
+namespace bmwrapper {
+    
+    // The message bodies of one mailbox, least recently read first out once they go over budget.
+    // Bodies are stored as the API delivered them and decoded the first time they are read.
+    // A body that isn't here is fetched again from the API server, without holding the cache locked.
+    class MailBodyCache : public NetworkMailBodySource {
+        
+    public:
+        
+        // Sets encoded to the body of a message from the API server, false if it couldn't. An empty body
+        // that did come through is kept like any other, so it isn't asked for again.
+        typedef OT_STD_FUNCTION(bool(std::string const&, std::string&)) BodyFetcher;
+        
+        // budget is in bytes of body text
+        MailBodyCache(BodyFetcher fetcher, std::size_t budget) : m_fetcher(fetcher), m_closed(false), m_fetching(0), m_bytes(0), m_budget(budget) {}
+        
+        std::string body(std::string const& messageID);
+        
+        // Adds a body that came with a refresh, as the most recently read. Empty bodies are ignored, as
+        // records loaded from the cache carry none, the first read fetches them instead.
+        void insert(std::string const& messageID, std::string encoded);
+        void erase(std::string const& messageID);
+        
+        void setBudget(std::size_t budget);
+        
+        // Stops fetching, waiting for any fetch under way, so the fetcher's owner can go away while mail
+        // still holds the cache. Bodies already here are still read, misses come back empty.
+        void close();
+        
+    private:
+        
+        struct Entry {
+            std::string messageID;
+            std::string data;
+            bool decoded;
+        };
+        
+        typedef std::list<Entry> Entries;
+        
+        OT_MUTEX(m_cacheMutex);
+        
+        BodyFetcher m_fetcher;
+        bool m_closed;
+        int m_fetching; // Calls to m_fetcher under way, close waits for them
+        CONDITION_VARIABLE(m_fetchDone);
+        
+        Entries m_entries; // Most recently read at the front
+        std::unordered_map<std::string, Entries::iterator> m_lookup;
+        
+        std::size_t m_bytes;
+        std::size_t m_budget;
+        
+        // Caller holds m_cacheMutex
+        void store(std::string const& messageID, std::string &encoded);
+        void evict();
+        
+    };
+    
+}
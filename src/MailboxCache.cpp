@@ -0,0 +1,312 @@
+//
+//  MailboxCache.cpp
+//
+
+#include "MailboxCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace bmwrapper {
+    
+    static const char cacheMagic[8] = {'B', 'M', 'W', 'C', 'A', 'C', 'H', 'E'};
+    static const unsigned int cacheVersion = 1;
+    
+    
+    // Bounds checked reads over the mapped file. Once a read runs off the end every later read fails too.
+    class CacheReader {
+        
+    public:
+        
+        CacheReader(const char *data, std::size_t size) : m_data(data), m_size(size), m_position(0), m_failed(false) {}
+        
+        bool failed(){return m_failed;}
+        
+        bool readBytes(void *value, std::size_t length){
+            if(m_failed || m_size - m_position < length){
+                m_failed = true;
+                return false;
+            }
+            std::memcpy(value, m_data + m_position, length);
+            m_position += length;
+            return true;
+        }
+        
+        template<typename Integer>
+        Integer readInt(){
+            Integer value = 0;
+            readBytes(&value, sizeof(value));
+            return value;
+        }
+        
+        bool readBool(){return readInt<unsigned char>() != 0;}
+        
+        std::string readString(){
+            unsigned int length = readInt<unsigned int>();
+            if(m_failed || m_size - m_position < length){
+                m_failed = true;
+                return "";
+            }
+            std::string value(m_data + m_position, length);
+            m_position += length;
+            return value;
+        }
+        
+        base64 readBase64(){return base64(readString(), true);}
+        
+        // Every record is at least a byte, so a count larger than what is left is damage
+        unsigned int readCount(){
+            unsigned int count = readInt<unsigned int>();
+            if(count > m_size - m_position)
+                m_failed = true;
+            return m_failed ? 0 : count;
+        }
+        
+    private:
+        
+        const char *m_data;
+        std::size_t m_size;
+        std::size_t m_position;
+        bool m_failed;
+        
+    };
+    
+    
+    class CacheWriter {
+        
+    public:
+        
+        CacheWriter(std::ostream &stream) : m_stream(stream) {}
+        
+        template<typename Integer>
+        void writeInt(Integer value){
+            m_stream.write((const char *)&value, sizeof(value));
+        }
+        
+        void writeBool(bool value){writeInt<unsigned char>(value ? 1 : 0);}
+        
+        void writeString(std::string const& value){
+            writeInt<unsigned int>((unsigned int)value.size());
+            m_stream.write(value.data(), value.size());
+        }
+        
+        void writeBase64(base64 const& value){writeString(value.encodedRef());}
+        
+    private:
+        
+        std::ostream &m_stream;
+        
+    };
+    
+    
+    bool MailboxCache::load(BitMessageIdentities &identities, BitMessageAddressBook &addressBook, BitMessageSubscriptionList &subscriptions, BitMessageInbox &inbox, BitMessageOutbox &outbox){
+        
+        int fd = open(m_path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        
+        struct stat info;
+        if(fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(cacheMagic)){
+            close(fd);
+            return false;
+        }
+        
+        std::size_t size = (std::size_t)info.st_size;
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        
+        if(mapping == MAP_FAILED)
+            return false;
+        
+        // Read front to back once
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        
+        CacheReader reader((const char *)mapping, size);
+        
+        char magic[sizeof(cacheMagic)];
+        reader.readBytes(magic, sizeof(magic));
+        
+        if(std::memcmp(magic, cacheMagic, sizeof(magic)) != 0 || reader.readInt<unsigned int>() != cacheVersion || reader.readString() != m_source){
+            munmap(mapping, size);
+            return false;
+        }
+        
+        unsigned int count = reader.readCount();
+        for(unsigned int x = 0; x < count && !reader.failed(); x++){
+            BitMessageIdentity identity;
+            identity.m_label = reader.readBase64();
+            identity.m_address = reader.readString();
+            identity.m_stream = reader.readInt<int>();
+            identity.m_enabled = reader.readBool();
+            identity.m_chan = reader.readBool();
+            identities.push_back(identity);
+        }
+        
+        count = reader.readCount();
+        for(unsigned int x = 0; x < count && !reader.failed(); x++){
+            BitMessageAddressBookEntry entry;
+            entry.m_address = reader.readString();
+            entry.m_label = reader.readBase64();
+            addressBook.push_back(entry);
+        }
+        
+        count = reader.readCount();
+        for(unsigned int x = 0; x < count && !reader.failed(); x++){
+            BitMessageSubscription subscription;
+            subscription.m_address = reader.readString();
+            subscription.m_enabled = reader.readBool();
+            subscription.m_label = reader.readBase64();
+            subscriptions.push_back(subscription);
+        }
+        
+        count = reader.readCount();
+        inbox.reserve(count);
+        for(unsigned int x = 0; x < count && !reader.failed(); x++){
+            BitInboxMessage message;
+            message.m_msgID = reader.readString();
+            message.m_toAddress = reader.readString();
+            message.m_fromAddress = reader.readString();
+            message.m_subject = reader.readBase64();
+            message.m_message = reader.readBase64();
+            message.m_encodingType = reader.readInt<int>();
+            message.m_receivedTime = (std::time_t)reader.readInt<long long>();
+            message.m_read = reader.readBool();
+            inbox.push_back(message);
+        }
+        
+        count = reader.readCount();
+        outbox.reserve(count);
+        for(unsigned int x = 0; x < count && !reader.failed(); x++){
+            BitSentMessage message;
+            message.m_msgID = reader.readString();
+            message.m_toAddress = reader.readString();
+            message.m_fromAddress = reader.readString();
+            message.m_subject = reader.readBase64();
+            message.m_message = reader.readBase64();
+            message.m_encodingType = reader.readInt<int>();
+            message.m_lastActionTime = (std::time_t)reader.readInt<long long>();
+            message.m_status = reader.readString();
+            message.m_ackData = reader.readString();
+            outbox.push_back(message);
+        }
+        
+        munmap(mapping, size);
+        
+        if(reader.failed()){
+            std::cerr << "Error: BitMessage cache " << m_path << " is damaged, ignoring it" << std::endl;
+            identities.clear();
+            addressBook.clear();
+            subscriptions.clear();
+            inbox.clear();
+            outbox.clear();
+            return false;
+        }
+        
+        return true;
+        
+    }
+    
+    
+    bool MailboxCache::save(BitMessageIdentities const& identities, BitMessageAddressBook const& addressBook, BitMessageSubscriptionList const& subscriptions, MailboxSnapshot<BitInboxMessage> const& inbox, MailboxSnapshot<BitSentMessage> const& outbox){
+        
+        // Written beside the cache and renamed over it, so a crash never leaves half a file behind
+        std::string temporaryPath = m_path + ".tmp";
+        
+        std::ofstream stream(temporaryPath.c_str(), std::ios::binary | std::ios::trunc);
+        if(!stream){
+            std::cerr << "Error: Could not write BitMessage cache " << temporaryPath << std::endl;
+            return false;
+        }
+        
+        CacheWriter writer(stream);
+        
+        stream.write(cacheMagic, sizeof(cacheMagic));
+        writer.writeInt<unsigned int>(cacheVersion);
+        writer.writeString(m_source);
+        
+        writer.writeInt<unsigned int>((unsigned int)identities.size());
+        for(std::size_t x = 0; x < identities.size(); x++){
+            BitMessageIdentity const& identity = identities[x];
+            writer.writeBase64(identity.m_label);
+            writer.writeString(identity.m_address);
+            writer.writeInt<int>(identity.m_stream);
+            writer.writeBool(identity.m_enabled);
+            writer.writeBool(identity.m_chan);
+        }
+        
+        writer.writeInt<unsigned int>((unsigned int)addressBook.size());
+        for(std::size_t x = 0; x < addressBook.size(); x++){
+            BitMessageAddressBookEntry const& entry = addressBook[x];
+            writer.writeString(entry.m_address);
+            writer.writeBase64(entry.m_label);
+        }
+        
+        writer.writeInt<unsigned int>((unsigned int)subscriptions.size());
+        for(std::size_t x = 0; x < subscriptions.size(); x++){
+            BitMessageSubscription const& subscription = subscriptions[x];
+            writer.writeString(subscription.m_address);
+            writer.writeBool(subscription.m_enabled);
+            writer.writeBase64(subscription.m_label);
+        }
+        
+        // The records are kept as the API listed them, the mail is what is left of them locally
+        BitInboxRecords const& inboxRecords = *inbox.records;
+        
+        writer.writeInt<unsigned int>((unsigned int)inbox.mail.size());
+        for(std::size_t x = 0; x < inboxRecords.size(); x++){
+            BitInboxMessage const& message = *inboxRecords[x];
+            
+            _SharedPtr<NetworkMail> mail = inbox.index.find(message.m_msgID);
+            if(!mail)
+                continue;
+            
+            writer.writeString(message.m_msgID);
+            writer.writeString(message.m_toAddress);
+            writer.writeString(message.m_fromAddress);
+            writer.writeBase64(message.m_subject);
+            writer.writeBase64(message.m_message);
+            writer.writeInt<int>(message.m_encodingType);
+            writer.writeInt<long long>((long long)message.m_receivedTime);
+            writer.writeBool(mail->getRead());
+        }
+        
+        BitSentRecords const& outboxRecords = *outbox.records;
+        
+        writer.writeInt<unsigned int>((unsigned int)outbox.mail.size());
+        for(std::size_t x = 0; x < outboxRecords.size(); x++){
+            BitSentMessage const& message = *outboxRecords[x];
+            
+            if(!outbox.index.find(message.m_msgID))
+                continue;
+            
+            writer.writeString(message.m_msgID);
+            writer.writeString(message.m_toAddress);
+            writer.writeString(message.m_fromAddress);
+            writer.writeBase64(message.m_subject);
+            writer.writeBase64(message.m_message);
+            writer.writeInt<int>(message.m_encodingType);
+            writer.writeInt<long long>((long long)message.m_lastActionTime);
+            writer.writeString(message.m_status);
+            writer.writeString(message.m_ackData);
+        }
+        
+        stream.close();
+        
+        if(!stream || std::rename(temporaryPath.c_str(), m_path.c_str()) != 0){
+            std::cerr << "Error: Could not write BitMessage cache " << m_path << std::endl;
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+        
+        return true;
+        
+    }
+    
+}
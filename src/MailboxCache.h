@@ -0,0 +1,43 @@
+#pragma once
+//
+//  MailboxCache.h
+//
+
+#include <string>
+#include <vector>
+#include <ctime>
+
+#include "BitMessage.h"
+
+namespace bmwrapper {
+    
+    // A compact file holding everything initializeUserData pulls down, so that a restart can answer
+    // queries from the last session's data while the API server is asked what changed.
+    //
+    // Binary, in the host's byte order: a header naming the API server the data came from, then the
+    // identities, address book, subscriptions, inbox and outbox as counted lists of records. Strings are
+    // a 32 bit length followed by the bytes, base64 fields are kept encoded. Loading maps the file
+    // rather than reading it, saving writes a new file and renames it over the old one.
+    class MailboxCache {
+        
+    public:
+        
+        // source identifies the API server, a cache written for another server is ignored.
+        MailboxCache(std::string path, std::string source) : m_path(path), m_source(source) {}
+        
+        // False if there is no cache, it belongs to another server or it is damaged, in which case
+        // the lists are left empty.
+        bool load(BitMessageIdentities &identities, BitMessageAddressBook &addressBook, BitMessageSubscriptionList &subscriptions, BitMessageInbox &inbox, BitMessageOutbox &outbox);
+        
+        // Saves the mailboxes' records, leaving out messages deleted locally and taking the read flag from
+        // the mail, which is where markRead changes it.
+        bool save(BitMessageIdentities const& identities, BitMessageAddressBook const& addressBook, BitMessageSubscriptionList const& subscriptions, MailboxSnapshot<BitInboxMessage> const& inbox, MailboxSnapshot<BitSentMessage> const& outbox);
+        
+    private:
+        
+        std::string m_path;
+        std::string m_source;
+        
+    };
+    
+}
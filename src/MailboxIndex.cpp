@@ -0,0 +1,145 @@
+//
+//  MailboxIndex.cpp
+//
+
+#include "MailboxIndex.h"
+
+#include <algorithm>
+
+namespace bmwrapper {
+    
+    
+    void MailboxIndex::rebuild(Mailbox const& mailbox){
+        
+        // New tables and counts, copies of the old index keep theirs
+        _SharedPtr<IDMap> byID(new IDMap());
+        std::unordered_map<std::string, Mailbox> addressMail;
+        _SharedPtr<UnreadCounts> unread(new UnreadCounts());
+        
+        byID->reserve(mailbox.size());
+        
+        for(std::size_t x = 0; x < mailbox.size(); x++){
+            std::string const& address = addressOf(mailbox[x]);
+            
+            (*byID)[mailbox[x]->getMessageIDRef()] = mailbox[x];
+            addressMail[address].push_back(mailbox[x]);
+            
+            UnreadCount &count = unread->byAddress[address];
+            if(mailbox[x]->getRead() == false){
+                count.count++;
+                unread->total.count++;
+            }
+        }
+        
+        _SharedPtr<AddressMap> byAddress(new AddressMap());
+        byAddress->reserve(addressMail.size());
+        
+        for(std::unordered_map<std::string, Mailbox>::iterator it = addressMail.begin(); it != addressMail.end(); ++it)
+            (*byAddress)[it->first] = _SharedPtr<const Mailbox>(new Mailbox(std::move(it->second)));
+        
+        m_byID = byID;
+        m_erased.reset(new IDSet());
+        m_byAddress = byAddress;
+        m_unread = unread;
+        
+    }
+    
+    
+    void MailboxIndex::erase(_SharedPtr<NetworkMail> const& mail){
+        
+        std::string const& messageID = mail->getMessageIDRef();
+        
+        if(!find(messageID))
+            return;
+        
+        // The ID table stays shared, the few IDs erased since the rebuild are copied instead
+        _SharedPtr<IDSet> erased(new IDSet(*m_erased));
+        erased->insert(messageID);
+        m_erased = erased;
+        
+        if(mail->getRead() == false)
+            countUnread(addressOf(mail), -1);
+        
+        std::string const& address = addressOf(mail);
+        
+        AddressMap::const_iterator it = m_byAddress->find(address);
+        if(it == m_byAddress->end())
+            return;
+        
+        // Only the one address's list is copied, the others are shared with the old table
+        _SharedPtr<Mailbox> addressMail(new Mailbox(*it->second));
+        addressMail->erase(std::remove(addressMail->begin(), addressMail->end(), mail), addressMail->end());
+        
+        _SharedPtr<AddressMap> byAddress(new AddressMap(*m_byAddress));
+        if(addressMail->empty())
+            byAddress->erase(address);
+        else
+            (*byAddress)[address] = addressMail;
+        
+        m_byAddress = byAddress;
+        
+    }
+    
+    
+    void MailboxIndex::setRead(_SharedPtr<NetworkMail> const& mail, bool read) const {
+        
+        // Exchanged so that two calls racing on the same mail only count it once
+        if(mail->exchangeRead(read) == read)
+            return;
+        
+        countUnread(addressOf(mail), read ? -1 : 1);
+        
+    }
+    
+    
+    int MailboxIndex::unread(std::string const& address) const {
+        
+        std::unordered_map<std::string, UnreadCount>::const_iterator it = m_unread->byAddress.find(address);
+        if(it == m_unread->byAddress.end())
+            return 0;
+        
+        return it->second.count;
+        
+    }
+    
+    
+    _SharedPtr<NetworkMail> MailboxIndex::find(std::string const& messageID) const {
+        
+        IDMap::const_iterator it = m_byID->find(messageID);
+        if(it == m_byID->end() || m_erased->find(messageID) != m_erased->end())
+            return _SharedPtr<NetworkMail>();
+        
+        return it->second;
+        
+    }
+    
+    
+    MailboxIndex::Mailbox const& MailboxIndex::forAddress(std::string const& address) const {
+        
+        AddressMap::const_iterator it = m_byAddress->find(address);
+        if(it == m_byAddress->end())
+            return m_noMail;
+        
+        return *it->second;
+        
+    }
+    
+    
+    std::string const& MailboxIndex::addressOf(_SharedPtr<NetworkMail> const& mail) const {
+        
+        return m_addressField == RECIPIENT ? mail->getToRef() : mail->getFromRef();
+        
+    }
+    
+    
+    void MailboxIndex::countUnread(std::string const& address, int change) const {
+        
+        std::unordered_map<std::string, UnreadCount>::iterator it = m_unread->byAddress.find(address);
+        if(it != m_unread->byAddress.end())
+            it->second.count += change;
+        
+        m_unread->total.count += change;
+        
+    }
+    
+}
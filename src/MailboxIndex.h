@@ -0,0 +1,107 @@
+#pragma once
+//
+//  MailboxIndex.h
+//
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Network.h"
+#include "TR1_Wrapper.hpp"
+#include "BMThreading.h"
+
+namespace bmwrapper {
+    
+    // Hash lookups into a local mailbox, by message ID and by address, so that finding a message or
+    // an address's mail doesn't mean walking the whole mailbox. Rebuilt whenever the mailbox is
+    // replaced, and kept up to date by hand for single removals.
+    //
+    // Copying an index is cheap, the copy shares the tables with the original. A removal from the copy
+    // only records the ID as erased and copies the one address's list, rather than the whole index.
+    class MailboxIndex {
+        
+    public:
+        
+        typedef std::vector<_SharedPtr<NetworkMail> > Mailbox;
+        
+        // Which address a mailbox is looked up by, the recipient for an inbox and the sender for an outbox.
+        enum AddressField {
+            RECIPIENT,
+            SENDER
+        };
+        
+        MailboxIndex(AddressField addressField) : m_addressField(addressField), m_byID(new IDMap()), m_erased(new IDSet()), m_byAddress(new AddressMap()), m_unread(new UnreadCounts()) {}
+        
+        void rebuild(Mailbox const& mailbox);
+        void erase(_SharedPtr<NetworkMail> const& mail);
+        
+        // Sets the message's read flag, use this rather than NetworkMail::setRead to keep the counts right.
+        // The flag and counts are atomic, so this is safe while readers hold the index.
+        void setRead(_SharedPtr<NetworkMail> const& mail, bool read) const;
+        
+        // Messages not read yet, in the whole mailbox and for one address. Atomic reads, safe alongside setRead.
+        // Copies of the index share their counts with the one they were copied from until it is rebuilt,
+        // so these follow the latest mailbox rather than the one a reader holds.
+        int unread() const {return m_unread->total.count;}
+        int unread(std::string const& address) const;
+        
+        // An empty pointer if the message isn't in the mailbox
+        _SharedPtr<NetworkMail> find(std::string const& messageID) const;
+        
+        // The address's mail, in mailbox order
+        Mailbox const& forAddress(std::string const& address) const;
+        
+    private:
+        
+        AddressField m_addressField;
+        
+        struct UnreadCount {
+            UnreadCount() : count(0) {}
+            OT_ATOMIC_INT(count);
+        };
+        
+        // Every address in the mailbox has a count, so the map itself never changes after a rebuild
+        struct UnreadCounts {
+            UnreadCount total;
+            std::unordered_map<std::string, UnreadCount> byAddress;
+        };
+        
+        typedef std::unordered_map<std::string, _SharedPtr<NetworkMail> > IDMap;
+        typedef std::unordered_map<std::string, _SharedPtr<const Mailbox> > AddressMap;
+        typedef std::unordered_set<std::string> IDSet;
+        
+        // Shared between copies and never changed once built, a change replaces the pointer
+        _SharedPtr<const IDMap> m_byID;
+        _SharedPtr<const IDSet> m_erased; // Removed since the last rebuild, still in m_byID
+        _SharedPtr<const AddressMap> m_byAddress;
+        
+        _SharedPtr<UnreadCounts> m_unread;
+        
+        Mailbox m_noMail;
+        
+        std::string const& addressOf(_SharedPtr<NetworkMail> const& mail) const;
+        void countUnread(std::string const& address, int change) const;
+        
+    };
+    
+    
+    
+    // Everything known about one mailbox, published together through a Snapshot so that readers always
+    // see the mail, its index and the API's records from the same refresh. A local removal publishes a
+    // copy, which shares the records and index tables and only copies the mail's pointers.
+    template<typename Record>
+    struct MailboxSnapshot {
+        
+        MailboxSnapshot(MailboxIndex::AddressField addressField) : index(addressField), records(new Records()) {}
+        
+        typedef std::vector<_SharedPtr<const Record> > Records;
+        
+        MailboxIndex::Mailbox mail; // Newest first, each a view over one of the records
+        MailboxIndex index;
+        _SharedPtr<const Records> records; // As the API listed them, oldest first. Local removals leave them be
+        
+    };
+    
+}
@@ -3,6 +3,7 @@
 //  MsgQueue.h
 
 #include <queue>
+#include <vector>
 
 #include "BMThreading.h"
 
@@ -54,6 +55,32 @@ namespace bmwrapper {
         }
 #endif
         
+        // Pops items off the front of the queue for as long as they satisfy pred,
+        // up to max items. Does not wait for new items to arrive.
+        template <typename Pred>
+        std::vector<T> popWhile(Pred pred, unsigned int max)
+        {
+            std::vector<T> items;
+            INSTANTIATE_MLOCK(mutex_);
+            while (!queue_.empty() && items.size() < max && pred(queue_.front()))
+            {
+                items.push_back(queue_.front());
+                queue_.pop();
+            }
+            mlock.unlock();
+            return items;
+        }
+        
+        // Waits up to the given number of milliseconds for the queue to hold something.
+        // Returns true if it does.
+        bool waitForItem(unsigned int milliseconds)
+        {
+            INSTANTIATE_MLOCK(mutex_);
+            bool ready = cond_.wait_for(mlock, std::chrono::milliseconds(milliseconds), [this]{ return !queue_.empty(); });
+            mlock.unlock();
+            return ready;
+        }
+        
         int size()
         {
             INSTANTIATE_MLOCK(mutex_);
@@ -13,6 +13,7 @@
 #include <iostream>
 
 #include "TR1_Wrapper.hpp"
+#include "BMThreading.h"
 
 
 
@@ -68,21 +69,134 @@ template <typename T> int NetCounter<T>::loaded( 0 );
 template <typename T> int NetCounter<T>::alive( 0 );
 
 
+// Turns a subject or body from the form the network delivered it in into plain text.
+typedef std::string (*NetworkMailDecoder)(std::string const& encoded);
+
+
+// Hands out message bodies that a NetworkMail doesn't keep itself, so that a module can hold on to
+// as few of them as it likes and fetch the rest again when they are read.
+class NetworkMailBodySource {
+    
+public:
+    
+    virtual ~NetworkMailBodySource(){}
+    
+    // The decoded body, empty if it can't be had.
+    virtual std::string body(std::string const& messageID) = 0;
+    
+};
+
+
+// The headers of a message as a module stores them, so that a NetworkMail can be a view over the
+// module's own record of the message rather than a copy of it. Records are not changed once shared.
+class NetworkMailHeaders {
+    
+public:
+    
+    virtual ~NetworkMailHeaders(){}
+    
+    virtual const std::string& fromRef() const = 0;
+    virtual const std::string& toRef() const = 0;
+    virtual const std::string& encodedSubjectRef() const = 0; // As the network delivered it
+    virtual const std::string& messageIDRef() const = 0;
+    virtual std::time_t receivedTime() const = 0;
+    virtual std::time_t sentTime() const = 0;
+    
+};
+
+
+// The subject and body of a message still in their encoded form, decoded the first time they are read.
+// Copies of a NetworkMail share one payload, so each field is only ever decoded once.
+// With a body source the body isn't held here at all, it is asked for on every read.
+// With headers the encoded subject is read from them, and only the decoded one is kept here.
+class NetworkMailPayload {
+    
+public:
+    
+    NetworkMailPayload(NetworkMailDecoder decoder, std::string subject, std::string message) : m_decoder(decoder), m_subject(subject), m_mail(message), m_subjectDecoded(false), m_mailDecoded(false) {}
+    NetworkMailPayload(NetworkMailDecoder decoder, std::string subject, _WeakPtr<NetworkMailBodySource> bodies) : m_decoder(decoder), m_subject(subject), m_bodies(bodies), m_subjectDecoded(false), m_mailDecoded(true) {}
+    NetworkMailPayload(NetworkMailDecoder decoder, _SharedPtr<const NetworkMailHeaders> headers, _WeakPtr<NetworkMailBodySource> bodies) : m_decoder(decoder), m_headers(headers), m_bodies(bodies), m_subjectDecoded(false), m_mailDecoded(true) {}
+    
+    const std::string& subject(){
+        INSTANTIATE_MLOCK(m_mutex);
+        if(!m_subjectDecoded){
+            m_subject = m_decoder(m_headers ? m_headers->encodedSubjectRef() : m_subject);
+            m_subjectDecoded = true;
+        }
+        return m_subject;
+    }
+    
+    std::string message(std::string const& messageID){
+        _SharedPtr<NetworkMailBodySource> bodies = m_bodies.lock();
+        if(bodies)
+            return bodies->body(messageID);
+        
+        INSTANTIATE_MLOCK(m_mutex);
+        if(!m_mailDecoded){
+            m_mail = m_decoder(m_mail);
+            m_mailDecoded = true;
+        }
+        return m_mail;
+    }
+    
+private:
+    
+    OT_MUTEX(m_mutex);
+    
+    NetworkMailDecoder m_decoder;
+    
+    std::string m_subject;
+    std::string m_mail;
+    
+    _SharedPtr<const NetworkMailHeaders> m_headers;
+    _WeakPtr<NetworkMailBodySource> m_bodies; // Doesn't keep the module's bodies alive past the module
+    
+    bool m_subjectDecoded;
+    bool m_mailDecoded;
+    
+};
+
+
 class NetworkMail {
     
 public:
     
     NetworkMail(std::string from="", std::string to="", std::string subject="", std::string message="", bool isRead=false, std::string messageID="", std::time_t received=0, std::time_t sent=0) : m_from(from), m_to(to), m_subject(subject), m_mail(message), m_readStatus(isRead), m_messageID(messageID), m_received(received), m_sent(sent) {}
     
-    std::string getFrom(){return m_from;}
-    std::string getTo(){return m_to;}
-    std::string getSubject(){return m_subject;}
-    std::string getMessage(){return m_mail;}
-    std::time_t getReceivedTime(){return m_received;}
-    std::time_t getSentTime(){return m_sent;}
+    // Keeps the subject and message encoded until they are first asked for, so building a large mailbox
+    // only costs as much as its headers.
+    NetworkMail(NetworkMailDecoder decoder, std::string from, std::string to, std::string encodedSubject, std::string encodedMessage, bool isRead=false, std::string messageID="", std::time_t received=0, std::time_t sent=0) : m_from(from), m_to(to), m_payload(new NetworkMailPayload(decoder, encodedSubject, encodedMessage)), m_readStatus(isRead), m_messageID(messageID), m_received(received), m_sent(sent) {}
+    
+    // Only the headers are held, the message is read from bodies by its ID each time it is asked for.
+    NetworkMail(NetworkMailDecoder decoder, _WeakPtr<NetworkMailBodySource> bodies, std::string from, std::string to, std::string encodedSubject, bool isRead=false, std::string messageID="", std::time_t received=0, std::time_t sent=0) : m_from(from), m_to(to), m_payload(new NetworkMailPayload(decoder, encodedSubject, bodies)), m_readStatus(isRead), m_messageID(messageID), m_received(received), m_sent(sent) {}
+    
+    // A view over a module's record of the message, which the mail keeps alive. Only the read flag is its own.
+    NetworkMail(NetworkMailDecoder decoder, _SharedPtr<const NetworkMailHeaders> headers, _WeakPtr<NetworkMailBodySource> bodies, bool isRead=false) : m_payload(new NetworkMailPayload(decoder, headers, bodies)), m_headers(headers), m_readStatus(isRead), m_received(0), m_sent(0) {}
+    
+    // A copy shares the payload and record, but has a read flag of its own.
+    NetworkMail(NetworkMail const& other) : m_from(other.m_from), m_to(other.m_to), m_subject(other.m_subject), m_mail(other.m_mail), m_payload(other.m_payload), m_headers(other.m_headers), m_readStatus(other.m_readStatus.load()), m_messageID(other.m_messageID), m_received(other.m_received), m_sent(other.m_sent) {}
+    NetworkMail& operator=(NetworkMail const& other);
+    
+    std::string getFrom(){return getFromRef();}
+    std::string getTo(){return getToRef();}
+    std::string getSubject(){return m_payload ? m_payload->subject() : m_subject;}
+    std::string getMessage(){return m_payload ? m_payload->message(getMessageIDRef()) : m_mail;}
+    std::time_t getReceivedTime(){return m_headers ? m_headers->receivedTime() : m_received;}
+    std::time_t getSentTime(){return m_headers ? m_headers->sentTime() : m_sent;}
     void        setRead(bool status){m_readStatus = status;}
-    bool        getRead(){ return m_readStatus;}
-    std::string getMessageID(){return m_messageID;}
+    bool        getRead() const { return m_readStatus;}
+    bool        exchangeRead(bool status){return m_readStatus.exchange(status);} // Returns the old flag
+    std::string getMessageID(){return getMessageIDRef();}
+    
+    // The same fields by reference, for scans that only compare them. Valid for as long as the mail is.
+    // There is no getMessageRef, as the body may not be held by the mail at all.
+    const std::string& getFromRef() const {return m_headers ? m_headers->fromRef() : m_from;}
+    const std::string& getToRef() const {return m_headers ? m_headers->toRef() : m_to;}
+    const std::string& getSubjectRef(){return m_payload ? m_payload->subject() : m_subject;}
+    const std::string& getMessageIDRef() const {return m_headers ? m_headers->messageIDRef() : m_messageID;}
+    
+    // The module's record this mail is a view over, if it is one.
+    _SharedPtr<const NetworkMailHeaders> getHeaders() const {return m_headers;}
     
 private:
     
@@ -91,7 +205,10 @@ private:
     std::string m_subject;
     std::string m_mail;
     
-    bool m_readStatus;
+    _SharedPtr<NetworkMailPayload> m_payload; // Set when the subject and message are decoded lazily
+    _SharedPtr<const NetworkMailHeaders> m_headers; // Set when the fields above are left empty for the record's
+    
+    OT_ATOMIC(m_readStatus); // Set while readers may be looking at the mail, see MailboxIndex::setRead
     
     std::string m_messageID;
     
@@ -101,6 +218,24 @@ private:
 };
 
 
+inline NetworkMail& NetworkMail::operator=(NetworkMail const& other){
+    
+    m_from = other.m_from;
+    m_to = other.m_to;
+    m_subject = other.m_subject;
+    m_mail = other.m_mail;
+    m_payload = other.m_payload;
+    m_headers = other.m_headers;
+    m_readStatus = other.m_readStatus.load();
+    m_messageID = other.m_messageID;
+    m_received = other.m_received;
+    m_sent = other.m_sent;
+    
+    return *this;
+    
+}
+
+
 class NetworkModule : public NetCounter<NetworkModule> {
     
 public:
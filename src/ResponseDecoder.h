@@ -0,0 +1,194 @@
+#pragma once
+//
+//  ResponseDecoder.h
+//
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#include "JsonStreamReader.h"
+#include "base64.h"
+
+namespace bmwrapper {
+    
+    // One JSON member of a Record, and the function that reads its value into place.
+    template<typename Record>
+    struct ResponseField {
+        const char *key;
+        bool (*read)(JsonStreamReader &reader, Record &record);
+    };
+    
+    // Specialised for every type that is decoded from an API response, with a table of its fields
+    // ending in a null key:
+    //
+    //   template<> struct ResponseFields<Foo> { static const ResponseField<Foo> fields[]; };
+    //
+    //   const ResponseField<Foo> ResponseFields<Foo>::fields[] = {
+    //       {"name", &readField<Foo, std::string, &Foo::m_name>},
+    //       {nullptr, nullptr}
+    //   };
+    //
+    // Records need a default constructor, which gives the value of any member missing from the response.
+    template<typename Record>
+    struct ResponseFields;
+    
+    
+    // Value conversions, following jsoncpp's as*() so that numbers may arrive as strings and so on.
+    
+    inline bool readValue(JsonStreamReader &reader, std::string &value){
+        return reader.readString(value);
+    }
+    
+    inline bool readValue(JsonStreamReader &reader, bool &value){
+        return reader.readBool(value);
+    }
+    
+    // Kept encoded, line breaks and all, base64::decoded() copes with them.
+    inline bool readValue(JsonStreamReader &reader, base64 &value){
+        std::string encoded;
+        if(!reader.readString(encoded))
+            return false;
+        value = base64(std::move(encoded), true);
+        return true;
+    }
+    
+    template<typename Integer>
+    inline bool readValue(JsonStreamReader &reader, Integer &value){
+        long long number = value;
+        if(!reader.readInt(number))
+            return false;
+        value = (Integer)number;
+        return true;
+    }
+    
+    template<typename Record, typename Type, Type Record::*Member>
+    bool readField(JsonStreamReader &reader, Record &record){
+        return readValue(reader, record.*Member);
+    }
+    
+    // For strings that may arrive line wrapped, but are kept without the line breaks.
+    template<typename Record, std::string Record::*Member>
+    bool readUnwrappedField(JsonStreamReader &reader, Record &record){
+        std::string &value = record.*Member;
+        if(!reader.readString(value))
+            return false;
+        value.erase(std::remove(value.begin(), value.end(), '\n'), value.end());
+        return true;
+    }
+    
+    
+    // Reads one object into record, skipping any member it has no field for.
+    // key is scratch space, passed in so that it is only allocated once per document.
+    template<typename Record>
+    bool decodeObject(JsonStreamReader &reader, Record &record, std::string &key){
+        
+        reader.beginObject();
+        while(reader.nextMember(key)){
+            
+            const ResponseField<Record> *field = ResponseFields<Record>::fields;
+            while(field->key != nullptr && key != field->key)
+                field++;
+            
+            if(field->key != nullptr)
+                field->read(reader, record);
+            else
+                reader.skipValue();
+            
+        }
+        
+        return !reader.failed();
+        
+    }
+    
+    
+    // A document that is a single object.
+    template<typename Record>
+    bool decodeRecord(std::string const& document, Record &record){
+        
+        JsonStreamReader reader(document);
+        std::string key;
+        
+        return decodeObject(reader, record, key);
+        
+    }
+    
+    
+    // Appends the objects in the array under listKey, which is looked up at the top level of the document.
+    // Nothing is appended if the document is malformed or has no listKey, so that a response of some
+    // other shape isn't taken for an empty list.
+    template<typename Record>
+    bool decodeRecordList(std::string const& document, const char *listKey, std::vector<Record> &records){
+        
+        JsonStreamReader reader(document);
+        std::string key;
+        std::size_t existing = records.size();
+        bool found = false;
+        
+        reader.beginObject();
+        while(reader.nextMember(key)){
+            
+            if(key != listKey){
+                reader.skipValue();
+                continue;
+            }
+            
+            found = true;
+            reader.beginArray();
+            while(reader.nextElement()){
+                Record record;
+                if(!decodeObject(reader, record, key))
+                    break;
+                records.push_back(std::move(record));
+            }
+            
+        }
+        
+        if(reader.failed() || !found){
+            records.erase(records.begin() + existing, records.end());
+            return false;
+        }
+        
+        return true;
+        
+    }
+    
+    
+    // As decodeRecordList, for an array of plain strings.
+    inline bool decodeStringList(std::string const& document, const char *listKey, std::vector<std::string> &values){
+        
+        JsonStreamReader reader(document);
+        std::string key;
+        std::size_t existing = values.size();
+        bool found = false;
+        
+        reader.beginObject();
+        while(reader.nextMember(key)){
+            
+            if(key != listKey){
+                reader.skipValue();
+                continue;
+            }
+            
+            found = true;
+            reader.beginArray();
+            while(reader.nextElement()){
+                std::string value;
+                if(!reader.readString(value))
+                    break;
+                values.push_back(std::move(value));
+            }
+            
+        }
+        
+        if(reader.failed() || !found){
+            values.erase(values.begin() + existing, values.end());
+            return false;
+        }
+        
+        return true;
+        
+    }
+    
+}
@@ -0,0 +1,40 @@
+#pragma once
+//
+//  Snapshot.h
+//
+
+#include "TR1_Wrapper.hpp"
+
+namespace bmwrapper {
+    
+    // Holds a value that is only ever replaced whole. Readers take a handle to the current value without
+    // locking and can keep using it for as long as they like, while a writer builds the next value off to
+    // the side and publishes it in one step. Writers that modify the current value (copy, change, publish)
+    // need their own mutex so that they don't lose each other's changes.
+    template<typename T>
+    class Snapshot {
+        
+    public:
+        
+        typedef _SharedPtr<const T> Handle;
+        
+        Snapshot(T *initial) : m_current(initial) {}
+        Snapshot() : m_current(new T()) {}
+        
+        Handle load() const {return atomic_load(&m_current);}
+        
+        void publish(_SharedPtr<T> const& next){
+            Handle handle(next);
+            atomic_store(&m_current, handle);
+        }
+        
+    private:
+        
+        Handle m_current;
+        
+        Snapshot(Snapshot const&);
+        Snapshot& operator=(Snapshot const&);
+        
+    };
+    
+}
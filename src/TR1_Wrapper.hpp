@@ -14,6 +14,7 @@
 #define _CINTTYPES <tr1/cinttypes>
 #define _MEMORY <tr1/memory>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 #endif
 #ifdef __APPLE__
 #define _CINTTYPES <inttypes>
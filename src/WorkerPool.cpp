@@ -0,0 +1,128 @@
+//
+//  WorkerPool.cpp
+//
+
+#include "WorkerPool.h"
+
+namespace bmwrapper {
+    
+    
+    WorkerPool::WorkerPool(unsigned int workers) : m_count(0), m_chunk(1), m_next(0), m_chunksLeft(0), m_stop(false) {
+        
+        if(workers == 0){
+            unsigned int cores = OT_THREAD::hardware_concurrency();
+            workers = cores > 1 ? cores - 1 : 0;
+        }
+        
+        for(unsigned int x = 0; x < workers; x++)
+            m_threads.push_back(OT_THREAD(&WorkerPool::run, this));
+        
+    }
+    
+    
+    WorkerPool::~WorkerPool(){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        m_stop = true;
+        mlock.unlock();
+        m_wake.notify_all();
+        
+        for(unsigned int x = 0; x < m_threads.size(); x++)
+            m_threads.at(x).join();
+        
+    }
+    
+    
+    void WorkerPool::parallelFor(std::size_t count, RangeJob job){
+        
+        if(count == 0)
+            return;
+        
+        if(m_threads.empty()){
+            job(0, count);
+            return;
+        }
+        
+        INSTANTIATE_MLOCK(m_callMutex);
+        dispatch(count, job);
+        mlock.unlock();
+        
+    }
+    
+    
+    void WorkerPool::dispatch(std::size_t count, RangeJob const& job){
+        
+        // A few chunks per thread evens out messages of different sizes
+        std::size_t chunks = (m_threads.size() + 1) * 4;
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        m_job = job;
+        m_count = count;
+        m_chunk = (count + chunks - 1) / chunks;
+        m_next = 0;
+        m_chunksLeft = (count + m_chunk - 1) / m_chunk;
+        mlock.unlock();
+        m_wake.notify_all();
+        
+        while(runNextChunk()){}
+        
+        mlock.lock();
+        while(m_chunksLeft > 0)
+            m_finished.wait(mlock);
+        
+        m_job = RangeJob();
+        m_count = 0;
+        mlock.unlock();
+        
+    }
+    
+    
+    bool WorkerPool::runNextChunk(){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
+        if(m_next >= m_count){
+            mlock.unlock();
+            return false;
+        }
+        
+        std::size_t begin = m_next;
+        std::size_t end = begin + m_chunk < m_count ? begin + m_chunk : m_count;
+        m_next = end;
+        mlock.unlock();
+        
+        // m_job stays put until the last chunk is done, parallelFor waits for that
+        m_job(begin, end);
+        
+        mlock.lock();
+        if(--m_chunksLeft == 0)
+            m_finished.notify_all();
+        mlock.unlock();
+        
+        return true;
+        
+    }
+    
+    
+    void WorkerPool::run(){
+        
+        while(true){
+            
+            INSTANTIATE_MLOCK(m_poolMutex);
+            while(!m_stop && m_next >= m_count)
+                m_wake.wait(mlock);
+            
+            if(m_stop){
+                mlock.unlock();
+                return;
+            }
+            
+            mlock.unlock();
+            
+            while(runNextChunk()){}
+            
+        }
+        
+    }
+    
+}
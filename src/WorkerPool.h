@@ -0,0 +1,54 @@
+#pragma once
+//
+//  WorkerPool.h
+//
+
+#include <vector>
+#include <cstddef>
+
+#include "BMThreading.h"
+
+namespace bmwrapper {
+    
+    // A fixed set of threads for splitting CPU bound work, such as decoding a large mailbox, across cores.
+    class WorkerPool {
+        
+    public:
+        
+        // Runs over the half open range [begin, end)
+        typedef OT_STD_FUNCTION(void(std::size_t, std::size_t)) RangeJob;
+        
+        // With workers=0 there is one thread for every core but the caller's.
+        WorkerPool(unsigned int workers=0);
+        ~WorkerPool();
+        
+        // Splits [0, count) into contiguous chunks and runs job on each of them, with the calling thread
+        // taking chunks too. Returns once every chunk is done. Chunks run in no particular order, so job
+        // should write each index to its own slot. Calls from several threads take turns.
+        void parallelFor(std::size_t count, RangeJob job);
+        
+        unsigned int workers(){return (unsigned int)m_threads.size();}
+        
+    private:
+        
+        std::vector<OT_THREAD> m_threads;
+        
+        OT_MUTEX(m_callMutex); // Held for the length of a parallelFor
+        OT_MUTEX(m_poolMutex);
+        CONDITION_VARIABLE(m_wake);
+        CONDITION_VARIABLE(m_finished);
+        
+        RangeJob m_job;
+        std::size_t m_count;
+        std::size_t m_chunk;
+        std::size_t m_next; // Start of the next chunk to hand out
+        std::size_t m_chunksLeft;
+        bool m_stop;
+        
+        void run();
+        void dispatch(std::size_t count, RangeJob const& job); // Caller holds m_callMutex
+        bool runNextChunk(); // Returns false once every chunk has been handed out
+        
+    };
+    
+}
@@ -8,29 +8,282 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <map>
+#include <chrono>
 
 namespace bmwrapper {
     
     
-    XmlRPC::XmlRPC(std::string serverurl, int port, bool authrequired, int Timeout) : m_serverurl(serverurl), m_port(port), m_authrequired(authrequired), m_timeout(Timeout) {
+    // xmlrpc-c checks responses against a single process-wide size limit when it parses them. Our
+    // transports stop reading a response once it is over its client's own limit, so the process-wide
+    // one is lifted once, by the first client, rather than moved around by every client's setting.
+    static OT_MUTEX(s_globalSizeLimitMutex);
+    static bool s_globalSizeLimitLifted = false;
+    
+    static void liftGlobalSizeLimit(){
+        
+        INSTANTIATE_MLOCK(s_globalSizeLimitMutex);
+        if(!s_globalSizeLimitLifted){
+            xmlrpc_limit_set(XMLRPC_XML_SIZE_LIMIT_ID, (std::size_t)-1);
+            s_globalSizeLimitLifted = true;
+        }
+        mlock.unlock();
+        
+    }
+    
+    
+    // Turns a raw response document into our response pair, refusing anything over sizeLimit
+    // before any parsing work is spent on it. The socket transports have already refused it while
+    // reading, this catches the in-process one.
+    static XmlResponse parseResponseXml(std::string const& responseXml, std::size_t sizeLimit, bool *faulted){
+        
+        if(responseXml.size() > sizeLimit){
+            std::cerr << "Error: XML-RPC response of " << responseXml.size() << " bytes exceeds the limit of " << sizeLimit << " bytes" << std::endl;
+            return std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string("")));
+        }
+        
+        xmlrpc_c::rpcOutcome outcome;
+        xmlrpc_c::xml::parseResponse(responseXml, &outcome);
+        
+        // The server answered with a fault rather than a result.
+        if(!outcome.succeeded()){
+            if(faulted != nullptr)
+                *faulted = true;
+            return std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(outcome.getFault().getDescription())));
+        }
+        
+        return std::make_pair(true, outcome.getResult());
+        
+    }
+    
+    
+    // Feeds one finished call into the stats, a failure that took the full transport timeout counts as a timeout.
+    static void recordCall(XmlRPCStats &stats, std::string const& methodName, std::chrono::steady_clock::time_point started, std::size_t requestBytes, std::size_t responseBytes, bool success, int timeout){
+        
+        unsigned long long latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+        bool timedOut = !success && timeout > 0 && latency >= (unsigned long long)timeout * 1000;
         
-        xmlrpc_c::clientXmlTransport_curl transport(
-                                                    xmlrpc_c::clientXmlTransport_curl::constrOpt()
-                                                    .timeout(m_timeout)  // milliseconds
-                                                    );
+        stats.record(methodName, latency, requestBytes, responseBytes, success, timedOut);
+        
+    }
+    
+    
+    // A transaction that hands its outcome to a future when the transport completes it.
+    class XmlAsyncCall : public xmlrpc_c::xmlTransaction {
+        
+    public:
+        
+        XmlAsyncCall(std::string const& methodName, std::size_t sizeLimit, XmlRPCStats &stats, CircuitBreaker &breaker, int timeout) : m_methodName(methodName), m_sizeLimit(sizeLimit), m_stats(stats), m_breaker(breaker), m_timeout(timeout), m_requestBytes(0), m_started(std::chrono::steady_clock::now()), m_completed(false) {}
+        
+        XmlAsyncResponse getResponse(){return m_promise.get_future();}
+        
+        void setRequestBytes(std::size_t requestBytes){m_requestBytes = requestBytes;}
+        
+        void finish(std::string const& responseXml) const {
+            if(m_completed)
+                return;
+            m_breaker.recordSuccess();
+            XmlResponse response(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(""))));
+            try {
+                response = parseResponseXml(responseXml, m_sizeLimit, nullptr);
+            } catch (...) {
+                //std::cerr << "Client threw unexpected error while parsing async response." << std::endl;
+            }
+            recordCall(m_stats, m_methodName, m_started, m_requestBytes, responseXml.size(), response.first, m_timeout);
+            complete(response);
+        }
+        
+        void finishErr(girerr::error const& error) const {
+            if(m_completed)
+                return;
+            // The server answered these, so it is up
+            if(dynamic_cast<XmlResponseTooLarge const*>(&error) != nullptr || dynamic_cast<XmlHttpStatusError const*>(&error) != nullptr){
+                std::cerr << "Error: " << error.what() << std::endl;
+                m_breaker.recordSuccess();
+            }
+            else
+                m_breaker.recordFailure();
+            recordCall(m_stats, m_methodName, m_started, m_requestBytes, 0, false, m_timeout);
+            complete(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(""))));
+        }
+        
+        void complete(XmlResponse response) const {
+            if(!m_completed){
+                m_completed = true;
+                m_promise.set_value(response);
+            }
+        }
+        
+    private:
+        
+        // xmlTransaction completes through const methods
+        mutable OT_PROMISE(XmlResponse) m_promise;
+        std::string m_methodName;
+        std::size_t m_sizeLimit;
+        XmlRPCStats &m_stats;
+        CircuitBreaker &m_breaker;
+        int m_timeout;
+        std::size_t m_requestBytes;
+        std::chrono::steady_clock::time_point m_started;
+        mutable bool m_completed;
+        
+    };
+    
+    
+    XmlRPC::XmlRPC(std::string serverurl, int port, bool authrequired, int Timeout, int poolSize) : m_serverurl(serverurl), m_port(port), m_timeout(Timeout), m_authrequired(authrequired), m_connectionCount(0), m_poolSize(poolSize > 0 ? poolSize : 1), m_transportGeneration(0), m_carriageGeneration(0), m_responseSizeLimit(5000000), m_asyncFinishing(0) {
+        
+        m_multicallSupported = true;
         
         m_authset = false;
         
+        if(m_serverurl.compare(0, 5, "unix:") == 0){
+            m_transportType = XmlTransportType::UNIX;
+            m_transportTarget = m_serverurl.substr(5);
+        }
+        else if(m_serverurl.compare(0, 7, "inproc:") == 0){
+            m_transportType = XmlTransportType::INPROC;
+            m_transportTarget = m_serverurl.substr(7);
+        }
+        else{
+            m_transportType = XmlTransportType::TCP;
+        }
+        
+        liftGlobalSizeLimit();
+        
+    }
+    
+    
+    XmlRPC::~XmlRPC(){
+        
+        // Don't pull the transport out from under calls that are still in flight.
+        finishAsync();
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
+        for(unsigned int x = 0; x < m_idleConnections.size(); x++){
+            delete m_idleConnections.at(x);
+        }
+        m_idleConnections.clear();
+        
+        mlock.unlock();
+        
     }
     
     
     
     XmlResponse XmlRPC::run(std::string methodName, std::vector<xmlrpc_c::value> parameters ){
         
-        try {
+        return call(methodName, parameters, nullptr);
+        
+    }
+    
+    
+    std::vector<XmlResponse> XmlRPC::multicall(std::vector<XmlCall> calls){
+        
+        std::vector<XmlResponse> responses;
+        
+        // Nothing to gain from wrapping a single call, and some servers don't offer system.multicall at all.
+        if(calls.size() < 2 || OT_ATOMIC_ISFALSE(m_multicallSupported)){
+            for(unsigned int x = 0; x < calls.size(); x++){
+                responses.push_back(run(calls.at(x).first, calls.at(x).second));
+            }
+            return responses;
+        }
+        
+        std::vector<xmlrpc_c::value> batch;
+        
+        for(unsigned int x = 0; x < calls.size(); x++){
+            std::map<std::string, xmlrpc_c::value> entry;
+            entry["methodName"] = xmlrpc_c::value_string(calls.at(x).first);
+            entry["params"] = xmlrpc_c::value_array(calls.at(x).second);
+            batch.push_back(xmlrpc_c::value_struct(entry));
+        }
+        
+        std::vector<xmlrpc_c::value> parameters;
+        parameters.push_back(xmlrpc_c::value_array(batch));
+        
+        bool faulted = false;
+        XmlResponse result = call("system.multicall", parameters, &faulted);
+        
+        if(faulted){
+            // The server answered, but doesn't understand system.multicall. Don't ask again.
+            std::cerr << "XML-RPC server does not support system.multicall, falling back to single calls" << std::endl;
+            m_multicallSupported = false;
+            return multicall(calls);
+        }
+        
+        if(result.first == false || result.second.type() != xmlrpc_c::value::TYPE_ARRAY){
+            // The whole batch failed to go through, so every call in it failed.
+            for(unsigned int x = 0; x < calls.size(); x++){
+                responses.push_back(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(""))));
+            }
+            return responses;
+        }
+        
+        std::vector<xmlrpc_c::value> results = xmlrpc_c::value_array(result.second).vectorValueValue();
+        
+        // The batch itself is timed under system.multicall, its members only count towards success and failure.
+        
+        for(unsigned int x = 0; x < calls.size(); x++){
             
-            // Construct our client from our Transport object
-            xmlrpc_c::client_xml client(&transport);
+            if(x >= results.size()){
+                responses.push_back(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(""))));
+            }
+            else if(results.at(x).type() == xmlrpc_c::value::TYPE_ARRAY){
+                // A successful call is wrapped in a single element array
+                std::vector<xmlrpc_c::value> wrapped = xmlrpc_c::value_array(results.at(x)).vectorValueValue();
+                if(wrapped.size() > 0)
+                    responses.push_back(std::make_pair(true, wrapped.at(0)));
+                else
+                    responses.push_back(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(""))));
+            }
+            else{
+                // Otherwise it is a fault struct for this call alone
+                std::string faultString;
+                if(results.at(x).type() == xmlrpc_c::value::TYPE_STRUCT){
+                    std::map<std::string, xmlrpc_c::value> fault = xmlrpc_c::value_struct(results.at(x));
+                    if(fault.count("faultString") && fault["faultString"].type() == xmlrpc_c::value::TYPE_STRING)
+                        faultString = std::string(xmlrpc_c::value_string(fault["faultString"]));
+                }
+                std::cerr << "Error: XML-RPC call " << calls.at(x).first << " failed in batch: " << faultString << std::endl;
+                responses.push_back(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(faultString))));
+            }
+            
+            m_stats.recordBatched(calls.at(x).first, responses.back().first);
+            
+        }
+        
+        return responses;
+        
+    }
+    
+    
+    XmlResponse XmlRPC::call(std::string const& methodName, std::vector<xmlrpc_c::value> const& parameters, bool *faulted){
+        
+        // Check That Auth Requirements have been met
+        if(!authReady()){
+            std::cerr << "Error: XML-RPC Auth is required but has not been set" << std::endl;
+            return std::make_pair(false,xmlrpc_c::value_string(""));
+        }
+        
+        // Don't wait out a timeout on a server we already know is down.
+        if(!m_breaker.allowRequest()){
+            m_stats.recordRejected(methodName);
+            return std::make_pair(false,xmlrpc_c::value_string(""));
+        }
+        
+        std::size_t const sizeLimit = getResponseSizeLimit();
+        int const timeout = getTimeout();
+        bool delivered = false;
+        
+        // Each connection holds a single curl session, so it is ours alone until we return it.
+        XmlConnection *connection = checkoutConnection();
+        
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        std::size_t requestBytes = 0;
+        std::size_t responseBytes = 0;
+        
+        try {
             
             std::string const method(methodName);
             
@@ -38,49 +291,62 @@ namespace bmwrapper {
             
             xmlrpc_c::paramList params;
             
-            for(int i=0; i < parameters.size(); i++){
-                xmlrpc_c::value newParameter(parameters.at(i));
-                params.add(newParameter);
+            for(unsigned int i=0; i < parameters.size(); i++){
+                params.add(parameters.at(i));
             }
             
-            // Construct the Server URL
-            char port_string[10];
-            sprintf(port_string, "%d", m_port);
-            std::string const serverUrl(m_serverurl + ":" + port_string);
-            xmlrpc_c::carriageParm_http0 carriageParams(serverUrl);
-            
-            // Check That Auth Requirements have been met
-            if(m_authrequired){
-                if(!m_authset){
-                    std::cerr << "Error: XML-RPC Auth is required but has not been set" << std::endl;
-                    return std::make_pair(false,xmlrpc_c::value_string(""));
-                }
-                else{
-                    carriageParams.setUser(m_authuser, m_authpass);
-                    carriageParams.allowAuthBasic();
-                }
-            }
+            std::string callXml;
+            xmlrpc_c::xml::generateCall(method, params, &callXml);
+            requestBytes = callXml.size();
             
+            // Run our RPC Call
+            std::string responseXml;
+            connection->transport->call(connection->carriageParams, callXml, &responseXml);
+            responseBytes = responseXml.size();
             
-            // Uncomment this to expand the size limit, I will move this elsewhere later into a function
-            // similar to the timeout setting one.
-            //
-            xmlrpc_limit_set(XMLRPC_XML_SIZE_LIMIT_ID, 5e6);
+            returnConnection(connection);
+            connection = nullptr;
             
-            // Run our RPC Call
-            xmlrpc_c::rpcPtr rpc(method, params);
-            rpc->call(&client, &carriageParams);
-            assert(rpc->isFinished());
+            // The server answered, whatever the response turns out to hold.
+            delivered = true;
+            m_breaker.recordSuccess();
             
-            xmlrpc_c::value const response(rpc->getResult());
+            XmlResponse response(parseResponseXml(responseXml, sizeLimit, faulted));
             
-            return std::make_pair(true,response);
+            recordCall(m_stats, methodName, started, requestBytes, responseBytes, response.first, timeout);
+            return response;
             
+        } catch (XmlResponseTooLarge const& e) {
+            // The server is there, it just sent more than we will take
+            std::cerr << "Error: " << e.what() << std::endl;
+            if(connection != nullptr)
+                returnConnection(connection);
+            m_breaker.recordSuccess();
+            recordCall(m_stats, methodName, started, requestBytes, responseBytes, false, timeout);
+            return std::make_pair(false,xmlrpc_c::value_string(""));
+        } catch (XmlHttpStatusError const& e) {
+            // The server is there, it just turned the call down (bad auth, internal error)
+            std::cerr << "Error: " << e.what() << std::endl;
+            if(connection != nullptr)
+                returnConnection(connection);
+            m_breaker.recordSuccess();
+            recordCall(m_stats, methodName, started, requestBytes, responseBytes, false, timeout);
+            return std::make_pair(false,xmlrpc_c::value_string(""));
         } catch (std::exception const& e) {
             //std::cerr << "Client threw error: " << e.what() << std::endl;
+            if(connection != nullptr)
+                returnConnection(connection);
+            if(!delivered)
+                m_breaker.recordFailure();
+            recordCall(m_stats, methodName, started, requestBytes, responseBytes, false, timeout);
             return std::make_pair(false,xmlrpc_c::value_string(""));
         } catch (...) {
             //std::cerr << "Client threw unexpected error." << std::endl;
+            if(connection != nullptr)
+                returnConnection(connection);
+            if(!delivered)
+                m_breaker.recordFailure();
+            recordCall(m_stats, methodName, started, requestBytes, responseBytes, false, timeout);
             return std::make_pair(false,xmlrpc_c::value_string(""));
         }
         
@@ -88,29 +354,379 @@ namespace bmwrapper {
     
     
     
+    XmlAsyncResponse XmlRPC::runAsync(std::string methodName, std::vector<xmlrpc_c::value> parameters){
+        
+        xmlrpc_c::paramList params;
+        
+        for(unsigned int i=0; i < parameters.size(); i++){
+            params.add(parameters.at(i));
+        }
+        
+        XmlAsyncCall *call = new XmlAsyncCall(methodName, getResponseSizeLimit(), m_stats, m_breaker, getTimeout());
+        xmlrpc_c::xmlTransactionPtr transaction(call); // The transaction pointer owns our call from here on
+        XmlAsyncResponse response(call->getResponse());
+        
+        if(!authReady()){
+            std::cerr << "Error: XML-RPC Auth is required but has not been set" << std::endl;
+            call->complete(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(""))));
+            return response;
+        }
+        
+        if(!m_breaker.allowRequest()){
+            m_stats.recordRejected(methodName);
+            call->complete(std::make_pair(false, xmlrpc_c::value(xmlrpc_c::value_string(""))));
+            return response;
+        }
+        
+        INSTANTIATE_MLOCK(m_asyncMutex);
+        
+        // Only pick up new settings while nothing is attached to the connection.
+        if(m_asyncCalls.size() == 0){
+            INSTANTIATE_MLOCK(m_poolMutex);
+            refreshConnection(&m_asyncConnection);
+        }
+        
+        try {
+            std::string callXml;
+            xmlrpc_c::xml::generateCall(methodName, params, &callXml);
+            call->setRequestBytes(callXml.size());
+            
+            m_asyncConnection.transport->start(m_asyncConnection.carriageParams, callXml, transaction);
+            m_asyncCalls.push_back(std::make_pair(transaction, call));
+        } catch (girerr::error const& e) {
+            // Transports without their own start run the call right here, so this may be how it ended
+            call->finishErr(e);
+        } catch (...) {
+            call->finishErr(girerr::error("Unable to start XML-RPC call"));
+        }
+        
+        mlock.unlock();
+        return response;
+        
+    }
+    
+    
+    void XmlRPC::finishAsync(){
+        
+        INSTANTIATE_MLOCK(m_asyncMutex);
+        
+        if(m_asyncCalls.size() == 0){
+            mlock.unlock();
+            return;
+        }
+        
+        // Take the calls and the connection they are attached to, so that other threads can start
+        // calls on a fresh connection while we wait on the network.
+        std::vector<std::pair<xmlrpc_c::xmlTransactionPtr, XmlAsyncCall*> > calls;
+        calls.swap(m_asyncCalls);
+        
+        XmlConnection *connection = new XmlConnection();
+        std::swap(connection->transport, m_asyncConnection.transport);
+        std::swap(connection->carriageParams, m_asyncConnection.carriageParams);
+        std::swap(connection->transportGeneration, m_asyncConnection.transportGeneration);
+        std::swap(connection->carriageGeneration, m_asyncConnection.carriageGeneration);
+        
+        int const finishing = calls.size();
+        m_asyncFinishing += finishing;
+        
+        mlock.unlock();
+        
+        try {
+            // Each transfer is still bound by the transport timeout, so this will return.
+            connection->transport->finishAsync(xmlrpc_c::timeout());
+        } catch (...) {
+            //std::cerr << "Client threw unexpected error while finishing async calls." << std::endl;
+        }
+        
+        // Anything the transport didn't complete is reported as failed so no future is left hanging.
+        for(unsigned int x = 0; x < calls.size(); x++){
+            calls.at(x).second->finishErr(girerr::error("XML-RPC call did not complete"));
+        }
+        calls.clear();
+        
+        mlock.lock();
+        
+        m_asyncFinishing -= finishing;
+        
+        // Hand the connection back for reuse, unless calls were started on a new one meanwhile
+        if(m_asyncConnection.transport == nullptr){
+            std::swap(connection->transport, m_asyncConnection.transport);
+            std::swap(connection->carriageParams, m_asyncConnection.carriageParams);
+            std::swap(connection->transportGeneration, m_asyncConnection.transportGeneration);
+            std::swap(connection->carriageGeneration, m_asyncConnection.carriageGeneration);
+        }
+        
+        mlock.unlock();
+        
+        delete connection;
+        
+    }
+    
+    
+    int XmlRPC::asyncPending(){
+        
+        INSTANTIATE_MLOCK(m_asyncMutex);
+        int pending = m_asyncCalls.size() + m_asyncFinishing;
+        mlock.unlock();
+        return pending;
+        
+    }
+    
+    
     void XmlRPC::setTimeout(int Timeout){
         
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
         m_timeout = Timeout;
         
-        xmlrpc_c::clientXmlTransport_curl transport(
-                                                    xmlrpc_c::clientXmlTransport_curl::constrOpt()
-                                                    .timeout(m_timeout)  // milliseconds
-                                                    );
+        // The timeout is a property of the transport, so connections rebuild theirs on next checkout.
+        m_transportGeneration++;
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    int XmlRPC::getTimeout(){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        int timeout = m_timeout;
+        mlock.unlock();
+        return timeout;
+        
     }
     
     
     void XmlRPC::setAuth(std::string user, std::string pass){
         
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
         m_authuser = user;
         m_authpass = pass;
         
         m_authset = true;
         
+        m_carriageGeneration++;
+        
+        mlock.unlock();
+        
     }
     
     
     void XmlRPC::toggleAuth(bool toggle){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
         m_authrequired = toggle;
+        
+        m_carriageGeneration++;
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    void XmlRPC::setPoolSize(int poolSize){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
+        m_poolSize = poolSize > 0 ? poolSize : 1;
+        
+        // Drop idle connections we no longer have room for, busy ones are dropped as they come back.
+        while(m_connectionCount > m_poolSize && m_idleConnections.size() > 0){
+            delete m_idleConnections.back();
+            m_idleConnections.pop_back();
+            m_connectionCount--;
+        }
+        
+        mlock.unlock();
+        
+        m_poolAvailable.notify_all();
+        
+    }
+    
+    
+    int XmlRPC::getPoolSize(){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        int poolSize = m_poolSize;
+        mlock.unlock();
+        return poolSize;
+        
+    }
+    
+    
+    void XmlRPC::setResponseSizeLimit(std::size_t sizeLimit){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
+        m_responseSizeLimit = sizeLimit;
+        
+        // The transports enforce the limit as they read, so connections rebuild theirs on next checkout.
+        m_transportGeneration++;
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    std::size_t XmlRPC::getResponseSizeLimit(){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        std::size_t sizeLimit = m_responseSizeLimit;
+        mlock.unlock();
+        return sizeLimit;
+        
+    }
+    
+    
+    RPCStatsSnapshot XmlRPC::getStats(){
+        
+        return m_stats.snapshot();
+        
+    }
+    
+    
+    void XmlRPC::resetStats(){
+        
+        m_stats.reset();
+        
+    }
+    
+    
+    void XmlRPC::setCircuitBreaker(int failureThreshold, int baseBackoff, int maxBackoff){
+        
+        m_breaker.configure(failureThreshold, baseBackoff, maxBackoff);
+        
+    }
+    
+    
+    CircuitBreaker::State XmlRPC::circuitState(){
+        
+        return m_breaker.state();
+        
+    }
+    
+    
+    int XmlRPC::circuitRetryMillis(){
+        
+        return m_breaker.retryInMillis();
+        
+    }
+    
+    
+    XmlConnection* XmlRPC::checkoutConnection(){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
+        while(m_idleConnections.size() == 0 && m_connectionCount >= m_poolSize){
+            m_poolAvailable.wait(mlock);
+        }
+        
+        XmlConnection *connection;
+        
+        if(m_idleConnections.size() > 0){
+            connection = m_idleConnections.back();
+            m_idleConnections.pop_back();
+        }
+        else{
+            connection = new XmlConnection();
+            m_connectionCount++;
+        }
+        
+        refreshConnection(connection);
+        
+        mlock.unlock();
+        
+        return connection;
+        
+    }
+    
+    
+    void XmlRPC::returnConnection(XmlConnection *connection){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        
+        if(m_connectionCount > m_poolSize){
+            // The pool was shrunk while this connection was out.
+            delete connection;
+            m_connectionCount--;
+        }
+        else{
+            m_idleConnections.push_back(connection);
+        }
+        
+        mlock.unlock();
+        
+        m_poolAvailable.notify_one();
+        
+    }
+    
+    
+    bool XmlRPC::authReady(){
+        
+        INSTANTIATE_MLOCK(m_poolMutex);
+        bool ready = !m_authrequired || m_authset;
+        mlock.unlock();
+        return ready;
+        
+    }
+    
+    
+    // Callers must hold m_poolMutex.
+    void XmlRPC::refreshConnection(XmlConnection *connection){
+        
+        if(connection->transportGeneration != m_transportGeneration){
+            
+            delete connection->transport;
+            
+            if(m_transportType == XmlTransportType::UNIX){
+                connection->transport = new clientXmlTransport_unix(m_transportTarget, m_timeout, m_responseSizeLimit);
+            }
+            else if(m_transportType == XmlTransportType::INPROC){
+                connection->transport = new clientXmlTransport_inproc(m_transportTarget);
+            }
+            else{
+                connection->transport = new clientXmlTransport_tcp(m_timeout, m_responseSizeLimit);
+            }
+            
+            connection->transportGeneration = m_transportGeneration;
+        }
+        
+        if(connection->carriageGeneration != m_carriageGeneration){
+            
+            delete connection->carriageParams;
+            connection->carriageParams = nullptr;
+            
+            if(m_transportType == XmlTransportType::UNIX){
+                carriageParm_unix *carriageParams = new carriageParm_unix();
+                
+                if(m_authrequired && m_authset)
+                    carriageParams->setUser(m_authuser, m_authpass);
+                
+                connection->carriageParams = carriageParams;
+            }
+            else if(m_transportType == XmlTransportType::INPROC){
+                // Nothing to carry, the handler is called directly.
+                connection->carriageParams = new carriageParm_unix();
+            }
+            else{
+                // Construct the Server URL
+                char port_string[10];
+                sprintf(port_string, "%d", m_port);
+                std::string const serverUrl(m_serverurl + ":" + port_string);
+                
+                carriageParm_tcp *carriageParams = new carriageParm_tcp(serverUrl);
+                
+                if(m_authrequired && m_authset)
+                    carriageParams->setUser(m_authuser, m_authpass);
+                
+                connection->carriageParams = carriageParams;
+            }
+            
+            connection->carriageGeneration = m_carriageGeneration;
+        }
+        
     }
     
     
@@ -1,3 +1,4 @@
+#pragma once
 //
 //  XmlRPC.h
 //
@@ -15,6 +16,11 @@
 #include <xmlrpc-c/timeout.hpp>
 #include <xmlrpc-c/xml.hpp>
 
+#include "BMThreading.h"
+#include "XmlRPCStats.h"
+#include "CircuitBreaker.h"
+#include "XmlTransport.h"
+
 #if MSVCRT
 #  define WIN32_LEAN_AND_MEAN
 #  include <windows.h>
@@ -27,27 +33,97 @@ namespace bmwrapper {
     
     typedef std::pair<bool, xmlrpc_c::value> XmlResponse;
     
+    // A method name and its parameters, as batched by XmlRPC::multicall
+    typedef std::pair<std::string, std::vector<xmlrpc_c::value> > XmlCall;
+    
+    // Handle to an RPC started with XmlRPC::runAsync, it becomes ready once
+    // XmlRPC::finishAsync has driven the call to completion.
+    typedef OT_FUTURE(XmlResponse) XmlAsyncResponse;
+    
+    class XmlAsyncCall;
+    
+    // One transport, along with the carriage parameters it was built for.
+    // The curl and Unix socket transports keep their connection alive for synchronous calls, so
+    // the HTTP/1.1 connection to the API server is reused between RPCs and is only re-established
+    // when the server drops it.
+    class XmlConnection {
+        
+    public:
+        
+        XmlConnection() : transport(nullptr), carriageParams(nullptr), transportGeneration(-1), carriageGeneration(-1) {}
+        ~XmlConnection(){delete carriageParams; delete transport;}
+        
+        xmlrpc_c::clientXmlTransport *transport;
+        xmlrpc_c::carriageParm *carriageParams;
+        
+        // The settings generations this connection was built from
+        int transportGeneration;
+        int carriageGeneration;
+        
+    };
+    
     class XmlRPC {
         
     public:
         
-        XmlRPC(std::string serverurl, int port=80, bool authrequired=false, int Timeout=10000);
-        ~XmlRPC(){}
+        // serverurl picks the transport, see XmlTransportType. The port is only used over TCP.
+        XmlRPC(std::string serverurl, int port=80, bool authrequired=false, int Timeout=10000, int poolSize=4);
+        ~XmlRPC();
         
         XmlResponse run(std::string methodName, std::vector<xmlrpc_c::value> parameters);
+        
+        // Sends every call in one system.multicall request and returns a response per call, in order.
+        // A fault inside the batch only fails the call it belongs to. Falls back to individual
+        // calls if the server does not support system.multicall.
+        std::vector<XmlResponse> multicall(std::vector<XmlCall> calls);
+        
+        // Starts an RPC without waiting for the response. Any number of calls may be in flight
+        // at once. Over TCP they are carried concurrently by the curl multi interface once finishAsync
+        // is called, the Unix socket and in-process transports run each call before runAsync returns.
+        XmlAsyncResponse runAsync(std::string methodName, std::vector<xmlrpc_c::value> parameters);
+        
+        // Blocks until every call started with runAsync so far has completed (or timed out). The calls
+        // are taken off the client first, so other threads can start and finish their own meanwhile.
+        void finishAsync();
+        int asyncPending();
+        
         void setTimeout(int Timeout);
+        int getTimeout();
         void setAuth(std::string user, std::string pass);
         void toggleAuth(bool toggle);
         
+        // Maximum number of connections used for concurrent synchronous calls.
+        void setPoolSize(int poolSize);
+        int getPoolSize();
+        
+        XmlTransportType getTransportType(){return m_transportType;}
+        
+        // Largest response, in bytes, this client will accept. Anything larger fails the call, the
+        // transport stops reading it once it goes over. Defaults to 5MB.
+        void setResponseSizeLimit(std::size_t sizeLimit);
+        std::size_t getResponseSizeLimit();
+        
+        // Per-method latency, size and error counters for every call made through this client.
+        RPCStatsSnapshot getStats();
+        void resetStats();
+        
+        // Calls fail immediately while the breaker is open, see CircuitBreaker.
+        // Backoffs are in milliseconds.
+        void setCircuitBreaker(int failureThreshold, int baseBackoff, int maxBackoff);
+        CircuitBreaker::State circuitState();
+        int circuitRetryMillis();
+        
     private:
         
         // Address Settings
         std::string m_serverurl;
         int m_port;
         
+        XmlTransportType m_transportType;
+        std::string m_transportTarget; // Socket path or handler name, for the transports that need one
+        
         // Transport Settings
         int m_timeout;
-        xmlrpc_c::clientXmlTransport_curl transport;
         
         // Auth Variables
         bool m_authrequired;
@@ -56,6 +132,43 @@ namespace bmwrapper {
         std::string m_authuser;
         std::string m_authpass;
         
+        // Connection Pool
+        // Callers check a connection out for the duration of a call, so concurrent callers
+        // each get their own curl session. Connections are created on demand up to m_poolSize
+        // and are rebuilt on checkout if the settings changed since they were built.
+        // m_poolMutex guards the pool as well as all of the settings above.
+        OT_MUTEX(m_poolMutex);
+        CONDITION_VARIABLE(m_poolAvailable);
+        std::vector<XmlConnection*> m_idleConnections;
+        int m_connectionCount;
+        int m_poolSize;
+        
+        int m_transportGeneration;
+        int m_carriageGeneration;
+        
+        std::size_t m_responseSizeLimit;
+        
+        OT_ATOMIC(m_multicallSupported);
+        
+        XmlRPCStats m_stats;
+        CircuitBreaker m_breaker;
+        
+        // Async calls run on their own connection, since they stay attached to it until finishAsync.
+        OT_MUTEX(m_asyncMutex);
+        XmlConnection m_asyncConnection;
+        
+        // Calls started with runAsync that have not been finished yet.
+        std::vector<std::pair<xmlrpc_c::xmlTransactionPtr, XmlAsyncCall*> > m_asyncCalls;
+        int m_asyncFinishing; // Calls a finishAsync has taken and is still waiting on
+        
+        XmlResponse call(std::string const& methodName, std::vector<xmlrpc_c::value> const& parameters, bool *faulted);
+        
+        XmlConnection* checkoutConnection();
+        void returnConnection(XmlConnection *connection);
+        
+        bool authReady();
+        void refreshConnection(XmlConnection *connection);
+        
         void xmlrpc_millisecond_sleep(unsigned int const milliseconds);
         
     };
@@ -0,0 +1,137 @@
+//
+//  XmlRPCStats.cpp
+//
+
+#include "XmlRPCStats.h"
+
+namespace bmwrapper {
+    
+    
+    RPCMethodStats::RPCMethodStats() : calls(0), successes(0), failures(0), timeouts(0), rejected(0), batchedCalls(0), requestBytes(0), responseBytes(0), totalLatencyMicros(0), maxLatencyMicros(0) {
+        
+        for(int x = 0; x < LatencyBuckets; x++)
+            latencyHistogram[x] = 0;
+        
+    }
+    
+    
+    unsigned long long RPCMethodStats::latencyPercentileMicros(double percentile) const {
+        
+        unsigned long long timed = 0;
+        for(int x = 0; x < LatencyBuckets; x++)
+            timed += latencyHistogram[x];
+        
+        if(timed == 0)
+            return 0;
+        
+        unsigned long long target = (unsigned long long)(timed * (percentile / 100.0));
+        if(target == 0)
+            target = 1;
+        
+        unsigned long long seen = 0;
+        for(int x = 0; x < LatencyBuckets; x++){
+            seen += latencyHistogram[x];
+            if(seen >= target)
+                return 1ULL << (x + 1);
+        }
+        
+        return maxLatencyMicros;
+        
+    }
+    
+    
+    unsigned long long RPCMethodStats::meanLatencyMicros() const {
+        
+        unsigned long long timed = calls - batchedCalls - rejected;
+        
+        if(timed == 0)
+            return 0;
+        
+        return totalLatencyMicros / timed;
+        
+    }
+    
+    
+    void XmlRPCStats::record(std::string const& methodName, unsigned long long latencyMicros, std::size_t requestBytes, std::size_t responseBytes, bool success, bool timedOut){
+        
+        int bucket = 0;
+        while(bucket < RPCMethodStats::LatencyBuckets - 1 && (latencyMicros >> (bucket + 1)) != 0)
+            bucket++;
+        
+        INSTANTIATE_MLOCK(m_statsMutex);
+        
+        RPCMethodStats &stats = m_stats[methodName];
+        
+        stats.calls++;
+        if(success)
+            stats.successes++;
+        else
+            stats.failures++;
+        if(timedOut)
+            stats.timeouts++;
+        
+        stats.requestBytes += requestBytes;
+        stats.responseBytes += responseBytes;
+        
+        stats.totalLatencyMicros += latencyMicros;
+        if(latencyMicros > stats.maxLatencyMicros)
+            stats.maxLatencyMicros = latencyMicros;
+        stats.latencyHistogram[bucket]++;
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    void XmlRPCStats::recordBatched(std::string const& methodName, bool success){
+        
+        INSTANTIATE_MLOCK(m_statsMutex);
+        
+        RPCMethodStats &stats = m_stats[methodName];
+        
+        stats.calls++;
+        stats.batchedCalls++;
+        if(success)
+            stats.successes++;
+        else
+            stats.failures++;
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    void XmlRPCStats::recordRejected(std::string const& methodName){
+        
+        INSTANTIATE_MLOCK(m_statsMutex);
+        
+        RPCMethodStats &stats = m_stats[methodName];
+        
+        stats.calls++;
+        stats.failures++;
+        stats.rejected++;
+        
+        mlock.unlock();
+        
+    }
+    
+    
+    RPCStatsSnapshot XmlRPCStats::snapshot(){
+        
+        INSTANTIATE_MLOCK(m_statsMutex);
+        RPCStatsSnapshot stats(m_stats);
+        mlock.unlock();
+        return stats;
+        
+    }
+    
+    
+    void XmlRPCStats::reset(){
+        
+        INSTANTIATE_MLOCK(m_statsMutex);
+        m_stats.clear();
+        mlock.unlock();
+        
+    }
+    
+}
@@ -0,0 +1,69 @@
+#pragma once
+//
+//  XmlRPCStats.h
+//
+
+#include <string>
+#include <map>
+#include <cstddef>
+
+#include "BMThreading.h"
+
+namespace bmwrapper {
+    
+    // Counters for a single XML-RPC method.
+    // Latencies are kept in a log2 histogram, bucket i counts calls that took [2^i, 2^(i+1)) microseconds.
+    class RPCMethodStats {
+        
+    public:
+        
+        static const int LatencyBuckets = 32;
+        
+        RPCMethodStats();
+        
+        unsigned long long calls;
+        unsigned long long successes;
+        unsigned long long failures;
+        unsigned long long timeouts;
+        
+        // Calls refused without being sent because the circuit breaker was open, also counted as failures.
+        unsigned long long rejected;
+        
+        // Calls sent inside a system.multicall batch, these have no latency of their own.
+        unsigned long long batchedCalls;
+        
+        unsigned long long requestBytes;
+        unsigned long long responseBytes;
+        
+        unsigned long long totalLatencyMicros;
+        unsigned long long maxLatencyMicros;
+        unsigned long long latencyHistogram[LatencyBuckets];
+        
+        // Estimated from the histogram, returns the upper bound of the bucket holding the given percentile (0-100).
+        unsigned long long latencyPercentileMicros(double percentile) const;
+        unsigned long long meanLatencyMicros() const;
+        
+    };
+    
+    typedef std::map<std::string, RPCMethodStats> RPCStatsSnapshot;
+    
+    
+    class XmlRPCStats {
+        
+    public:
+        
+        void record(std::string const& methodName, unsigned long long latencyMicros, std::size_t requestBytes, std::size_t responseBytes, bool success, bool timedOut);
+        void recordBatched(std::string const& methodName, bool success);
+        void recordRejected(std::string const& methodName);
+        
+        RPCStatsSnapshot snapshot();
+        void reset();
+        
+    private:
+        
+        OT_MUTEX(m_statsMutex);
+        RPCStatsSnapshot m_stats;
+        
+    };
+    
+}
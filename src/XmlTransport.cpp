@@ -0,0 +1,662 @@
+//
+//  XmlTransport.cpp
+//
+
+#include "XmlTransport.h"
+#include "base64.h"
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <curl/curl.h>
+
+namespace bmwrapper {
+    
+    
+    static OT_MUTEX(s_handlersMutex);
+    static std::map<std::string, XmlRPCHandler*> s_handlers;
+    
+    
+    void registerXmlRPCHandler(std::string const& name, XmlRPCHandler *handler){
+        
+        INSTANTIATE_MLOCK(s_handlersMutex);
+        s_handlers[name] = handler;
+        mlock.unlock();
+        
+    }
+    
+    
+    void unregisterXmlRPCHandler(std::string const& name){
+        
+        INSTANTIATE_MLOCK(s_handlersMutex);
+        s_handlers.erase(name);
+        mlock.unlock();
+        
+    }
+    
+    
+    void clientXmlTransport_inproc::call(xmlrpc_c::carriageParm * const, std::string const& callXml, std::string * const responseXmlP){
+        
+        INSTANTIATE_MLOCK(s_handlersMutex);
+        std::map<std::string, XmlRPCHandler*>::iterator it = s_handlers.find(m_name);
+        XmlRPCHandler *handler = it != s_handlers.end() ? it->second : nullptr;
+        mlock.unlock();
+        
+        if(handler == nullptr)
+            throw girerr::error("No in-process XML-RPC handler registered as " + m_name);
+        
+        handler->processCall(callXml, responseXmlP);
+        
+    }
+    
+    
+    XmlResponseTooLarge::XmlResponseTooLarge(std::size_t sizeLimit) : girerr::error(describeLimit(sizeLimit)) {
+        
+    }
+    
+    
+    std::string XmlResponseTooLarge::describeLimit(std::size_t sizeLimit){
+        
+        std::ostringstream description;
+        description << "XML-RPC response exceeds the limit of " << sizeLimit << " bytes";
+        return description.str();
+        
+    }
+    
+    
+    static OT_MUTEX(s_curlInitMutex);
+    static bool s_curlInitialized = false;
+    
+    // curl_global_init isn't thread safe, so it is done once here rather than left to the first handle
+    static void initializeCurl(){
+        
+        INSTANTIATE_MLOCK(s_curlInitMutex);
+        if(!s_curlInitialized){
+            curl_global_init(CURL_GLOBAL_ALL);
+            s_curlInitialized = true;
+        }
+        mlock.unlock();
+        
+    }
+    
+    
+    struct clientXmlTransport_tcp::CurlHandles {
+        
+        CurlHandles() : easy(nullptr), multi(nullptr) {}
+        
+        CURL *easy; // Synchronous calls
+        CURLM *multi; // Async calls, created with the first one
+        
+    };
+    
+    
+    struct clientXmlTransport_tcp::Transfer {
+        
+        Transfer(std::size_t sizeLimit) : easy(nullptr), headers(nullptr), sizeLimit(sizeLimit), overLimit(false) {error[0] = '\0';}
+        
+        CURL *easy;
+        struct curl_slist *headers;
+        
+        std::string request; // curl reads the request from here rather than copying it
+        std::string response;
+        
+        std::size_t sizeLimit;
+        bool overLimit;
+        
+        char error[CURL_ERROR_SIZE];
+        
+        xmlrpc_c::xmlTransactionPtr transaction; // Async calls only
+        
+    };
+    
+    
+    // curl's write callback. Stops the transfer as soon as the response goes over the limit, rather
+    // than reading the rest of it into memory first.
+    size_t clientXmlTransport_tcp::collectResponse(char *data, size_t size, size_t count, void *userdata){
+        
+        Transfer *transfer = static_cast<Transfer*>(userdata);
+        std::size_t bytes = size * count;
+        
+        // Anything other than bytes fails the transfer with CURLE_WRITE_ERROR
+        if(transfer->response.size() + bytes > transfer->sizeLimit){
+            transfer->overLimit = true;
+            return 0;
+        }
+        
+        transfer->response.append(data, bytes);
+        return bytes;
+        
+    }
+    
+    
+    clientXmlTransport_tcp::clientXmlTransport_tcp(int timeout, std::size_t sizeLimit) : m_timeout(timeout), m_sizeLimit(sizeLimit), m_curl(new CurlHandles()) {
+        
+        initializeCurl();
+        
+        m_curl->easy = curl_easy_init();
+        if(m_curl->easy == nullptr){
+            delete m_curl;
+            throw girerr::error("Unable to create a curl handle");
+        }
+        
+    }
+    
+    
+    clientXmlTransport_tcp::~clientXmlTransport_tcp(){
+        
+        // XmlRPC::finishAsync has already failed anything left over, so these are just let go
+        for(std::size_t x = 0; x < m_transfers.size(); x++){
+            curl_multi_remove_handle(m_curl->multi, m_transfers[x]->easy);
+            curl_easy_cleanup(m_transfers[x]->easy);
+            curl_slist_free_all(m_transfers[x]->headers);
+            delete m_transfers[x];
+        }
+        
+        if(m_curl->multi != nullptr)
+            curl_multi_cleanup(m_curl->multi);
+        curl_easy_cleanup(m_curl->easy);
+        
+        delete m_curl;
+        
+    }
+    
+    
+    void clientXmlTransport_tcp::prepare(Transfer *transfer, xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml){
+        
+        carriageParm_tcp *carriage = dynamic_cast<carriageParm_tcp*>(carriageParmP);
+        if(carriage == nullptr)
+            throw girerr::error("TCP transport called without a server url");
+        
+        transfer->request = callXml;
+        transfer->headers = curl_slist_append(transfer->headers, "Content-Type: text/xml");
+        transfer->headers = curl_slist_append(transfer->headers, "Expect:"); // Don't wait on a 100 Continue
+        
+        CURL *easy = transfer->easy;
+        
+        curl_easy_setopt(easy, CURLOPT_URL, carriage->getUrl().c_str());
+        curl_easy_setopt(easy, CURLOPT_POST, 1L);
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDS, transfer->request.data());
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)transfer->request.size());
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, transfer->headers);
+        curl_easy_setopt(easy, CURLOPT_USERAGENT, "libbmwrapper");
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, &clientXmlTransport_tcp::collectResponse);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, transfer);
+        curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, transfer->error);
+        curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, (long)m_timeout);
+        
+        // Refuses a response whose Content-Length is already over the limit before any of it is read
+        curl_easy_setopt(easy, CURLOPT_MAXFILESIZE_LARGE, (curl_off_t)m_sizeLimit);
+        
+        if(!carriage->getUserPassword().empty()){
+            curl_easy_setopt(easy, CURLOPT_USERPWD, carriage->getUserPassword().c_str());
+            curl_easy_setopt(easy, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+        }
+        
+    }
+    
+    
+    // Throws for a transfer that didn't bring back a whole response with a 200.
+    static void checkTransfer(CURL *easy, CURLcode result, bool overLimit, std::size_t sizeLimit, char const *error){
+        
+        if(overLimit || result == CURLE_FILESIZE_EXCEEDED)
+            throw XmlResponseTooLarge(sizeLimit);
+        
+        if(result != CURLE_OK)
+            throw girerr::error(std::string("Unable to reach API server: ") + (error[0] != '\0' ? error : curl_easy_strerror(result)));
+        
+        long status = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+        
+        if(status != 200){
+            std::ostringstream description;
+            description << "HTTP " << status;
+            throw XmlHttpStatusError(description.str());
+        }
+        
+    }
+    
+    
+    void clientXmlTransport_tcp::call(xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml, std::string * const responseXmlP){
+        
+        // Reset rather than recreated, so curl keeps its connection to the server
+        curl_easy_reset(m_curl->easy);
+        
+        Transfer transfer(m_sizeLimit);
+        transfer.easy = m_curl->easy;
+        
+        try {
+            prepare(&transfer, carriageParmP, callXml);
+            CURLcode result = curl_easy_perform(transfer.easy);
+            checkTransfer(transfer.easy, result, transfer.overLimit, transfer.sizeLimit, transfer.error);
+        } catch (...) {
+            curl_slist_free_all(transfer.headers);
+            throw;
+        }
+        
+        curl_slist_free_all(transfer.headers);
+        responseXmlP->swap(transfer.response);
+        
+    }
+    
+    
+    void clientXmlTransport_tcp::start(xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml, xmlrpc_c::xmlTransactionPtr const& transactionP){
+        
+        if(m_curl->multi == nullptr){
+            m_curl->multi = curl_multi_init();
+            if(m_curl->multi == nullptr)
+                throw girerr::error("Unable to create a curl multi handle");
+        }
+        
+        Transfer *transfer = new Transfer(m_sizeLimit);
+        transfer->transaction = transactionP;
+        transfer->easy = curl_easy_init();
+        
+        try {
+            if(transfer->easy == nullptr)
+                throw girerr::error("Unable to create a curl handle");
+            prepare(transfer, carriageParmP, callXml);
+            if(curl_multi_add_handle(m_curl->multi, transfer->easy) != CURLM_OK)
+                throw girerr::error("Unable to start XML-RPC call");
+        } catch (...) {
+            if(transfer->easy != nullptr)
+                curl_easy_cleanup(transfer->easy);
+            curl_slist_free_all(transfer->headers);
+            delete transfer;
+            throw;
+        }
+        
+        m_transfers.push_back(transfer);
+        
+    }
+    
+    
+    // The timeout isn't needed, each transfer is bound by the transport timeout on its own.
+    void clientXmlTransport_tcp::finishAsync(xmlrpc_c::timeout const){
+        
+        if(m_curl->multi == nullptr)
+            return;
+        
+        int running = 0;
+        do {
+            if(curl_multi_perform(m_curl->multi, &running) != CURLM_OK)
+                break;
+            completeTransfers();
+            if(running > 0)
+                curl_multi_wait(m_curl->multi, nullptr, 0, 1000, nullptr);
+        } while(running > 0);
+        
+        completeTransfers();
+        
+    }
+    
+    
+    // Hands every transfer curl has finished to its transaction.
+    void clientXmlTransport_tcp::completeTransfers(){
+        
+        CURLMsg *message;
+        int remaining;
+        
+        while((message = curl_multi_info_read(m_curl->multi, &remaining)) != nullptr){
+            
+            if(message->msg != CURLMSG_DONE)
+                continue;
+            
+            CURL *easy = message->easy_handle;
+            CURLcode result = message->data.result;
+            
+            std::vector<Transfer*>::iterator it = m_transfers.begin();
+            while(it != m_transfers.end() && (*it)->easy != easy)
+                ++it;
+            if(it == m_transfers.end())
+                continue;
+            
+            Transfer *transfer = *it;
+            m_transfers.erase(it);
+            
+            try {
+                checkTransfer(easy, result, transfer->overLimit, transfer->sizeLimit, transfer->error);
+                transfer->transaction->finish(transfer->response);
+            } catch (girerr::error const& error) {
+                transfer->transaction->finishErr(error);
+            }
+            
+            curl_multi_remove_handle(m_curl->multi, easy);
+            curl_easy_cleanup(easy);
+            curl_slist_free_all(transfer->headers);
+            delete transfer;
+        }
+        
+    }
+    
+    
+    void carriageParm_unix::setUser(std::string const& user, std::string const& pass){
+        
+        m_authorization = base64(user + ":" + pass).encoded();
+        
+    }
+    
+    
+    clientXmlTransport_unix::clientXmlTransport_unix(std::string const& socketPath, int timeout, std::size_t sizeLimit) : m_socketPath(socketPath), m_timeout(timeout), m_sizeLimit(sizeLimit), m_socket(-1) {
+        
+    }
+    
+    
+    clientXmlTransport_unix::~clientXmlTransport_unix(){
+        
+        closeSocket();
+        
+    }
+    
+    
+    void clientXmlTransport_unix::call(xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml, std::string * const responseXmlP){
+        
+        carriageParm_unix *carriage = dynamic_cast<carriageParm_unix*>(carriageParmP);
+        
+        std::ostringstream request;
+        request << "POST " << (carriage != nullptr ? carriage->getUriPath() : std::string("/")) << " HTTP/1.1\r\n"
+                << "Host: localhost\r\n"
+                << "User-Agent: libbmwrapper\r\n"
+                << "Content-Type: text/xml\r\n"
+                << "Content-Length: " << callXml.size() << "\r\n";
+        if(carriage != nullptr && !carriage->getAuthorization().empty())
+            request << "Authorization: Basic " << carriage->getAuthorization() << "\r\n";
+        request << "\r\n" << callXml;
+        
+        try {
+            
+            // A kept-alive connection the server has since closed is replaced before anything is sent on it
+            bool reused = m_socket >= 0;
+            if(reused && !connectionOpen()){
+                closeSocket();
+                reused = false;
+            }
+            if(!reused)
+                connectSocket();
+            
+            bool sent = false;
+            if(!exchange(request.str(), responseXmlP, &sent)){
+                closeSocket();
+                // Only a request none of which went out is safe to send again. Once the server may have
+                // read it, it may also have acted on it, and calls like sendMessage or trashMessage
+                // mustn't run twice.
+                if(!reused || sent)
+                    throw girerr::error("Connection closed by API server at " + m_socketPath);
+                connectSocket();
+                if(!exchange(request.str(), responseXmlP, &sent))
+                    throw girerr::error("Connection closed by API server at " + m_socketPath);
+            }
+            
+        } catch (...) {
+            closeSocket();
+            throw;
+        }
+        
+    }
+    
+    
+    void clientXmlTransport_unix::connectSocket(){
+        
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        
+        if(m_socketPath.size() >= sizeof(address.sun_path))
+            throw girerr::error("Unix socket path is too long: " + m_socketPath);
+        std::strncpy(address.sun_path, m_socketPath.c_str(), sizeof(address.sun_path) - 1);
+        
+        m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(m_socket < 0)
+            throw girerr::error(std::string("Unable to create Unix socket: ") + std::strerror(errno));
+        
+        if(connect(m_socket, (struct sockaddr*)&address, sizeof(address)) != 0){
+            std::string reason(std::strerror(errno));
+            closeSocket();
+            throw girerr::error("Unable to connect to " + m_socketPath + ": " + reason);
+        }
+        
+    }
+    
+    
+    void clientXmlTransport_unix::closeSocket(){
+        
+        if(m_socket >= 0){
+            close(m_socket);
+            m_socket = -1;
+        }
+        m_buffer.clear();
+        
+    }
+    
+    
+    // Whether a kept-alive connection is still usable, without waiting. The server has nothing to say
+    // between responses, so anything readable means it has closed the connection or is about to.
+    bool clientXmlTransport_unix::connectionOpen(){
+        
+        struct pollfd descriptor;
+        descriptor.fd = m_socket;
+        descriptor.events = POLLIN;
+        descriptor.revents = 0;
+        
+        int ready;
+        do {
+            ready = poll(&descriptor, 1, 0);
+        } while(ready < 0 && errno == EINTR);
+        
+        return ready == 0 && m_buffer.empty();
+        
+    }
+    
+    
+    void clientXmlTransport_unix::waitFor(short events){
+        
+        struct pollfd descriptor;
+        descriptor.fd = m_socket;
+        descriptor.events = events;
+        descriptor.revents = 0;
+        
+        int ready;
+        do {
+            ready = poll(&descriptor, 1, m_timeout > 0 ? m_timeout : -1);
+        } while(ready < 0 && errno == EINTR);
+        
+        if(ready == 0)
+            throw girerr::error("Timed out waiting for API server at " + m_socketPath);
+        if(ready < 0)
+            throw girerr::error(std::string("Unable to poll Unix socket: ") + std::strerror(errno));
+        
+    }
+    
+    
+    // Returns false if the server has already closed the connection. sentAny is set once any of the
+    // data has been written.
+    bool clientXmlTransport_unix::sendAll(std::string const& data, bool *sentAny){
+        
+        std::size_t sent = 0;
+        
+        while(sent < data.size()){
+            waitFor(POLLOUT);
+            ssize_t written = send(m_socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if(written < 0){
+                if(errno == EINTR || errno == EAGAIN)
+                    continue;
+                if(errno == EPIPE || errno == ECONNRESET)
+                    return false;
+                throw girerr::error(std::string("Unable to write to API server: ") + std::strerror(errno));
+            }
+            sent += written;
+            *sentAny = true;
+        }
+        
+        return true;
+        
+    }
+    
+    
+    // Reads whatever is available onto m_buffer, returns false once the server has closed the connection.
+    bool clientXmlTransport_unix::receiveMore(){
+        
+        char chunk[65536];
+        
+        while(true){
+            waitFor(POLLIN);
+            ssize_t received = recv(m_socket, chunk, sizeof(chunk), 0);
+            if(received > 0){
+                m_buffer.append(chunk, received);
+                return true;
+            }
+            if(received == 0 || errno == ECONNRESET)
+                return false;
+            if(errno != EINTR && errno != EAGAIN)
+                throw girerr::error(std::string("Unable to read from API server: ") + std::strerror(errno));
+        }
+        
+    }
+    
+    
+    // A chunk size in hex and any extensions after it. A line longer than this is a server that
+    // isn't going to end it.
+    static const std::size_t maxChunkLineLength = 1024;
+    
+    
+    // Sends one request and reads its response. Returns false if the connection turned out to be
+    // closed before any of the response arrived, which is what a stale keep-alive looks like.
+    bool clientXmlTransport_unix::exchange(std::string const& request, std::string *responseXml, bool *sent){
+        
+        if(!sendAll(request, sent))
+            return false;
+        
+        // Every read below is checked against the limit as it goes, so an oversized response is never
+        // read in whole. The connection is closed by the caller, with the rest of the response unread.
+        std::size_t headerEnd;
+        while((headerEnd = m_buffer.find("\r\n\r\n")) == std::string::npos){
+            if(m_buffer.size() > m_sizeLimit)
+                throw XmlResponseTooLarge(m_sizeLimit);
+            if(!receiveMore()){
+                if(m_buffer.empty())
+                    return false;
+                throw girerr::error("API server closed the connection in the middle of a response");
+            }
+        }
+        
+        std::string headers(m_buffer, 0, headerEnd);
+        m_buffer.erase(0, headerEnd + 4);
+        
+        // Status line first, then one header per line
+        std::istringstream lines(headers);
+        std::string statusLine;
+        std::getline(lines, statusLine);
+        
+        std::size_t statusStart = statusLine.find(' ');
+        int status = statusStart != std::string::npos ? std::atoi(statusLine.c_str() + statusStart + 1) : 0;
+        
+        long long contentLength = -1;
+        bool chunked = false;
+        bool closeAfter = statusLine.compare(0, 8, "HTTP/1.0") == 0;
+        
+        std::string line;
+        while(std::getline(lines, line)){
+            std::size_t colon = line.find(':');
+            if(colon == std::string::npos)
+                continue;
+            
+            std::string name(line, 0, colon);
+            std::string value(line, colon + 1);
+            for(unsigned int x = 0; x < name.size(); x++)
+                name[x] = (char)std::tolower((unsigned char)name[x]);
+            for(unsigned int x = 0; x < value.size(); x++)
+                value[x] = (char)std::tolower((unsigned char)value[x]);
+            
+            if(name == "content-length")
+                contentLength = std::atoll(value.c_str());
+            else if(name == "transfer-encoding" && value.find("chunked") != std::string::npos)
+                chunked = true;
+            else if(name == "connection" && value.find("close") != std::string::npos)
+                closeAfter = true;
+            else if(name == "connection" && value.find("keep-alive") != std::string::npos)
+                closeAfter = false;
+        }
+        
+        std::string body;
+        
+        if(chunked){
+            while(true){
+                std::size_t lineEnd;
+                while((lineEnd = m_buffer.find("\r\n")) == std::string::npos){
+                    if(m_buffer.size() > maxChunkLineLength)
+                        throw XmlResponseTooLarge(m_sizeLimit);
+                    if(!receiveMore())
+                        throw girerr::error("API server closed the connection in the middle of a response");
+                }
+                std::size_t chunkSize = std::strtoul(m_buffer.c_str(), nullptr, 16);
+                m_buffer.erase(0, lineEnd + 2);
+                
+                if(chunkSize > m_sizeLimit || body.size() + chunkSize > m_sizeLimit)
+                    throw XmlResponseTooLarge(m_sizeLimit);
+                
+                // Each chunk is followed by a CRLF, the last one by optional trailers and a blank line
+                if(chunkSize == 0){
+                    while(m_buffer.find("\r\n") != 0){
+                        std::size_t trailerEnd = m_buffer.find("\r\n");
+                        if(trailerEnd != std::string::npos)
+                            m_buffer.erase(0, trailerEnd + 2);
+                        else if(m_buffer.size() > m_sizeLimit)
+                            throw XmlResponseTooLarge(m_sizeLimit);
+                        else if(!receiveMore())
+                            break;
+                    }
+                    if(m_buffer.size() >= 2)
+                        m_buffer.erase(0, 2);
+                    break;
+                }
+                
+                while(m_buffer.size() < chunkSize + 2){
+                    if(!receiveMore())
+                        throw girerr::error("API server closed the connection in the middle of a response");
+                }
+                body.append(m_buffer, 0, chunkSize);
+                m_buffer.erase(0, chunkSize + 2);
+            }
+        }
+        else if(contentLength >= 0){
+            if((unsigned long long)contentLength > m_sizeLimit)
+                throw XmlResponseTooLarge(m_sizeLimit);
+            while((long long)m_buffer.size() < contentLength){
+                if(!receiveMore())
+                    throw girerr::error("API server closed the connection in the middle of a response");
+            }
+            body.assign(m_buffer, 0, contentLength);
+            m_buffer.erase(0, contentLength);
+        }
+        else{
+            // No length given, the body runs until the server hangs up.
+            while(receiveMore()){
+                if(m_buffer.size() > m_sizeLimit)
+                    throw XmlResponseTooLarge(m_sizeLimit);
+            }
+            body.swap(m_buffer);
+            closeAfter = true;
+        }
+        
+        if(closeAfter)
+            closeSocket();
+        
+        if(status != 200)
+            throw XmlHttpStatusError(statusLine);
+        
+        responseXml->swap(body);
+        return true;
+        
+    }
+    
+}
@@ -0,0 +1,198 @@
+#pragma once
+//
+//  XmlTransport.h
+//
+
+#include <string>
+#include <vector>
+
+#include <xmlrpc-c/girerr.hpp>
+#include <xmlrpc-c/base.hpp>
+#include <xmlrpc-c/client.hpp>
+
+#include "BMThreading.h"
+
+namespace bmwrapper {
+    
+    // How XmlRPC reaches the API server, picked from the server url it is given:
+    //   "unix:/path/to/socket"  HTTP over a Unix domain socket
+    //   "inproc:name"           a handler registered in this process under name
+    //   anything else           HTTP over TCP through curl
+    //
+    // The socket transports stop reading a response as soon as it goes over their size limit, and
+    // fail the call with XmlResponseTooLarge.
+    enum class XmlTransportType {
+        
+        TCP,
+        UNIX,
+        INPROC
+        
+    };
+    
+    
+    // Anything that can answer an XML-RPC call document with a response document.
+    class XmlRPCHandler {
+        
+    public:
+        
+        virtual ~XmlRPCHandler(){}
+        virtual void processCall(std::string const& callXml, std::string *responseXml) = 0;
+        
+    };
+    
+    // Makes a handler reachable through "inproc:name". The handler is not owned, and must be
+    // unregistered before it is destroyed.
+    void registerXmlRPCHandler(std::string const& name, XmlRPCHandler *handler);
+    void unregisterXmlRPCHandler(std::string const& name);
+    
+    
+    // Thrown, or handed to an async call's finishErr, when a response goes over the transport's size limit.
+    class XmlResponseTooLarge : public girerr::error {
+        
+    public:
+        
+        XmlResponseTooLarge(std::size_t sizeLimit);
+        
+    private:
+        
+        static std::string describeLimit(std::size_t sizeLimit);
+        
+    };
+    
+    
+    // Thrown, or handed to an async call's finishErr, when the API server answers with an HTTP status
+    // other than 200. The server is up, so this doesn't count against it the way a transport failure does.
+    class XmlHttpStatusError : public girerr::error {
+        
+    public:
+        
+        XmlHttpStatusError(std::string const& status) : girerr::error("API server answered with " + status) {}
+        
+    };
+    
+    
+    // Carriage parameters for clientXmlTransport_tcp, the server's url and optional basic auth.
+    class carriageParm_tcp : public xmlrpc_c::carriageParm {
+        
+    public:
+        
+        carriageParm_tcp(std::string const& url) : m_url(url) {}
+        
+        void setUser(std::string const& user, std::string const& pass){m_userPassword = user + ":" + pass;}
+        
+        std::string const& getUrl() const {return m_url;}
+        std::string const& getUserPassword() const {return m_userPassword;}
+        
+    private:
+        
+        std::string m_url;
+        std::string m_userPassword; // Empty without auth
+        
+    };
+    
+    
+    // HTTP over TCP through libcurl. Synchronous calls share one curl handle, so curl keeps the
+    // connection alive between them. Async calls are carried concurrently by the curl multi interface
+    // once finishAsync is called.
+    class clientXmlTransport_tcp : public xmlrpc_c::clientXmlTransport {
+        
+    public:
+        
+        // timeout in milliseconds and sizeLimit in bytes, both per call
+        clientXmlTransport_tcp(int timeout, std::size_t sizeLimit);
+        ~clientXmlTransport_tcp();
+        
+        void call(xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml, std::string * const responseXmlP);
+        void start(xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml, xmlrpc_c::xmlTransactionPtr const& transactionP);
+        void finishAsync(xmlrpc_c::timeout const timeout);
+        
+    private:
+        
+        struct Transfer;
+        struct CurlHandles;
+        
+        int m_timeout;
+        std::size_t m_sizeLimit;
+        
+        CurlHandles *m_curl; // Kept out of this header, so it doesn't need curl's
+        std::vector<Transfer*> m_transfers; // Started and not finished yet
+        
+        void prepare(Transfer *transfer, xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml);
+        void completeTransfers();
+        
+        static size_t collectResponse(char *data, size_t size, size_t count, void *userdata);
+        
+    };
+    
+    
+    // Carriage parameters for clientXmlTransport_unix, the HTTP request path and optional basic auth.
+    class carriageParm_unix : public xmlrpc_c::carriageParm {
+        
+    public:
+        
+        carriageParm_unix(std::string uriPath="/") : m_uriPath(uriPath) {}
+        
+        void setUser(std::string const& user, std::string const& pass);
+        
+        std::string const& getUriPath() const {return m_uriPath;}
+        std::string const& getAuthorization() const {return m_authorization;}
+        
+    private:
+        
+        std::string m_uriPath;
+        std::string m_authorization; // Already base64 encoded
+        
+    };
+    
+    
+    // HTTP/1.1 over a Unix domain socket. The socket is kept open between calls and reopened
+    // if the server closes it. Async calls run synchronously, one at a time.
+    class clientXmlTransport_unix : public xmlrpc_c::clientXmlTransport {
+        
+    public:
+        
+        clientXmlTransport_unix(std::string const& socketPath, int timeout, std::size_t sizeLimit);
+        ~clientXmlTransport_unix();
+        
+        void call(xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml, std::string * const responseXmlP);
+        
+    private:
+        
+        std::string m_socketPath;
+        int m_timeout; // Milliseconds, per read or write
+        std::size_t m_sizeLimit; // Bytes, per response
+        int m_socket;
+        
+        // Bytes read past the end of the last response
+        std::string m_buffer;
+        
+        void connectSocket();
+        void closeSocket();
+        
+        bool connectionOpen();
+        void waitFor(short events);
+        bool sendAll(std::string const& data, bool *sentAny);
+        bool receiveMore();
+        
+        // sent is set once any of the request has gone out
+        bool exchange(std::string const& request, std::string *responseXml, bool *sent);
+        
+    };
+    
+    
+    // Hands calls straight to a registered XmlRPCHandler, with no sockets or HTTP involved.
+    class clientXmlTransport_inproc : public xmlrpc_c::clientXmlTransport {
+        
+    public:
+        
+        clientXmlTransport_inproc(std::string const& name) : m_name(name) {}
+        
+        void call(xmlrpc_c::carriageParm * const carriageParmP, std::string const& callXml, std::string * const responseXmlP);
+        
+    private:
+        
+        std::string m_name;
+        
+    };
+    
+}
@@ -1,137 +1,531 @@
 /*
  base64.cpp and base64.h
- 
+
  Copyright (C) 2004-2008 René Nyffenegger
- 
+
  This source code is provided 'as-is', without any express or implied
  warranty. In no event will the author be held liable for any damages
  arising from the use of this software.
- 
+
  Permission is granted to anyone to use this software for any purpose,
  including commercial applications, and to alter it and redistribute it
  freely, subject to the following restrictions:
- 
+
  1. The origin of this source code must not be misrepresented; you must not
  claim that you wrote the original source code. If you use this source code
  in a product, an acknowledgment in the product documentation would be
  appreciated but is not required.
- 
+
  2. Altered source versions must be plainly marked as such, and must not be
  misrepresented as being the original source code.
- 
+
  3. This notice may not be removed or altered from any source distribution.
- 
+
  René Nyffenegger rene.nyffenegger@adp-gmbh.ch
- 
+
  */
 
 /*
- 
+
  NOTICE - This source has been modified from the original for inclusion in the "base64" class as part of the libbmwrapper project.
- 
+
  Please visit http://www.adp-gmbh.ch/cpp/common/base64.html for more information about the original source code.
- 
+
  */
 
 
 #include "base64.h"
+#include "base64_internal.h"
+
+// The SSSE3 and AVX2 kernels are compiled with per-function target attributes and only run when
+// the CPU reports support at runtime, so the library still builds for and runs on any x86.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define BMWRAPPER_BASE64_SIMD 1
+#  include <immintrin.h>
+#endif
 
 namespace bmwrapper {
     
     
-    static const std::string base64_chars =
+    static const char base64_chars[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
     "abcdefghijklmnopqrstuvwxyz"
     "0123456789+/";
     
+    // Character to 6-bit value, 0xff for anything that isn't in the alphabet (including '=').
+    static const unsigned char base64_values[256] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+        0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+    };
+    
+    
+    /*
+     * Scalar kernels
+     */
     
-    static inline bool is_base64(unsigned char c) {
-        return (isalnum(c) || (c == '+') || (c == '/'));
+    
+    // Encodes whole 3 byte groups, returns the number of input bytes consumed.
+    static std::size_t encodeScalar(unsigned char const* in, std::size_t len, char *out){
+        
+        std::size_t consumed = 0;
+        
+        for(; consumed + 3 <= len; consumed += 3, in += 3, out += 4){
+            unsigned int group = (in[0] << 16) | (in[1] << 8) | in[2];
+            out[0] = base64_chars[(group >> 18) & 0x3f];
+            out[1] = base64_chars[(group >> 12) & 0x3f];
+            out[2] = base64_chars[(group >> 6) & 0x3f];
+            out[3] = base64_chars[group & 0x3f];
+        }
+        
+        return consumed;
+        
     }
     
     
-    std::string base64::p_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
-        std::string ret;
-        int i = 0;
-        int j = 0;
-        unsigned char char_array_3[3];
-        unsigned char char_array_4[4];
-        
-        while (in_len--) {
-            char_array_3[i++] = *(bytes_to_encode++);
-            if (i == 3) {
-                char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-                char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-                char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-                char_array_4[3] = char_array_3[2] & 0x3f;
-                
-                for(i = 0; (i <4) ; i++)
-                    ret += base64_chars[char_array_4[i]];
-                i = 0;
-            }
+    // Decodes whole 4 character groups, stopping at the first group that holds anything outside
+    // the alphabet. Returns the number of characters consumed.
+    static std::size_t decodeScalar(unsigned char const* in, std::size_t len, char *out){
+        
+        std::size_t consumed = 0;
+        
+        for(; consumed + 4 <= len; consumed += 4, in += 4, out += 3){
+            unsigned int a = base64_values[in[0]], b = base64_values[in[1]], c = base64_values[in[2]], d = base64_values[in[3]];
+            if((a | b | c | d) & 0x80)
+                break;
+            unsigned int group = (a << 18) | (b << 12) | (c << 6) | d;
+            out[0] = (char)(group >> 16);
+            out[1] = (char)(group >> 8);
+            out[2] = (char)group;
+        }
+        
+        return consumed;
+        
+    }
+    
+    
+#ifdef BMWRAPPER_BASE64_SIMD
+    
+    /*
+     * SIMD kernels
+     *
+     * These follow Wojciech Muła's vectorised base64 ("Faster Base64 Encoding and Decoding Using
+     * AVX2 Instructions", Muła & Lemire). The encoders take 12 (or 24) input bytes per 16 (or 32)
+     * characters, the decoders the reverse. A decoder stops at the first block holding a character
+     * outside the alphabet and leaves it to the scalar code.
+     */
+    
+    
+    // Maps 6-bit indices to their characters, see the paper for how the offsets are picked.
+    __attribute__((target("ssse3")))
+    static inline __m128i encodeLookupSSSE3(__m128i indices){
+        
+        const __m128i shiftLUT = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                               '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        
+        __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+        
+        return _mm_add_epi8(_mm_shuffle_epi8(shiftLUT, result), indices);
+        
+    }
+    
+    
+    // Spreads each 3 byte group over 4 bytes holding one 6-bit index each.
+    __attribute__((target("ssse3")))
+    static inline __m128i encodeUnpackSSSE3(__m128i in){
+        
+        in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        
+        const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        
+        return _mm_or_si128(t1, t3);
+        
+    }
+    
+    
+    __attribute__((target("ssse3")))
+    static std::size_t encodeSSSE3(unsigned char const* in, std::size_t len, char *out){
+        
+        std::size_t consumed = 0;
+        
+        // Each load reads 16 bytes but only uses 12
+        for(; consumed + 16 <= len; consumed += 12, in += 12, out += 16){
+            const __m128i indices = encodeUnpackSSSE3(_mm_loadu_si128((const __m128i*)in));
+            _mm_storeu_si128((__m128i*)out, encodeLookupSSSE3(indices));
+        }
+        
+        return consumed;
+        
+    }
+    
+    
+    // Turns 16 characters into their 6-bit values, returns false if any of them isn't base64.
+    __attribute__((target("ssse3")))
+    static inline bool decodeLookupSSSE3(__m128i in, __m128i &values){
+        
+        const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                              0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+        
+        const __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibbleMask);
+        const __m128i loNibbles = _mm_and_si128(in, nibbleMask);
+        const __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+        const __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+        
+        if(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+            return false;
+        
+        const __m128i eqSlash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+        const __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eqSlash, hiNibbles));
+        
+        values = _mm_add_epi8(in, roll);
+        return true;
+        
+    }
+    
+    
+    // Packs 16 6-bit values into 12 bytes, at the bottom of the register.
+    __attribute__((target("ssse3")))
+    static inline __m128i decodePackSSSE3(__m128i values){
+        
+        const __m128i mergeAB = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+        const __m128i merged = _mm_madd_epi16(mergeAB, _mm_set1_epi32(0x00011000));
+        
+        return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        
+    }
+    
+    
+    // Writes 16 bytes per 12 decoded, the caller leaves room for the overhang.
+    __attribute__((target("ssse3")))
+    static std::size_t decodeSSSE3(unsigned char const* in, std::size_t len, char *out){
+        
+        std::size_t consumed = 0;
+        
+        for(; consumed + 16 <= len; consumed += 16, in += 16, out += 12){
+            __m128i values;
+            if(!decodeLookupSSSE3(_mm_loadu_si128((const __m128i*)in), values))
+                break;
+            _mm_storeu_si128((__m128i*)out, decodePackSSSE3(values));
         }
         
-        if (i)
-        {
-            for(j = i; j < 3; j++)
-                char_array_3[j] = '\0';
+        return consumed;
+        
+    }
+    
+    
+    __attribute__((target("avx2")))
+    static std::size_t encodeAVX2(unsigned char const* in, std::size_t len, char *out){
+        
+        const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+        const __m256i shiftLUT = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                                  '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                                  'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                                  '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        
+        std::size_t consumed = 0;
+        
+        // Each lane gets 12 bytes, the second load reads 16 bytes starting 12 in
+        for(; consumed + 28 <= len; consumed += 24, in += 24, out += 32){
+            
+            __m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)in)),
+                                                    _mm_loadu_si128((const __m128i*)(in + 12)), 1);
+            block = _mm256_shuffle_epi8(block, shuffle);
             
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
+            const __m256i t0 = _mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00));
+            const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+            const __m256i t2 = _mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0));
+            const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+            const __m256i indices = _mm256_or_si256(t1, t3);
             
-            for (j = 0; (j < i + 1); j++)
-                ret += base64_chars[char_array_4[j]];
+            __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+            result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+            result = _mm256_add_epi8(_mm256_shuffle_epi8(shiftLUT, result), indices);
             
-            while((i++ < 3))
-                ret += '=';
+            _mm256_storeu_si256((__m256i*)out, result);
             
         }
         
-        return ret;
+        return consumed;
         
     }
     
-    std::string base64::p_decode(std::string const& encoded_string) {
-        int in_len = encoded_string.size();
-        int i = 0;
-        int j = 0;
-        int in_ = 0;
-        unsigned char char_array_4[4], char_array_3[3];
-        std::string ret;
+    
+    // Writes 32 bytes per 24 decoded, the caller leaves room for the overhang.
+    __attribute__((target("avx2")))
+    static std::size_t decodeAVX2(unsigned char const* in, std::size_t len, char *out){
+        
+        const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                               0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                               0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                               0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                               0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                               0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                               0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                                 0, 0, 0, 0, 0, 0, 0, 0,
+                                                 0, 16, 19, 4, -65, -65, -71, -71,
+                                                 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                              2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+        
+        std::size_t consumed = 0;
+        
+        for(; consumed + 32 <= len; consumed += 32, in += 32, out += 24){
+            
+            const __m256i block = _mm256_loadu_si256((const __m256i*)in);
+            
+            const __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(block, 4), nibbleMask);
+            const __m256i loNibbles = _mm256_and_si256(block, nibbleMask);
+            const __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+            const __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+            
+            if(!_mm256_testz_si256(lo, hi))
+                break;
+            
+            const __m256i eqSlash = _mm256_cmpeq_epi8(block, _mm256_set1_epi8('/'));
+            const __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eqSlash, hiNibbles));
+            const __m256i values = _mm256_add_epi8(block, roll);
+            
+            const __m256i mergeAB = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            __m256i merged = _mm256_madd_epi16(mergeAB, _mm256_set1_epi32(0x00011000));
+            merged = _mm256_shuffle_epi8(merged, pack);
+            merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+            
+            _mm256_storeu_si256((__m256i*)out, merged);
+            
+        }
+        
+        return consumed;
+        
+    }
+    
+#endif
+    
+    
+    /*
+     * Dispatch
+     */
+    
+    
+    typedef std::size_t (*Base64Kernel)(unsigned char const* in, std::size_t len, char *out);
+    
+    struct Base64Kernels {
         
-        while (in_len-- && ( encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-            char_array_4[i++] = encoded_string[in_]; in_++;
-            if (i ==4) {
-                for (i = 0; i <4; i++)
-                    char_array_4[i] = base64_chars.find(char_array_4[i]);
-                
-                char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-                char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-                char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-                
-                for (i = 0; (i < 3); i++)
-                    ret += char_array_3[i];
-                i = 0;
+        Base64Kernels() : encode(encodeScalar), decode(decodeScalar) {
+#ifdef BMWRAPPER_BASE64_SIMD
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx2")){
+                encode = encodeAVX2;
+                decode = decodeAVX2;
             }
+            else if(__builtin_cpu_supports("ssse3")){
+                encode = encodeSSSE3;
+                decode = decodeSSSE3;
+            }
+#endif
         }
         
-        if (i) {
-            for (j = i; j <4; j++)
-                char_array_4[j] = 0;
+        Base64Kernel encode;
+        Base64Kernel decode;
+        
+    };
+    
+    
+    // Picked once, on first use. Only the tests change them after that.
+    static Base64Kernels& base64Kernels(){
+        static Base64Kernels kernels;
+        return kernels;
+    }
+    
+    
+    bool base64_internal::kernelSupported(Kernel kernel){
+        
+        switch(kernel){
+            case Kernel::SCALAR:
+                return true;
+#ifdef BMWRAPPER_BASE64_SIMD
+            case Kernel::SSSE3:
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("ssse3");
+            case Kernel::AVX2:
+                __builtin_cpu_init();
+                return __builtin_cpu_supports("avx2");
+#endif
+            default:
+                return false;
+        }
+        
+    }
+    
+    
+    bool base64_internal::setKernel(Kernel kernel){
+        
+        if(!kernelSupported(kernel))
+            return false;
+        
+        Base64Kernels &kernels = base64Kernels();
+        
+        switch(kernel){
+#ifdef BMWRAPPER_BASE64_SIMD
+            case Kernel::SSSE3:
+                kernels.encode = encodeSSSE3;
+                kernels.decode = decodeSSSE3;
+                break;
+            case Kernel::AVX2:
+                kernels.encode = encodeAVX2;
+                kernels.decode = decodeAVX2;
+                break;
+#endif
+            default:
+                kernels.encode = encodeScalar;
+                kernels.decode = decodeScalar;
+                break;
+        }
+        
+        return true;
+        
+    }
+    
+    
+    // The largest number of bytes a decode kernel writes past the data it has decoded.
+    static const std::size_t decodeOverhang = 8;
+    
+    
+    std::string base64::p_encode(unsigned char const* bytes_to_encode, unsigned int in_len) {
+        
+        std::string ret;
+        if(in_len == 0)
+            return ret;
+        
+        ret.resize(((std::size_t)in_len + 2) / 3 * 4);
+        char *out = &ret[0];
+        
+        std::size_t consumed = base64Kernels().encode(bytes_to_encode, in_len, out);
+        consumed += encodeScalar(bytes_to_encode + consumed, in_len - consumed, out + consumed / 3 * 4);
+        
+        // One or two bytes left over, padded out with '='
+        std::size_t remaining = in_len - consumed;
+        if(remaining){
             
-            for (j = 0; j <4; j++)
-                char_array_4[j] = base64_chars.find(char_array_4[j]);
+            unsigned char const* in = bytes_to_encode + consumed;
+            char *tail = out + consumed / 3 * 4;
             
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+            unsigned int group = (in[0] << 16) | (remaining > 1 ? in[1] << 8 : 0);
+            tail[0] = base64_chars[(group >> 18) & 0x3f];
+            tail[1] = base64_chars[(group >> 12) & 0x3f];
+            tail[2] = remaining > 1 ? base64_chars[(group >> 6) & 0x3f] : '=';
+            tail[3] = '=';
             
-            for (j = 0; (j < i - 1); j++) ret += char_array_3[j];
         }
         
         return ret;
+        
+    }
+    
+    
+    // Line breaks, spaces and tabs.
+    static inline bool isWrapSpace(unsigned char c){
+        return c == '\n' || c == '\r' || c == ' ' || c == '\t';
+    }
+    
+    
+    // Whitespace is skipped in the same pass, so line wrapped data (as the API returns message bodies)
+    // decodes without being cleaned up first. Decoding stops at the first '=' or any other character
+    // outside the alphabet, with whatever came before it decoded, as it always has.
+    std::string base64::decode(std::string const& encoded_string) {
+        
+        std::string ret;
+        std::size_t in_len = encoded_string.size();
+        if(in_len == 0)
+            return ret;
+        
+        unsigned char const* in = (unsigned char const*)encoded_string.data();
+        
+        ret.resize(in_len / 4 * 3 + decodeOverhang);
+        char *out = &ret[0];
+        
+        Base64Kernel kernel = base64Kernels().decode;
+        
+        std::size_t position = 0;
+        std::size_t written = 0;
+        
+        while(true){
+            
+            // Runs of clean data go through the fast kernels
+            std::size_t consumed = kernel(in + position, in_len - position, out + written);
+            written += consumed / 4 * 3;
+            position += consumed;
+            
+            consumed = decodeScalar(in + position, in_len - position, out + written);
+            written += consumed / 4 * 3;
+            position += consumed;
+            
+            // Then one group at a time across the whitespace, the padding or the end
+            unsigned int values[4] = {0, 0, 0, 0};
+            int count = 0;
+            while(count < 4 && position < in_len){
+                unsigned char value = base64_values[in[position]];
+                if(value != 0xff)
+                    values[count++] = value;
+                else if(!isWrapSpace(in[position]))
+                    break;
+                position++;
+            }
+            
+            unsigned int group = (values[0] << 18) | (values[1] << 12) | (values[2] << 6) | values[3];
+            
+            if(count == 4){
+                out[written++] = (char)(group >> 16);
+                out[written++] = (char)(group >> 8);
+                out[written++] = (char)group;
+                continue;
+            }
+            
+            // A partial group gives a byte less than its count of characters
+            if(count > 1)
+                out[written++] = (char)(group >> 16);
+            if(count > 2)
+                out[written++] = (char)(group >> 8);
+            
+            break;
+            
+        }
+        
+        ret.resize(written);
+        return ret;
+        
+    }
+    
+    
+    std::string base64::p_decode(std::string const& encoded_string) {
+        return decode(encoded_string);
     }
     
     
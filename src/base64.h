@@ -12,11 +12,19 @@ namespace bmwrapper {
         
     public:
         
-        base64(std::string msg="", bool packed=false){if(packed)m_data = msg;else{m_data = p_encode((const unsigned char *)msg.c_str(), msg.size());}}
+        base64(std::string msg="", bool packed=false){if(packed)m_data.swap(msg);else{m_data = p_encode((const unsigned char *)msg.c_str(), msg.size());}}
         
         
+        // Packed data may be line wrapped, decoded() skips the whitespace.
         std::string encoded() const {return m_data;}
-        std::string decoded() {return p_decode(m_data);}
+        const std::string& encodedRef() const {return m_data;}
+        std::string decoded() const {return decode(m_data);}
+        
+        // Moves the packed data out, leaving this empty.
+        std::string release(){std::string data; data.swap(m_data); return data;}
+        
+        // Decodes packed data without wrapping it in a base64 first.
+        static std::string decode(std::string const& encoded);
         
         
         // Our Operator Overloads
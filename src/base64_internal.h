@@ -0,0 +1,29 @@
+#pragma once
+//
+//  base64_internal.h
+//  Not installed. Lets the tests run the codec through each of its kernels in turn.
+//
+
+namespace bmwrapper {
+    
+    namespace base64_internal {
+        
+        enum class Kernel {
+            
+            SCALAR,
+            SSSE3,
+            AVX2
+            
+        };
+        
+        // Whether this build has the kernel and the CPU can run it.
+        bool kernelSupported(Kernel kernel);
+        
+        // Sends every later encode and decode through kernel, in place of the one picked for the CPU.
+        // Returns false, changing nothing, if the kernel isn't supported. Not safe while another thread
+        // is encoding or decoding.
+        bool setKernel(Kernel kernel);
+        
+    }
+    
+}
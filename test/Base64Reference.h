@@ -0,0 +1,15 @@
+#pragma once
+//
+//  Base64Reference.h
+//  The base64 codec as it was before the table driven rewrite, kept so the tests can check the
+//  library's encoder and decoder against it byte for byte.
+//
+
+#include <string>
+
+namespace bmwrapper {
+    
+    std::string referenceBase64Encode(unsigned char const* bytes_to_encode, unsigned int in_len);
+    std::string referenceBase64Decode(std::string const& encoded_string);
+    
+}
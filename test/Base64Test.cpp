@@ -0,0 +1,197 @@
+//
+//  Base64Test.cpp
+//  Differential test of the library's base64 codec against the reference one in Base64Reference.
+//
+//  The SIMD kernels encode 12 or 24 bytes and decode 16 or 32 characters at a time, so lengths are
+//  run on either side of every one of those block edges, alongside wrapped input, stray characters
+//  and '=' padding in every position. Every check runs once per kernel the CPU supports, not just
+//  through the one the library would pick.
+//
+
+#include "base64.h"
+#include "base64_internal.h"
+#include "Base64Reference.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <random>
+
+using namespace bmwrapper;
+
+
+static int failures = 0;
+
+static void check(bool passed, std::string const& what, std::size_t length){
+    
+    if(!passed){
+        std::cerr << "FAIL: " << what << " (length " << length << ")" << std::endl;
+        failures++;
+    }
+    
+}
+
+
+static bool isWrapSpace(char c){
+    return c == '\n' || c == '\r' || c == ' ' || c == '\t';
+}
+
+
+static std::string unwrapped(std::string encoded){
+    
+    encoded.erase(std::remove_if(encoded.begin(), encoded.end(), isWrapSpace), encoded.end());
+    return encoded;
+    
+}
+
+
+// Wrapped the way PyBitmessage sends it, a newline every 76 columns, or with CRLF.
+static std::string wrapped(std::string const& encoded, std::string const& lineBreak){
+    
+    std::string wrapped;
+    for(std::size_t x = 0; x < encoded.size(); x += 76)
+        wrapped += encoded.substr(x, 76) + lineBreak;
+    return wrapped;
+    
+}
+
+
+static std::string randomBytes(std::mt19937 &random, std::size_t length){
+    
+    std::uniform_int_distribution<int> byte(0, 255);
+    
+    std::string plain;
+    plain.reserve(length);
+    for(std::size_t x = 0; x < length; x++)
+        plain += (char)byte(random);
+    return plain;
+    
+}
+
+
+// Every length up to a few blocks of the widest kernel, and around the block edges further out.
+static std::vector<std::size_t> testLengths(){
+    
+    std::vector<std::size_t> lengths;
+    
+    for(std::size_t length = 0; length <= 200; length++)
+        lengths.push_back(length);
+    
+    const std::size_t blocks[] = {12, 16, 24, 32};
+    for(std::size_t x = 0; x < sizeof(blocks) / sizeof(blocks[0]); x++){
+        for(std::size_t multiple = 8; multiple <= 64; multiple *= 2){
+            std::size_t edge = blocks[x] * multiple;
+            lengths.push_back(edge - 1);
+            lengths.push_back(edge);
+            lengths.push_back(edge + 1);
+        }
+    }
+    
+    return lengths;
+    
+}
+
+
+static void testRoundTrip(std::mt19937 &random, std::size_t length){
+    
+    std::string plain = randomBytes(random, length);
+    std::string encoded = base64(plain).encoded();
+    
+    check(encoded == referenceBase64Encode((const unsigned char *)plain.c_str(), plain.size()), "encode differs from the reference", length);
+    check(base64(encoded, true).decoded() == plain, "decode does not round trip", length);
+    check(base64::decode(encoded) == referenceBase64Decode(encoded), "decode differs from the reference", length);
+    
+    check(base64::decode(wrapped(encoded, "\n")) == plain, "decode of newline wrapped input", length);
+    check(base64::decode(wrapped(encoded, "\r\n")) == plain, "decode of CRLF wrapped input", length);
+    
+}
+
+
+// The decoder stops at the first '=' wherever it is, the way the reference one does.
+static void testPadding(std::mt19937 &random, std::size_t length){
+    
+    std::string encoded = base64(randomBytes(random, length)).encoded();
+    
+    for(std::size_t position = 0; position <= encoded.size(); position++){
+        
+        std::string padded = encoded;
+        padded.insert(position, "=");
+        check(base64::decode(padded) == referenceBase64Decode(padded), "'=' inside the input", length);
+        
+        std::string doubled = encoded.substr(0, position) + "==";
+        check(base64::decode(doubled) == referenceBase64Decode(doubled), "'==' ending the input", length);
+        
+    }
+    
+}
+
+
+// Alphabet characters with whitespace and characters from outside the alphabet mixed in. Whitespace
+// is skipped and anything else stops the decoder, in the same place as the reference.
+static void testStrayCharacters(std::mt19937 &random, std::size_t length){
+    
+    const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const std::string stray = "=\n\r\t -_.\x80\xff";
+    
+    std::string dirty;
+    dirty.reserve(length);
+    for(std::size_t x = 0; x < length; x++)
+        dirty += random() % 64 == 0 ? stray[random() % stray.size()] : alphabet[random() % alphabet.size()];
+    
+    check(base64::decode(dirty) == referenceBase64Decode(unwrapped(dirty)), "decode with stray characters", length);
+    
+}
+
+
+static void testKernel(){
+    
+    std::mt19937 random(7);
+    
+    std::vector<std::size_t> lengths = testLengths();
+    
+    for(std::size_t x = 0; x < lengths.size(); x++){
+        testRoundTrip(random, lengths[x]);
+        testStrayCharacters(random, lengths[x]);
+    }
+    
+    // Quadratic in the length, so only up to a few blocks of the widest kernel
+    for(std::size_t length = 0; length <= 100; length++)
+        testPadding(random, length);
+    
+    for(int x = 0; x < 2000; x++){
+        std::size_t length = random() % 8192;
+        testRoundTrip(random, length);
+        testStrayCharacters(random, length);
+    }
+    
+}
+
+
+int main(){
+    
+    const base64_internal::Kernel kernels[] = {base64_internal::Kernel::SCALAR, base64_internal::Kernel::SSSE3, base64_internal::Kernel::AVX2};
+    const char *names[] = {"scalar", "SSSE3", "AVX2"};
+    
+    for(std::size_t x = 0; x < sizeof(kernels) / sizeof(kernels[0]); x++){
+        
+        if(!base64_internal::setKernel(kernels[x])){
+            std::cout << "Skipping the " << names[x] << " kernel, this CPU doesn't support it" << std::endl;
+            continue;
+        }
+        
+        int before = failures;
+        testKernel();
+        
+        if(failures > before)
+            std::cerr << failures - before << " checks failed with the " << names[x] << " kernel" << std::endl;
+    }
+    
+    if(failures > 0){
+        std::cerr << failures << " base64 checks failed" << std::endl;
+        return 1;
+    }
+    
+    return 0;
+    
+}
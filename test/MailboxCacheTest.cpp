@@ -0,0 +1,110 @@
+//
+//  MailboxCacheTest.cpp
+//  Checks that what a session changed locally comes back from the on-disk cache after a restart.
+//
+//  The first instance loads its mailbox from the mock server, marks a message read and saves the cache
+//  as it is destroyed. The second starts with the server gone, so everything it has comes from the cache.
+//
+
+#include "BitMessage.h"
+#include "XmlTransport.h"
+#include "MockBitMessageServer.h"
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <iostream>
+
+using namespace bmwrapper;
+
+
+static int failures = 0;
+
+static void check(bool passed, std::string const& what){
+    
+    if(!passed){
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+    
+}
+
+
+static _SharedPtr<NetworkMail> findMail(std::vector<_SharedPtr<NetworkMail> > const& inbox, std::string const& messageID){
+    
+    for(std::size_t x = 0; x < inbox.size(); x++){
+        if(inbox[x]->getMessageIDRef() == messageID)
+            return inbox[x];
+    }
+    
+    return _SharedPtr<NetworkMail>();
+    
+}
+
+
+static void testReadSurvivesRestart(std::string const& cachePath){
+    
+    MockServerOptions options;
+    options.inboxSize = 8;
+    options.sentSize = 4;
+    
+    MockBitMessageServer server(options);
+    registerXmlRPCHandler("cachetest", &server);
+    
+    std::string commstring = "inproc:cachetest,0,test,test," + cachePath;
+    
+    std::string readID;
+    std::string deletedID;
+    
+    {
+        BitMessage session(commstring);
+        
+        std::vector<_SharedPtr<NetworkMail> > inbox = session.getInbox();
+        check(inbox.size() == 8, "first session loads the server's inbox");
+        
+        for(std::size_t x = 0; x < inbox.size(); x++){
+            if(inbox[x]->getRead() == false && readID == "")
+                readID = inbox[x]->getMessageIDRef();
+            else if(deletedID == "")
+                deletedID = inbox[x]->getMessageIDRef();
+        }
+        check(readID != "" && deletedID != "", "the inbox has a message to mark read and one to delete");
+        
+        check(session.markRead(readID), "markRead finds the message");
+        check(session.deleteMessage(deletedID), "deleteMessage finds the message");
+    }
+    
+    // The second session can only have what the first saved
+    unregisterXmlRPCHandler("cachetest");
+    
+    {
+        BitMessage session(commstring);
+        
+        std::vector<_SharedPtr<NetworkMail> > inbox = session.getInbox();
+        check(inbox.size() == 7, "second session loads the inbox from the cache, without the deleted message");
+        
+        _SharedPtr<NetworkMail> read = findMail(inbox, readID);
+        check(read && read->getRead(), "a message marked read is still read after a restart");
+        check(!findMail(inbox, deletedID), "a deleted message stays deleted after a restart");
+    }
+    
+}
+
+
+int main(){
+    
+    std::string cachePath = "bmwrapper-test-mailboxcache.cache";
+    std::remove(cachePath.c_str());
+    
+    testReadSurvivesRestart(cachePath);
+    
+    std::remove(cachePath.c_str());
+    
+    if(failures > 0){
+        std::cerr << failures << " mailbox cache checks failed" << std::endl;
+        return 1;
+    }
+    
+    return 0;
+    
+}